@@ -0,0 +1,512 @@
+/*
+ * ai.cc - Computer controlled players
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/ai.h"
+
+#include <algorithm>
+
+#include "src/game.h"
+#include "src/player.h"
+#include "src/flag.h"
+#include "src/inventory.h"
+#include "src/pathfinder.h"
+#include "src/debug.h"
+
+/* Construction sites the AI keeps going at the same time. */
+#define AI_MAX_MILITARY_SITES  2
+#define AI_MAX_ECONOMY_SITES   3
+
+/* Positions tried for a new building on each attempt. */
+#define AI_SITE_CANDIDATES  12
+
+/* Flags tried as the other end of the road to a new building, and the
+   work counted for each road search. */
+#define AI_ROAD_TRIES  3
+#define AI_ROAD_COST   32
+
+/* Offsets into the spiral pattern where rings 4 and 8 around the
+   position start. */
+#define AI_SPIRAL_RING_4  37
+#define AI_SPIRAL_RING_8  169
+
+/* Knights needed beyond the defenders before attacking. */
+#define AI_ATTACK_MARGIN  1
+
+typedef struct {
+  building_type_t type;
+  int count;
+} ai_build_order_t;
+
+/* Economy buildings in the order they are wanted. An entry is done
+   when the player has count buildings of the type, finished or not. */
+static const ai_build_order_t build_order[] = {
+  { BUILDING_LUMBERJACK, 1 },
+  { BUILDING_STONECUTTER, 1 },
+  { BUILDING_SAWMILL, 1 },
+  { BUILDING_FORESTER, 1 },
+  { BUILDING_LUMBERJACK, 2 },
+  { BUILDING_FISHER, 1 },
+  { BUILDING_FARM, 1 },
+  { BUILDING_MILL, 1 },
+  { BUILDING_BAKER, 1 },
+  { BUILDING_FORESTER, 2 },
+  { BUILDING_STONECUTTER, 2 },
+  { BUILDING_PIGFARM, 1 },
+  { BUILDING_BUTCHER, 1 },
+  { BUILDING_COALMINE, 1 },
+  { BUILDING_IRONMINE, 1 },
+  { BUILDING_STEELSMELTER, 1 },
+  { BUILDING_TOOLMAKER, 1 },
+  { BUILDING_WEAPONSMITH, 1 },
+  { BUILDING_GOLDMINE, 1 },
+  { BUILDING_GOLDSMELTER, 1 },
+  { BUILDING_LUMBERJACK, 3 },
+  { BUILDING_FISHER, 2 },
+  { BUILDING_FARM, 2 },
+  { BUILDING_COALMINE, 2 },
+  { BUILDING_NONE, 0 }
+};
+
+/* Unfinished entries of the build order the AI picks from. Entries
+   that can't be placed now don't hold up the ones after them. */
+#define AI_BUILD_CHOICES  3
+
+ai_t::ai_t(game_t *game, player_t *player)
+  : rnd(static_cast<uint16_t>(0x5a5a + player->get_index()), 0x3c1f,
+        static_cast<uint16_t>(player->get_face())) {
+  this->game = game;
+  map = game->get_map();
+  this->player = player;
+  credit = 0;
+  next_task = AI_TASK_EXPAND;
+  cache_tick = 0;
+  cache_valid = false;
+  next_target = 0;
+}
+
+void
+ai_t::add_credit(int ticks) {
+  credit = std::min(credit + ticks * AI_CREDIT_PER_TICK, AI_MAX_CREDIT);
+}
+
+void
+ai_t::update() {
+  while (credit > 0) {
+    credit -= run_task();
+  }
+}
+
+/* Run the next task. Returns the work spent on it. */
+int
+ai_t::run_task() {
+  if (!player->has_castle()) return place_castle();
+
+  if (!cache_valid ||
+      game->get_tick() - cache_tick >= AI_CACHE_TICKS) {
+    return refresh_cache();
+  }
+
+  task_t task = static_cast<task_t>(next_task);
+  next_task = (next_task + 1) % AI_TASK_COUNT;
+
+  switch (task) {
+  case AI_TASK_EXPAND: return expand();
+  case AI_TASK_ECONOMY: return grow_economy();
+  case AI_TASK_ATTACK: return attack();
+  default: NOT_REACHED(); break;
+  }
+
+  return 1;
+}
+
+/* Try a few random positions for the initial castle. */
+int
+ai_t::place_castle() {
+  const int tries = 32;
+  for (int i = 0; i < tries; i++) {
+    map_pos_t pos = map->pos(random_int() & map->get_col_mask(),
+                             random_int() & map->get_row_mask());
+    if (game->can_build_castle(pos, player)) {
+      game->build_castle(pos, player);
+      cache_valid = false;
+      break;
+    }
+  }
+
+  return tries;
+}
+
+/* Take the lists of military buildings from the game. */
+int
+ai_t::refresh_cache() {
+  own_military.clear();
+  enemy_military.clear();
+
+  int count = 0;
+  for (unsigned int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    player_t *other = game->get_player(i);
+    if (other == NULL) continue;
+
+    list_buildings_t buildings = game->get_player_buildings(other);
+    for (list_buildings_t::iterator it = buildings.begin();
+         it != buildings.end(); ++it) {
+      building_t *building = *it;
+      count += 1;
+      if (!building->is_military()) continue;
+      if (other == player) {
+        own_military.push_back(building->get_index());
+      } else {
+        enemy_military.push_back(building->get_index());
+      }
+    }
+  }
+
+  cache_tick = game->get_tick();
+  cache_valid = true;
+
+  return 1 + count / 8;
+}
+
+building_t *
+ai_t::get_own_building(unsigned int index) {
+  building_t *building = game->get_building(index);
+  if (building == NULL || building->get_owner() != player->get_index()) {
+    return NULL;
+  }
+  return building;
+}
+
+/* Build a military building where it gains the most land. */
+int
+ai_t::expand() {
+  int cost = 1;
+  if (own_military.empty()) return cost;
+
+  int sites = player->get_incomplete_building_count(BUILDING_HUT) +
+              player->get_incomplete_building_count(BUILDING_TOWER) +
+              player->get_incomplete_building_count(BUILDING_FORTRESS);
+  if (sites >= AI_MAX_MILITARY_SITES) return cost;
+
+  building_t *base =
+    get_own_building(own_military[random_int() % own_military.size()]);
+  if (base == NULL || !base->is_done()) return cost;
+
+  map_pos_t best_pos = bad_map_pos;
+  int best_score = 0;
+  for (int i = 0; i < AI_SITE_CANDIDATES; i++) {
+    unsigned int offset = AI_SPIRAL_RING_4 +
+      random_int() % (AI_SPIRAL_RING_8 - AI_SPIRAL_RING_4);
+    map_pos_t pos = map->pos_add_spirally(base->get_position(), offset);
+    cost += 1;
+    if (!game->can_build_building(pos, BUILDING_HUT, player)) continue;
+
+    cost += 4;
+    int score = score_site(pos, BUILDING_HUT);
+    if (score > best_score) {
+      best_pos = pos;
+      best_score = score;
+    }
+  }
+
+  if (best_pos == bad_map_pos) return cost;
+
+  building_type_t type = BUILDING_HUT;
+  if (game->can_build_building(best_pos, BUILDING_TOWER, player) &&
+      player->get_completed_building_count(BUILDING_HUT) > 2 &&
+      (random_int() & 3) == 0) {
+    type = BUILDING_TOWER;
+  }
+
+  if (build_and_connect(best_pos, type, &cost)) {
+    own_military.push_back(map->get_obj_index(best_pos));
+  }
+
+  return cost;
+}
+
+/* Build the next wanted economy building near one of the military
+   buildings. */
+int
+ai_t::grow_economy() {
+  int cost = 1;
+  if (own_military.empty()) return cost;
+
+  int sites = 0;
+  for (int type = BUILDING_FISHER; type <= BUILDING_GOLDSMELTER; type++) {
+    if (type == BUILDING_HUT || type == BUILDING_TOWER ||
+        type == BUILDING_FORTRESS) {
+      continue;
+    }
+    sites += player->get_incomplete_building_count(type);
+  }
+  if (sites >= AI_MAX_ECONOMY_SITES) return cost;
+
+  building_type_t choices[AI_BUILD_CHOICES];
+  int choice_count = 0;
+  for (int i = 0; build_order[i].type != BUILDING_NONE &&
+                  choice_count < AI_BUILD_CHOICES; i++) {
+    building_type_t type = build_order[i].type;
+    int count = player->get_completed_building_count(type) +
+                player->get_incomplete_building_count(type);
+    if (count >= build_order[i].count) continue;
+
+    bool listed = false;
+    for (int j = 0; j < choice_count; j++) {
+      if (choices[j] == type) listed = true;
+    }
+    if (!listed) choices[choice_count++] = type;
+  }
+  if (choice_count == 0) return cost;
+
+  building_type_t type = choices[random_int() % choice_count];
+  building_t *base =
+    get_own_building(own_military[random_int() % own_military.size()]);
+  if (base == NULL || !base->is_done()) return cost;
+
+  map_pos_t best_pos = bad_map_pos;
+  int best_score = 0;
+  for (int i = 0; i < AI_SITE_CANDIDATES; i++) {
+    unsigned int offset = 7 + random_int() % (AI_SPIRAL_RING_8 - 7);
+    map_pos_t pos = map->pos_add_spirally(base->get_position(), offset);
+    cost += 1;
+    if (!game->can_build_building(pos, type, player)) continue;
+
+    cost += 4;
+    int score = score_site(pos, type);
+    if (score > best_score) {
+      best_pos = pos;
+      best_score = score;
+    }
+  }
+
+  if (best_pos != bad_map_pos) {
+    build_and_connect(best_pos, type, &cost);
+  }
+
+  return cost;
+}
+
+/* How well a buildable position suits the building type, 0 if not at
+   all. */
+int
+ai_t::score_site(map_pos_t pos, building_type_t type) {
+  int score = 0;
+
+  switch (type) {
+  case BUILDING_HUT:
+  case BUILDING_TOWER:
+  case BUILDING_FORTRESS:
+    /* Land that is not ours yet. */
+    for (int i = 0; i < AI_SPIRAL_RING_4 + 24; i++) {
+      map_pos_t p = map->pos_add_spirally(pos, i);
+      if (!map->has_owner(p) || map->get_owner(p) != player->get_index()) {
+        score += 1;
+      }
+    }
+    break;
+  case BUILDING_LUMBERJACK:
+  case BUILDING_FORESTER:
+    for (int i = 0; i < AI_SPIRAL_RING_4; i++) {
+      map_obj_t obj = map->get_obj(map->pos_add_spirally(pos, i));
+      if (obj >= MAP_OBJ_TREE_0 && obj <= MAP_OBJ_PINE_7) score += 1;
+    }
+    if (type == BUILDING_FORESTER) score += 1;
+    break;
+  case BUILDING_STONECUTTER:
+    for (int i = 0; i < AI_SPIRAL_RING_4; i++) {
+      map_obj_t obj = map->get_obj(map->pos_add_spirally(pos, i));
+      if (obj >= MAP_OBJ_STONE_0 && obj <= MAP_OBJ_STONE_7) score += 1;
+    }
+    break;
+  case BUILDING_FISHER:
+    for (int i = 0; i < AI_SPIRAL_RING_4; i++) {
+      if (map->is_water_tile(map->pos_add_spirally(pos, i))) score += 1;
+    }
+    break;
+  case BUILDING_STONEMINE:
+  case BUILDING_COALMINE:
+  case BUILDING_IRONMINE:
+  case BUILDING_GOLDMINE: {
+    ground_deposit_t deposit = GROUND_DEPOSIT_NONE;
+    switch (type) {
+    case BUILDING_STONEMINE: deposit = GROUND_DEPOSIT_STONE; break;
+    case BUILDING_COALMINE: deposit = GROUND_DEPOSIT_COAL; break;
+    case BUILDING_IRONMINE: deposit = GROUND_DEPOSIT_IRON; break;
+    case BUILDING_GOLDMINE: deposit = GROUND_DEPOSIT_GOLD; break;
+    default: NOT_REACHED(); break;
+    }
+    for (int i = 0; i < 7; i++) {
+      map_pos_t p = map->pos_add_spirally(pos, i);
+      if (map->get_res_type(p) == deposit) score += map->get_res_amount(p);
+    }
+    break;
+  }
+  default:
+    /* Anywhere will do. */
+    score = 1;
+    break;
+  }
+
+  return score;
+}
+
+/* Place the building and connect its flag to the road network. The
+   building is taken down again if no road can be found. */
+bool
+ai_t::build_and_connect(map_pos_t pos, building_type_t type, int *cost) {
+  map_pos_t flag_pos = map->move_down_right(pos);
+  if (!game->build_building(pos, type, player)) return false;
+
+  if (connect_flag(flag_pos, cost)) return true;
+
+  game->demolish_building(pos, player);
+  flag_t *flag = game->get_flag_at_pos(flag_pos);
+  if (flag != NULL && flag->paths() == 0) {
+    game->demolish_flag(flag_pos, player);
+  }
+
+  return false;
+}
+
+/* Whether serfs can walk from flag to base. */
+bool
+ai_t::is_connected(flag_t *flag, flag_t *base) {
+  if (base == NULL) return (flag->land_paths() != 0);
+  if (flag == base) return true;
+  return (game->get_path_cache()->get_next_dir(flag, base) != DIR_NONE);
+}
+
+/* Build a road from the flag at pos to one of the nearest flags that
+   are connected to an inventory. */
+bool
+ai_t::connect_flag(map_pos_t pos, int *cost) {
+  flag_t *flag = game->get_flag_at_pos(pos);
+  if (flag == NULL) return false;
+
+  flag_t *base = NULL;
+  list_inventories_t inventories = game->get_player_inventories(player);
+  if (!inventories.empty()) {
+    base = game->get_flag(inventories.front()->get_flag_index());
+  }
+
+  if (flag->land_paths() != 0 && is_connected(flag, base)) return true;
+
+  int tries = 0;
+  for (int i = 1; i < AI_SPIRAL_RING_8 && tries < AI_ROAD_TRIES; i++) {
+    map_pos_t other_pos = map->pos_add_spirally(pos, i);
+    if (!map->has_flag(other_pos)) continue;
+
+    flag_t *other = game->get_flag_at_pos(other_pos);
+    if (other->get_owner() != player->get_index() ||
+        !is_connected(other, base)) {
+      continue;
+    }
+
+    tries += 1;
+    road_t road = pathfinder_map(map, pos, other_pos);
+    *cost += AI_ROAD_COST + static_cast<int>(road.get_length());
+    if (road.is_valid() && game->build_road(road, player)) {
+      place_road_flags(road);
+      return true;
+    }
+  }
+
+  *cost += AI_SPIRAL_RING_8 / 8;
+
+  return false;
+}
+
+/* Put flags along a new road so that it gets more transporters. */
+void
+ai_t::place_road_flags(const road_t &road) {
+  road_t::dirs_t dirs = road.get_dirs();
+  size_t length = dirs.size();
+  map_pos_t pos = road.get_source();
+  size_t i = 0;
+  for (road_t::dirs_t::iterator it = dirs.begin(); it != dirs.end(); ++it) {
+    pos = map->move(pos, *it);
+    i += 1;
+    if (i % 2 == 0 && i + 2 <= length) {
+      game->build_flag(pos, player);
+    }
+  }
+}
+
+/* Attacks are only allowed on buildings near own land, as in the user
+   interface. */
+bool
+ai_t::can_reach(building_t *target) {
+  for (int i = 7; i < 265; i++) {
+    map_pos_t pos = map->pos_add_spirally(target->get_position(), i);
+    if (map->has_owner(pos) && map->get_owner(pos) == player->get_index()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Attack the next enemy military building if enough knights are near
+   it. */
+int
+ai_t::attack() {
+  int cost = 1;
+  if (enemy_military.empty()) return cost;
+
+  unsigned int index = enemy_military[next_target % enemy_military.size()];
+  next_target += 1;
+
+  building_t *target = game->get_building(index);
+  if (target == NULL || !target->is_military() ||
+      target->get_owner() == player->get_index() ||
+      !target->is_done() || !target->is_active() ||
+      target->get_state() != 3) {
+    return cost;
+  }
+
+  cost += 16;
+  if (!can_reach(target)) return cost;
+
+  int defenders = target->get_knight_count();
+  int max_knights = 0;
+  switch (target->get_type()) {
+  case BUILDING_HUT: max_knights = 3; break;
+  case BUILDING_TOWER: max_knights = 6; break;
+  case BUILDING_FORTRESS: max_knights = 12; break;
+  case BUILDING_CASTLE:
+    max_knights = 20;
+    defenders = game->get_player(target->get_owner())->get_castle_knights();
+    break;
+  default: NOT_REACHED(); break;
+  }
+
+  cost += 64;
+  int knights = player->knights_available_for_attack(target->get_position());
+  if (knights <= defenders + AI_ATTACK_MARGIN ||
+      player->attacking_building_count == 0) {
+    return cost;
+  }
+
+  player->building_attacked = target->get_index();
+  player->knights_attacking = std::min(knights, max_knights);
+  player->start_attack();
+
+  return cost;
+}
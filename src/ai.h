@@ -0,0 +1,103 @@
+/*
+ * ai.h - Computer controlled players
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_AI_H_
+#define SRC_AI_H_
+
+#include <vector>
+
+#include "src/map.h"
+#include "src/building.h"
+#include "src/random.h"
+
+class game_t;
+class player_t;
+class flag_t;
+
+/* Work a computer player may do for each game tick. The player acts on
+   its turn only and spends what it saved up since the last one, up to
+   AI_MAX_CREDIT. A unit is about one can_build_*() query. */
+#define AI_CREDIT_PER_TICK  16
+#define AI_MAX_CREDIT       512
+
+/* Game ticks between refreshes of the building lists of an AI. */
+#define AI_CACHE_TICKS  1000
+
+/* Computer controlled opponent. It only uses the same game functions as
+   the user interface: it places the castle, builds military buildings
+   near the border, grows a basic economy connected by roads, and
+   attacks enemy buildings that it has enough knights for. Decisions
+   only depend on the game state and the AI's own random state, so
+   copies of a game stay equal. */
+class ai_t {
+ protected:
+  typedef enum {
+    AI_TASK_EXPAND = 0,
+    AI_TASK_ECONOMY,
+    AI_TASK_ATTACK,
+
+    AI_TASK_COUNT
+  } task_t;
+
+  game_t *game;
+  map_t *map;
+  player_t *player;
+
+  random_state_t rnd;
+  int credit;
+  int next_task;
+
+  /* Indexes of the own military buildings and of the enemy military
+     buildings, taken every AI_CACHE_TICKS. Entries are checked again
+     before use as the buildings may be gone. */
+  std::vector<unsigned int> own_military;
+  std::vector<unsigned int> enemy_military;
+  unsigned int cache_tick;
+  bool cache_valid;
+  unsigned int next_target;
+
+ public:
+  ai_t(game_t *game, player_t *player);
+
+  /* Save up work for ticks game ticks. */
+  void add_credit(int ticks);
+  /* Act on the player's turn until the saved up work is spent. */
+  void update();
+
+ protected:
+  int run_task();
+  int place_castle();
+  int expand();
+  int grow_economy();
+  int attack();
+  int refresh_cache();
+
+  building_t *get_own_building(unsigned int index);
+  bool build_and_connect(map_pos_t pos, building_type_t type, int *cost);
+  bool connect_flag(map_pos_t pos, int *cost);
+  void place_road_flags(const road_t &road);
+  bool is_connected(flag_t *flag, flag_t *base);
+  int score_site(map_pos_t pos, building_type_t type);
+  bool can_reach(building_t *target);
+  unsigned int random_int() { return rnd.random(); }
+};
+
+#endif  // SRC_AI_H_
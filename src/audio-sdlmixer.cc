@@ -31,6 +31,11 @@
 #include "src/data.h"
 #include "src/data-source.h"
 
+/* Number of mixer channels for sound effects, and how many of them
+   sounds from the game world may use. */
+#define SFX_VOICES        16
+#define SFX_WORLD_VOICES  12
+
 audio_t *
 audio_t::get_instance() {
   if (instance == NULL) {
@@ -59,15 +64,15 @@ audio_sdlmixer_t::audio_sdlmixer_t() {
     assert(false);
   }
 
-  r = Mix_AllocateChannels(16);
-  if (r != 16) {
+  r = Mix_AllocateChannels(SFX_VOICES);
+  if (r != SFX_VOICES) {
     LOGE("audio-sdlmixer", "Failed to allocate channels: %s.", Mix_GetError());
     assert(false);
   }
 
   volume = 1.f;
 
-  sfx_player = new sfx_player_t();
+  sfx_player = new sfx_player_t(SFX_VOICES, SFX_WORLD_VOICES);
   midi_player = new midi_player_t();
 }
 
@@ -125,6 +130,66 @@ audio_sdlmixer_t::volume_down() {
   set_volume(volume - 0.1f);
 }
 
+sfx_player_t::sfx_player_t(unsigned int voice_count,
+                           unsigned int world_voice_count)
+  : voices(voice_count, world_voice_count) {
+  unsigned int loaded = 0;
+  for (unsigned int i = 0; i < audio_voice_manager_t::get_sound_count(); i++) {
+    int sound = audio_voice_manager_t::get_sound(i);
+    audio_track_t *track = create_track(sound);
+    if (track != NULL) {
+      track_cache[sound] = track;
+      loaded++;
+    }
+  }
+
+  LOGV("audio-sdlmixer", "Loaded %u sound effects.", loaded);
+}
+
+void
+sfx_player_t::play_track(int track_id) {
+  play_track_at(track_id, 0.f, 1.f);
+}
+
+void
+sfx_player_t::play_track_at(int track_id, float pan, float volume) {
+  if (!is_enabled() || volume <= 0.f) {
+    return;
+  }
+
+  sfx_track_t *track = NULL;
+  track_cache_t::iterator it = track_cache.find(track_id);
+  if (it != track_cache.end()) {
+    track = static_cast<sfx_track_t*>(it->second);
+  } else {
+    track = static_cast<sfx_track_t*>(create_track(track_id));
+    if (track == NULL) {
+      return;
+    }
+    track_cache[track_id] = track;
+  }
+
+  /* Channels that stopped playing are free again. */
+  for (unsigned int i = 0; i < voices.get_voice_count(); i++) {
+    if (voices.is_busy(i) && !Mix_Playing(i)) {
+      voices.release(i);
+    }
+  }
+
+  int channel = voices.allocate(track_id, SDL_GetTicks());
+  if (channel < 0) {
+    return;
+  }
+
+  if (Mix_Playing(channel)) {
+    Mix_HaltChannel(channel);
+  }
+
+  if (!track->play_channel(channel, pan, volume)) {
+    voices.release(channel);
+  }
+}
+
 audio_track_t *
 sfx_player_t::create_track(int track_id) {
   data_t *data = data_t::get_instance();
@@ -193,10 +258,27 @@ sfx_track_t::~sfx_track_t() {
 
 void
 sfx_track_t::play() {
-  int r = Mix_PlayChannel(-1, chunk, 0);
+  play_channel(-1);
+}
+
+bool
+sfx_track_t::play_channel(int channel, float pan, float volume) {
+  /* Full volume in the centre unregisters the panning effect. */
+  if (channel >= 0) {
+    volume = std::max(0.f, std::min(volume, 1.f));
+    pan = std::max(-1.f, std::min(pan, 1.f));
+    float left = 255.f * volume * std::min(1.f, 1.f - pan);
+    float right = 255.f * volume * std::min(1.f, 1.f + pan);
+    Mix_SetPanning(channel, static_cast<Uint8>(left),
+                   static_cast<Uint8>(right));
+  }
+
+  int r = Mix_PlayChannel(channel, chunk, 0);
   if (r < 0) {
     LOGE("audio-sdlmixer", "Could not play SFX clip: %s.", Mix_GetError());
+    return false;
   }
+  return true;
 }
 
 midi_player_t::midi_player_t() {
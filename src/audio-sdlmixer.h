@@ -38,10 +38,20 @@ class sfx_track_t : public audio_track_t {
   virtual ~sfx_track_t();
 
   virtual void play();
+  bool play_channel(int channel, float pan = 0.f, float volume = 1.f);
 };
 
+/* All sound effects are converted when the player is created, so that
+   playing a sound never has to decode it. */
 class sfx_player_t : public audio_player_t, public audio_volume_controller_t {
+ protected:
+  audio_voice_manager_t voices;
+
  public:
+  sfx_player_t(unsigned int voice_count, unsigned int world_voice_count);
+
+  virtual void play_track(int track_id);
+  virtual void play_track_at(int track_id, float pan, float volume);
   virtual void enable(bool enable);
   virtual audio_volume_controller_t *get_volume_controller() { return this; }
 
@@ -24,6 +24,7 @@
 #include <algorithm>
 
 #include "src/log.h"
+#include "src/freeserf.h"
 
 audio_t *audio_t::instance = NULL;
 
@@ -60,3 +61,165 @@ audio_player_t::play_track(int track_id) {
     track->play();
   }
 }
+
+void
+audio_player_t::play_track_at(int track_id, float pan, float volume) {
+  if (volume > 0.f) {
+    play_track(track_id);
+  }
+}
+
+typedef enum {
+  SFX_PRIORITY_AMBIENT = 0,
+  SFX_PRIORITY_WORK,
+  SFX_PRIORITY_EVENT,
+  SFX_PRIORITY_INTERFACE,
+} sfx_priority_t;
+
+typedef struct {
+  int sound;
+  sfx_priority_t priority;
+  unsigned int limit;
+} sfx_info_t;
+
+/* Priority and maximum number of simultaneous voices of each sound. */
+static const sfx_info_t sfx_info[] = {
+  { SFX_MESSAGE,            SFX_PRIORITY_INTERFACE, 1 },
+  { SFX_ACCEPTED,           SFX_PRIORITY_INTERFACE, 1 },
+  { SFX_NOT_ACCEPTED,       SFX_PRIORITY_INTERFACE, 1 },
+  { SFX_UNDO,               SFX_PRIORITY_INTERFACE, 1 },
+  { SFX_CLICK,              SFX_PRIORITY_INTERFACE, 1 },
+  { SFX_FIGHT_01,           SFX_PRIORITY_EVENT,     3 },
+  { SFX_FIGHT_02,           SFX_PRIORITY_EVENT,     3 },
+  { SFX_FIGHT_03,           SFX_PRIORITY_EVENT,     3 },
+  { SFX_FIGHT_04,           SFX_PRIORITY_EVENT,     3 },
+  { SFX_RESOURCE_FOUND,     SFX_PRIORITY_EVENT,     1 },
+  { SFX_PICK_BLOW,          SFX_PRIORITY_WORK,      2 },
+  { SFX_METAL_HAMMERING,    SFX_PRIORITY_WORK,      2 },
+  { SFX_AX_BLOW,            SFX_PRIORITY_WORK,      2 },
+  { SFX_TREE_FALL,          SFX_PRIORITY_EVENT,     2 },
+  { SFX_WOOD_HAMMERING,     SFX_PRIORITY_WORK,      2 },
+  { SFX_ELEVATOR,           SFX_PRIORITY_WORK,      1 },
+  { SFX_HAMMER_BLOW,        SFX_PRIORITY_WORK,      2 },
+  { SFX_SAWING,             SFX_PRIORITY_WORK,      1 },
+  { SFX_MILL_GRINDING,      SFX_PRIORITY_WORK,      1 },
+  { SFX_BACKSWORD_BLOW,     SFX_PRIORITY_WORK,      2 },
+  { SFX_GEOLOGIST_SAMPLING, SFX_PRIORITY_WORK,      2 },
+  { SFX_PLANTING,           SFX_PRIORITY_WORK,      2 },
+  { SFX_DIGGING,            SFX_PRIORITY_WORK,      2 },
+  { SFX_MOWING,             SFX_PRIORITY_WORK,      2 },
+  { SFX_FISHING_ROD_REEL,   SFX_PRIORITY_WORK,      2 },
+  { SFX_UNKNOWN_21,         SFX_PRIORITY_WORK,      2 },
+  { SFX_PIG_OINK,           SFX_PRIORITY_AMBIENT,   1 },
+  { SFX_GOLD_BOILS,         SFX_PRIORITY_WORK,      1 },
+  { SFX_ROWING,             SFX_PRIORITY_WORK,      2 },
+  { SFX_UNKNOWN_25,         SFX_PRIORITY_WORK,      2 },
+  { SFX_SERF_DYING,         SFX_PRIORITY_EVENT,     3 },
+  { SFX_BIRD_CHIRP_0,       SFX_PRIORITY_AMBIENT,   1 },
+  { SFX_BIRD_CHIRP_1,       SFX_PRIORITY_AMBIENT,   1 },
+  { SFX_AHHH,               SFX_PRIORITY_EVENT,     2 },
+  { SFX_BIRD_CHIRP_2,       SFX_PRIORITY_AMBIENT,   1 },
+  { SFX_BIRD_CHIRP_3,       SFX_PRIORITY_AMBIENT,   1 },
+  { SFX_BURNING,            SFX_PRIORITY_EVENT,     2 },
+  { SFX_UNKNOWN_28,         SFX_PRIORITY_WORK,      2 },
+  { SFX_UNKNOWN_29,         SFX_PRIORITY_WORK,      2 },
+  { -1,                     SFX_PRIORITY_AMBIENT,   0 }
+};
+
+static const sfx_info_t *
+get_sfx_info(int sound) {
+  for (const sfx_info_t *info = sfx_info; info->sound >= 0; info++) {
+    if (info->sound == sound) return info;
+  }
+  return NULL;
+}
+
+audio_voice_manager_t::audio_voice_manager_t(unsigned int voice_count,
+                                             unsigned int world_voice_count) {
+  voice_t voice = { -1, 0, 0 };
+  voices.resize(voice_count, voice);
+  this->world_voice_count = std::min(world_voice_count, voice_count);
+}
+
+int
+audio_voice_manager_t::allocate(int sound, unsigned int now) {
+  unsigned int tick = now / TICK_LENGTH;
+  last_start_t::iterator last = last_start.find(sound);
+  if (last != last_start.end() && last->second == tick) {
+    return -1;
+  }
+
+  unsigned int priority = get_priority(sound);
+  unsigned int limit = get_limit(sound);
+
+  int free_voice = -1;
+  int victim = -1;
+  unsigned int playing = 0;
+  unsigned int world_playing = 0;
+  for (size_t i = 0; i < voices.size(); i++) {
+    const voice_t &voice = voices[i];
+    if (voice.sound < 0) {
+      if (free_voice < 0) free_voice = i;
+      continue;
+    }
+
+    if (voice.sound == sound) playing++;
+    if (voice.priority < SFX_PRIORITY_INTERFACE) world_playing++;
+
+    /* Lowest priority first, then the oldest. */
+    if (voice.priority < priority &&
+        (victim < 0 || voice.priority < voices[victim].priority ||
+         (voice.priority == voices[victim].priority &&
+          voice.start < voices[victim].start))) {
+      victim = i;
+    }
+  }
+
+  if (playing >= limit) {
+    return -1;
+  }
+
+  if (priority < SFX_PRIORITY_INTERFACE &&
+      world_playing >= world_voice_count) {
+    free_voice = -1;
+  }
+
+  int result = (free_voice >= 0) ? free_voice : victim;
+  if (result < 0) {
+    return -1;
+  }
+
+  voices[result].sound = sound;
+  voices[result].priority = priority;
+  voices[result].start = now;
+  last_start[sound] = tick;
+
+  return result;
+}
+
+void
+audio_voice_manager_t::release(int voice) {
+  voices[voice].sound = -1;
+}
+
+unsigned int
+audio_voice_manager_t::get_priority(int sound) {
+  const sfx_info_t *info = get_sfx_info(sound);
+  return (info != NULL) ? info->priority : SFX_PRIORITY_WORK;
+}
+
+unsigned int
+audio_voice_manager_t::get_limit(int sound) {
+  const sfx_info_t *info = get_sfx_info(sound);
+  return (info != NULL) ? info->limit : 2;
+}
+
+unsigned int
+audio_voice_manager_t::get_sound_count() {
+  return sizeof(sfx_info) / sizeof(sfx_info[0]) - 1;
+}
+
+int
+audio_voice_manager_t::get_sound(unsigned int index) {
+  return sfx_info[index].sound;
+}
@@ -24,6 +24,7 @@
 #define SRC_AUDIO_H_
 
 #include <map>
+#include <vector>
 
 typedef enum {
   SFX_MESSAGE = 1,
@@ -102,6 +103,9 @@ class audio_player_t {
   virtual ~audio_player_t();
 
   virtual void play_track(int track_id);
+  /* Play positioned relative to the listener. pan goes from -1 (left)
+     to 1 (right) and volume from 0 to 1. */
+  virtual void play_track_at(int track_id, float pan, float volume);
   virtual void enable(bool enable) = 0;
   virtual bool is_enabled() const { return enabled; }
   virtual audio_volume_controller_t *get_volume_controller() = 0;
@@ -111,6 +115,48 @@ class audio_player_t {
   virtual void stop() = 0;
 };
 
+/* Assigns sound effects to a fixed number of mixer voices.
+   A sound started again in the same game tick is dropped, each sound
+   has a limit of voices it may use at once and when all voices are busy
+   the oldest sound of the lowest priority below the new one is stopped
+   to make room. Sounds from the game world may only take up to
+   world_voice_count voices so that interface sounds always play. */
+class audio_voice_manager_t {
+ protected:
+  typedef struct {
+    int sound;
+    unsigned int priority;
+    unsigned int start;
+  } voice_t;
+
+  std::vector<voice_t> voices;
+  unsigned int world_voice_count;
+  typedef std::map<int, unsigned int> last_start_t;
+  last_start_t last_start;
+
+ public:
+  audio_voice_manager_t(unsigned int voice_count,
+                        unsigned int world_voice_count);
+
+  unsigned int get_voice_count() const { return voices.size(); }
+
+  /* Voice to play sound on at time now (in milliseconds), or -1 if the
+     sound should be dropped. A voice that is still busy must be stopped
+     before it is reused. */
+  int allocate(int sound, unsigned int now);
+
+  /* Mark voice as finished playing. */
+  void release(int voice);
+  bool is_busy(int voice) const { return voices[voice].sound >= 0; }
+
+  static unsigned int get_priority(int sound);
+  static unsigned int get_limit(int sound);
+
+  /* Sound effects known to the game. */
+  static unsigned int get_sound_count();
+  static int get_sound(unsigned int index);
+};
+
 class audio_t {
  protected:
   static audio_t *instance;
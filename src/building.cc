@@ -44,6 +44,15 @@ building_t::building_t(game_t *game, unsigned int index)
   }
 
   serf_index = 0;
+
+  wake();
+}
+
+/* Put the building back into the set of buildings updated each tick.
+   Called whenever something that is_idle() depends on changes. */
+void
+building_t::wake() {
+  game->activate_building(index);
 }
 
 map_obj_t
@@ -178,6 +187,7 @@ building_t::cancel_transported_resource(resource_type_t res) {
   if (in_stock >= 0) {
     stock[in_stock].requested -= 1;
     assert(stock[in_stock].requested >= 0);
+    wake();
   } else {
     assert(has_inventory());
   }
@@ -195,6 +205,7 @@ building_t::add_requested_resource(resource_type_t res, bool fix_priority) {
         stock[j].prio = 0;
       }
       stock[j].requested += 1;
+      wake();
       return true;
     }
   }
@@ -208,6 +219,7 @@ building_t::stock_init(unsigned int stock_num, resource_type_t type,
   stock[stock_num].type = type;
   stock[stock_num].prio = 0;
   stock[stock_num].maximum = maximum;
+  wake();
 }
 
 void
@@ -217,6 +229,7 @@ building_t::requested_resource_delivered(resource_type_t resource) {
       stock[i].available += 1;
       stock[i].requested -= 1;
       assert(stock[i].requested >= 0);
+      wake();
       return;
     }
   }
@@ -282,6 +295,24 @@ building_t::update(unsigned int tick) {
   }
 }
 
+/* Only finished production buildings that have their worker (or have
+   one on the way) can be idle. Their update() then just recomputes the
+   stock priorities, which stay the same as long as the stock and the
+   priorities of the owner do. Stocks, the castle and military buildings
+   have periodic work and are always updated. */
+bool
+building_t::is_idle() {
+  if (!is_done() || is_burning() || serf_request_fail()) {
+    return false;
+  }
+
+  if (type == BUILDING_NONE || type == BUILDING_STOCK || is_military()) {
+    return false;
+  }
+
+  return (has_serf() || serf_requested());
+}
+
 void
 building_t::knight_request_granted() {
   stock[0].requested += 1;
@@ -294,6 +325,7 @@ building_t::remove_stock() {
   stock[0].requested = 0;
   stock[1].available = 0;
   stock[1].requested = 0;
+  wake();
 }
 
 int
@@ -316,6 +348,7 @@ bool
 building_t::use_resource_in_stock(int stock_num) {
   if (stock[stock_num].available > 0) {
     stock[stock_num].available -= 1;
+    wake();
     return true;
   }
   return false;
@@ -327,6 +360,7 @@ building_t::use_resources_in_stocks() {
       stock[1].available > 0) {
     stock[0].available -= 1;
     stock[1].available -= 1;
+    wake();
     return true;
   }
   return false;
@@ -115,7 +115,7 @@ class building_t : public game_object_t {
 
   /* Type of building. */
   building_type_t get_type() { return type; }
-  void set_type(building_type_t type) { this->type = type; }
+  void set_type(building_type_t type) { this->type = type; wake(); }
   bool is_military() { return (type == BUILDING_HUT) ||
                               (type == BUILDING_TOWER) ||
                               (type == BUILDING_FORTRESS) ||
@@ -126,7 +126,7 @@ class building_t : public game_object_t {
   /* Whether construction of the building is finished. */
   bool is_done() { return !((bld >> 7) & 1); }
   bool is_leveling() { return (!is_done() && progress == 0); }
-  void done_build() { bld &= ~BIT(7); }
+  void done_build() { bld &= ~BIT(7); wake(); }
   void done_leveling() { progress = 1; }
   map_obj_t start_building(building_type_t type);
   int get_progress() { return progress; }
@@ -150,16 +150,16 @@ class building_t : public game_object_t {
   void stop_activity() { serf &= ~BIT(4); }
   /* Building is burning. */
   bool is_burning() { return (BIT_TEST(serf, 5) != 0); }
-  void burnup() { serf |= BIT(5); }
+  void burnup() { serf |= BIT(5); wake(); }
   /* Building has an associated serf. */
   bool has_serf() { return (BIT_TEST(serf, 6) != 0); }
-  void serf_arrive() { serf |= BIT(6); }
-  void serf_gone() { serf &= ~BIT(6); }
+  void serf_arrive() { serf |= BIT(6); wake(); }
+  void serf_gone() { serf &= ~BIT(6); wake(); }
   /* Building has succesfully requested a serf. */
   bool serf_requested() { return (BIT_TEST(serf, 7) != 0); }
-  void serf_request_complete() { serf &= ~BIT(7); }
-  void serf_request_failed() { serf &= ~BIT(7); }
-  void request_serf() { serf |= BIT(7); }
+  void serf_request_complete() { serf &= ~BIT(7); wake(); }
+  void serf_request_failed() { serf &= ~BIT(7); wake(); }
+  void request_serf() { serf |= BIT(7); wake(); }
   /* Building has requested a serf but none was available. */
   bool serf_request_fail() { return (BIT_TEST(serf, 2) != 0); }
   void clear_serf_request_failure() { serf &= ~BIT(2); }
@@ -202,19 +202,20 @@ class building_t : public game_object_t {
   int get_maximum_in_stock(int stock_num) { return stock[stock_num].maximum; }
   int get_requested_in_stock(int stock_num) {
     return stock[stock_num].requested; }
+  int get_priority_in_stock(int stock_num) { return stock[stock_num].prio; }
   void set_priority_in_stock(int stock_num, int priority) {
-    stock[stock_num].prio = priority; }
+    stock[stock_num].prio = priority; wake(); }
   void set_initial_res_in_stock(int stock_num, int count) {
-    stock[stock_num].available = count; }
+    stock[stock_num].available = count; wake(); }
   void requested_resource_delivered(resource_type_t resource);
   void plank_used_for_build() {
-    stock[0].available -= 1; stock[0].maximum -= 1; }
+    stock[0].available -= 1; stock[0].maximum -= 1; wake(); }
   void stone_used_for_build() {
-    stock[1].available -= 1; stock[1].maximum -= 1; }
+    stock[1].available -= 1; stock[1].maximum -= 1; wake(); }
   bool use_resource_in_stock(int stock_num);
   bool use_resources_in_stocks();
   void decrease_requested_for_stock(int stock_num) {
-    stock[stock_num].requested -= 1; }
+    stock[stock_num].requested -= 1; wake(); }
 
   int pigs_count() { return stock[1].available; }
   void send_pig_to_butcher() { stock[1].available -= 1; }
@@ -232,6 +233,9 @@ class building_t : public game_object_t {
   void knight_occupy();
 
   void update(unsigned int tick);
+  /* Whether update() has nothing to do until the stock or serf of the
+     building or the priorities of its owner change. */
+  bool is_idle();
 
   friend save_reader_binary_t&
     operator >> (save_reader_binary_t &reader, building_t &building);
@@ -241,6 +245,7 @@ class building_t : public game_object_t {
     operator << (save_writer_text_t &writer, building_t &building);
 
  private:
+  void wake();
   void update();
   void update_unfinished();
   void update_unfinished_adv();
@@ -0,0 +1,316 @@
+/*
+ * data-cache.cc - Persistent cache of decoded game resources
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/data-cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+# include <direct.h>
+#else
+# include <sys/stat.h>
+# include <sys/types.h>
+#endif
+
+#include "src/freeserf_endian.h"
+#include "src/log.h"
+#include "src/data-source.h"
+
+#define DATA_CACHE_MAGIC    "FSDC"
+#define DATA_CACHE_VERSION  1
+
+/* Entry data is aligned so that decoded pixels can be used in place. */
+#define DATA_CACHE_ALIGN    16
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t checksum;
+  uint32_t entry_count;
+  uint32_t reserved;
+} data_cache_header_t;
+
+typedef struct {
+  uint64_t key;
+  uint64_t offset;
+  uint64_t size;
+} data_cache_entry_t;
+
+data_cache_t::data_cache_t() {
+  source_hash = 0;
+  mapping = NULL;
+  mapping_size = 0;
+  mapped = false;
+  dirty = false;
+}
+
+data_cache_t::~data_cache_t() {
+  close();
+}
+
+void
+data_cache_t::close() {
+  entries.clear();
+  if (mapping != NULL) {
+    if (mapped) {
+      data_source_t::file_unmap(mapping, mapping_size);
+    } else {
+      free(mapping);
+    }
+    mapping = NULL;
+    mapping_size = 0;
+  }
+}
+
+bool
+data_cache_t::open(const std::string &path, uint64_t source_hash) {
+  close();
+  pending.clear();
+  dirty = false;
+  this->path = path;
+  this->source_hash = source_hash;
+
+  mapping = data_source_t::file_map(path, &mapping_size);
+  mapped = (mapping != NULL);
+  if (!mapped && data_source_t::check_file(path)) {
+    mapping = data_source_t::file_read(path, &mapping_size);
+  }
+  if (mapping == NULL) {
+    LOGV("data-cache", "No cache file at '%s'.", path.c_str());
+    return false;
+  }
+
+  const uint8_t *bytes = reinterpret_cast<const uint8_t*>(mapping);
+  const data_cache_header_t *header =
+    reinterpret_cast<const data_cache_header_t*>(mapping);
+  bool valid = (mapping_size >= sizeof(data_cache_header_t) &&
+                memcmp(header->magic, DATA_CACHE_MAGIC, 4) == 0 &&
+                le32toh(header->version) == DATA_CACHE_VERSION &&
+                le64toh(header->source_hash) == source_hash);
+
+  size_t count = 0;
+  if (valid) {
+    count = le32toh(header->entry_count);
+    valid = (count <= (mapping_size - sizeof(data_cache_header_t)) /
+                      sizeof(data_cache_entry_t));
+  }
+
+  if (valid) {
+    uint64_t checksum = hash(bytes + sizeof(data_cache_header_t),
+                             mapping_size - sizeof(data_cache_header_t));
+    valid = (checksum == le64toh(header->checksum));
+  }
+
+  if (valid) {
+    const data_cache_entry_t *index =
+      reinterpret_cast<const data_cache_entry_t*>(header + 1);
+    for (size_t i = 0; i < count; i++) {
+      uint64_t offset = le64toh(index[i].offset);
+      uint64_t size = le64toh(index[i].size);
+      if (offset > mapping_size || size > mapping_size - offset) {
+        valid = false;
+        break;
+      }
+      entry_t entry = { bytes + offset, static_cast<size_t>(size) };
+      entries[le64toh(index[i].key)] = entry;
+    }
+  }
+
+  if (!valid) {
+    LOGW("data-cache", "Ignoring outdated or broken cache file '%s'.",
+         path.c_str());
+    close();
+    return false;
+  }
+
+  LOGI("data-cache", "Loaded %u cached entries from '%s'.",
+       static_cast<unsigned int>(entries.size()), path.c_str());
+  return true;
+}
+
+const void *
+data_cache_t::get(uint64_t key, size_t *size) const {
+  mutex_lock_t lock(&mutex);
+
+  entries_t::const_iterator entry = entries.find(key);
+  if (entry != entries.end()) {
+    if (size != NULL) *size = entry->second.size;
+    return entry->second.data;
+  }
+
+  pending_t::const_iterator added = pending.find(key);
+  if (added != pending.end()) {
+    if (size != NULL) *size = added->second.size();
+    return added->second.empty() ? NULL : &added->second[0];
+  }
+
+  return NULL;
+}
+
+void
+data_cache_t::put(uint64_t key, const void *data, size_t size) {
+  if (path.empty() || get(key, NULL) != NULL) return;
+
+  mutex_lock_t lock(&mutex);
+  if (pending.find(key) != pending.end()) return;
+
+  const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+  pending[key].assign(bytes, bytes + size);
+  dirty = true;
+}
+
+bool
+data_cache_t::save() {
+  mutex_lock_t lock(&mutex);
+  if (path.empty() || !dirty) return true;
+
+  /* Merge the mapped and the added entries. */
+  entries_t all = entries;
+  for (pending_t::iterator it = pending.begin(); it != pending.end(); ++it) {
+    entry_t entry = { it->second.empty() ? NULL : &it->second[0],
+                      it->second.size() };
+    all[it->first] = entry;
+  }
+
+  size_t offset = sizeof(data_cache_header_t) +
+                  all.size() * sizeof(data_cache_entry_t);
+  std::vector<data_cache_entry_t> index;
+  for (entries_t::iterator it = all.begin(); it != all.end(); ++it) {
+    offset = (offset + DATA_CACHE_ALIGN - 1) & ~(DATA_CACHE_ALIGN - 1);
+    data_cache_entry_t entry = { htole64(it->first), htole64(offset),
+                                 htole64(it->second.size) };
+    index.push_back(entry);
+    offset += it->second.size;
+  }
+
+  std::vector<uint8_t> buffer(offset, 0);
+  if (!index.empty()) {
+    memcpy(&buffer[sizeof(data_cache_header_t)], &index[0],
+           index.size() * sizeof(data_cache_entry_t));
+  }
+  std::vector<data_cache_entry_t>::iterator entry = index.begin();
+  for (entries_t::iterator it = all.begin(); it != all.end();
+       ++it, ++entry) {
+    if (it->second.size > 0) {
+      memcpy(&buffer[le64toh(entry->offset)], it->second.data,
+             it->second.size);
+    }
+  }
+
+  data_cache_header_t header;
+  memcpy(header.magic, DATA_CACHE_MAGIC, 4);
+  header.version = htole32(DATA_CACHE_VERSION);
+  header.source_hash = htole64(source_hash);
+  header.checksum = htole64(hash(&buffer[sizeof(data_cache_header_t)],
+                                 buffer.size() - sizeof(data_cache_header_t)));
+  header.entry_count = htole32(static_cast<uint32_t>(all.size()));
+  header.reserved = 0;
+  memcpy(&buffer[0], &header, sizeof(header));
+
+  size_t sep = path.find_last_of("/\\");
+  if (sep != std::string::npos) {
+    make_dirs(path.substr(0, sep));
+  }
+
+  /* Write to a temporary file first so that an interrupted write never
+     leaves a truncated cache behind. */
+  std::string temp_path = path + ".tmp";
+  FILE *f = fopen(temp_path.c_str(), "wb");
+  if (f == NULL) {
+    LOGW("data-cache", "Unable to write cache file '%s'.", temp_path.c_str());
+    return false;
+  }
+  bool written = (fwrite(&buffer[0], buffer.size(), 1, f) == 1);
+  written = (fclose(f) == 0) && written;
+
+#ifdef _WIN32
+  if (written) remove(path.c_str());
+#endif
+  if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOGW("data-cache", "Unable to write cache file '%s'.", path.c_str());
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  LOGI("data-cache", "Saved %u entries to '%s'.",
+       static_cast<unsigned int>(all.size()), path.c_str());
+
+  /* Entries already handed out may point into the mapping and the
+     pending buffers, so both are kept until the cache is destroyed. */
+  dirty = false;
+
+  return true;
+}
+
+uint64_t
+data_cache_t::make_key(data_cache_kind_t kind, unsigned int index,
+                       unsigned int variant) {
+  return (static_cast<uint64_t>(kind) << 56) |
+         (static_cast<uint64_t>(variant & 0xffffff) << 32) | index;
+}
+
+/* 64 bit FNV-1a hash. */
+uint64_t
+data_cache_t::hash(const void *data, size_t size, uint64_t hash) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string
+data_cache_t::get_default_dir() {
+  const char *dir = std::getenv("XDG_CACHE_HOME");
+  if (dir != NULL && *dir != '\0') {
+    return std::string(dir) + "/freeserf";
+  }
+#ifdef _WIN32
+  dir = std::getenv("LOCALAPPDATA");
+  if (dir != NULL && *dir != '\0') {
+    return std::string(dir) + "/freeserf/cache";
+  }
+#endif
+  dir = std::getenv("HOME");
+  if (dir != NULL && *dir != '\0') {
+    return std::string(dir) + "/.cache/freeserf";
+  }
+  return ".";
+}
+
+bool
+data_cache_t::make_dirs(const std::string &path) {
+  size_t pos = 0;
+  while (pos != std::string::npos) {
+    pos = path.find_first_of("/\\", pos + 1);
+    std::string dir = path.substr(0, pos);
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+  }
+  return true;
+}
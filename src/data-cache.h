@@ -0,0 +1,109 @@
+/*
+ * data-cache.h - Persistent cache of decoded game resources
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_DATA_CACHE_H_
+#define SRC_DATA_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "src/thread-pool.h"
+
+/* Kinds of cache entries. The kind is stored in the top byte of the
+   entry key. */
+typedef enum {
+  DATA_CACHE_ARCHIVE = 1,
+  DATA_CACHE_SPRITE_SOLID,
+  DATA_CACHE_SPRITE_TRANSPARENT,
+  DATA_CACHE_SPRITE_OVERLAY,
+  DATA_CACHE_SPRITE_MASK,
+  DATA_CACHE_SOUND,
+  DATA_CACHE_MUSIC,
+} data_cache_kind_t;
+
+/* Cache of decoded resources kept in a single file.
+
+   The file starts with a header holding a magic value, the format
+   version, the hash of the data file the entries were decoded from and
+   a checksum of the rest of the file. An index of (key, offset, size)
+   entries follows, then the entry data. All values are little endian.
+   The file is mapped on open (or read where mapping is not available)
+   and entries are served from it directly.
+   A cache that does not match the data file or fails the checksum is
+   ignored and written again on save().
+   get() and put() may be called from several threads. */
+class data_cache_t {
+ protected:
+  typedef struct {
+    const void *data;
+    size_t size;
+  } entry_t;
+  typedef std::map<uint64_t, entry_t> entries_t;
+  typedef std::map<uint64_t, std::vector<uint8_t> > pending_t;
+
+  std::string path;
+  uint64_t source_hash;
+  void *mapping;
+  size_t mapping_size;
+  bool mapped;
+  entries_t entries;
+  pending_t pending;
+  bool dirty;
+  mutable mutex_t mutex;
+
+ public:
+  data_cache_t();
+  virtual ~data_cache_t();
+
+  /* Open the cache file at path for the data file with source_hash.
+     Returns false if there is no valid cache yet. Entries returned by
+     get() stay valid until the cache is destroyed. */
+  bool open(const std::string &path, uint64_t source_hash);
+
+  const void *get(uint64_t key, size_t *size) const;
+  void put(uint64_t key, const void *data, size_t size);
+
+  /* Write the cache file if entries were added since it was opened. */
+  bool save();
+
+  static uint64_t make_key(data_cache_kind_t kind, unsigned int index,
+                           unsigned int variant);
+  static uint64_t hash(const void *data, size_t size,
+                       uint64_t hash = 0xcbf29ce484222325ull);
+
+  /* Default directory for cache files. */
+  static std::string get_default_dir();
+
+ protected:
+  void close();
+  static bool make_dirs(const std::string &path);
+};
+
+#endif  // SRC_DATA_CACHE_H_
@@ -22,8 +22,10 @@
 #include "src/data-source-dos.h"
 
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 #include <fstream>
+#include <vector>
 
 #include "src/freeserf_endian.h"
 #include "src/log.h"
@@ -44,14 +46,19 @@
 data_source_dos_t::data_source_dos_t() {
   sprites = NULL;
   sprites_size = 0;
+  storage = STORAGE_ALLOCATED;
   entry_count = 0;
   animation_table = NULL;
+  cache = NULL;
 }
 
 data_source_dos_t::~data_source_dos_t() {
-  if (sprites != NULL) {
-    free(sprites);
-    sprites = NULL;
+  release_sprites();
+
+  if (cache != NULL) {
+    cache->save();
+    delete cache;
+    cache = NULL;
   }
 
   if (animation_table != NULL) {
@@ -86,39 +93,181 @@ data_source_dos_t::check(const std::string &path, std::string *load_path) {
 
 bool
 data_source_dos_t::load(const std::string &path) {
-  sprites = file_read(path, &sprites_size);
+  /* Objects are served directly from the mapped file when possible. */
+  sprites = file_map(path, &sprites_size);
+  storage = STORAGE_MAPPED;
+  if (sprites == NULL) {
+    sprites = file_read(path, &sprites_size);
+    storage = STORAGE_ALLOCATED;
+  }
   if (sprites == NULL) {
     return false;
   }
 
+  if (!cache_dir.empty()) {
+    open_cache(path);
+  }
+
   /* Check that data file is decompressed. */
   if (tpwm_is_compressed(sprites, sprites_size)) {
     LOGV("data", "Data file is compressed");
-    void *uncompressed = NULL;
-    size_t uncmpsd_size = 0;
-    const char *error = NULL;
-    if (!tpwm_uncompress(sprites, sprites_size,
-                         &uncompressed, &uncmpsd_size,
-                         &error)) {
-      LOGE("tpwm", error);
-      LOGE("data", "Data file is broken!");
-      return false;
+    size_t cached_size = 0;
+    void *cached = get_cached_blob(DATA_CACHE_ARCHIVE, 0, &cached_size);
+    if (cached != NULL) {
+      release_sprites();
+      sprites = cached;
+      sprites_size = cached_size;
+      storage = STORAGE_CACHED;
+    } else {
+      void *uncompressed = NULL;
+      size_t uncmpsd_size = 0;
+      const char *error = NULL;
+      bool result = tpwm_uncompress(sprites, sprites_size,
+                                    &uncompressed, &uncmpsd_size,
+                                    &error);
+      release_sprites();
+      sprites = uncompressed;
+      sprites_size = uncmpsd_size;
+      storage = STORAGE_ALLOCATED;
+      if (!result) {
+        LOGE("tpwm", error);
+        LOGE("data", "Data file is broken!");
+        return false;
+      }
+
+      if (cache != NULL) {
+        cache->put(data_cache_t::make_key(DATA_CACHE_ARCHIVE, 0, 0),
+                   sprites, sprites_size);
+      }
     }
-    free(sprites);
-    sprites = uncompressed;
-    sprites_size = uncmpsd_size;
+  }
+
+  if (sprites_size < 2*sizeof(uint32_t)) {
+    LOGE("data", "Data file is broken!");
+    return false;
   }
 
   /* Read the number of entries in the index table.
      Some entries are undefined (size and offset are zero). */
   entry_count = *(reinterpret_cast<uint32_t*>(sprites) + 1);
   entry_count = le32toh(entry_count) + 1;
+  if (entry_count * sizeof(spae_entry_t) > sprites_size) {
+    LOGE("data", "Data file is broken!");
+    return false;
+  }
 
   fixup();
 
   return load_animation_table();
 }
 
+void
+data_source_dos_t::release_sprites() {
+  if (sprites != NULL) {
+    if (storage == STORAGE_MAPPED) {
+      file_unmap(sprites, sprites_size);
+    } else if (storage == STORAGE_ALLOCATED) {
+      free(sprites);
+    }
+    sprites = NULL;
+    sprites_size = 0;
+  }
+}
+
+/* Open the cache of decoded resources for the data file at path, which
+   has already been read into sprites. */
+void
+data_source_dos_t::open_cache(const std::string &path) {
+  std::string name = path;
+  size_t sep = name.find_last_of("/\\");
+  if (sep != std::string::npos) {
+    name = name.substr(sep + 1);
+  }
+
+  cache = new data_cache_t();
+  cache->open(cache_dir + '/' + name + ".cache",
+              data_cache_t::hash(sprites, sprites_size));
+}
+
+/* Return a pointer to the cache entry, which stays valid while the
+   cache exists. */
+void *
+data_source_dos_t::get_cached_blob(data_cache_kind_t kind, unsigned int index,
+                                   size_t *size) {
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  const void *data = cache->get(data_cache_t::make_key(kind, index, 0), size);
+  return const_cast<void*>(data);
+}
+
+sprite_t *
+data_source_dos_t::get_cached_sprite(data_cache_kind_t kind,
+                                     unsigned int index,
+                                     unsigned int variant) {
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  size_t size = 0;
+  const void *data = cache->get(data_cache_t::make_key(kind, index, variant),
+                                &size);
+  if (data == NULL ||
+      size < sizeof(sprite_dos_cached_t::cached_sprite_header_t)) {
+    return NULL;
+  }
+
+  return new sprite_dos_cached_t(data, size);
+}
+
+void
+data_source_dos_t::cache_sprite(data_cache_kind_t kind, unsigned int index,
+                                unsigned int variant, sprite_t *sprite) {
+  if (cache == NULL || sprite == NULL) {
+    return;
+  }
+
+  sprite_dos_cached_t::cached_sprite_header_t header;
+  header.delta_x = htole32(sprite->get_delta_x());
+  header.delta_y = htole32(sprite->get_delta_y());
+  header.offset_x = htole32(sprite->get_offset_x());
+  header.offset_y = htole32(sprite->get_offset_y());
+  header.width = htole32(sprite->get_width());
+  header.height = htole32(sprite->get_height());
+  header.reserved[0] = 0;
+  header.reserved[1] = 0;
+
+  size_t pixels_size = sprite->get_width() * sprite->get_height() * 4;
+  std::vector<uint8_t> entry(sizeof(header) + pixels_size);
+  memcpy(&entry[0], &header, sizeof(header));
+  memcpy(&entry[sizeof(header)], sprite->get_data(), pixels_size);
+
+  cache->put(data_cache_t::make_key(kind, index, variant),
+             &entry[0], entry.size());
+}
+
+sprite_dos_cached_t::sprite_dos_cached_t(const void *data, size_t size) {
+  const cached_sprite_header_t *header =
+    reinterpret_cast<const cached_sprite_header_t*>(data);
+  delta_x = static_cast<int32_t>(le32toh(header->delta_x));
+  delta_y = static_cast<int32_t>(le32toh(header->delta_y));
+  offset_x = static_cast<int32_t>(le32toh(header->offset_x));
+  offset_y = static_cast<int32_t>(le32toh(header->offset_y));
+  width = le32toh(header->width);
+  height = le32toh(header->height);
+
+  size_t pixels_size = width * height * 4;
+  if (size - sizeof(cached_sprite_header_t) < pixels_size) {
+    width = 0;
+    height = 0;
+    pixels_size = 0;
+  }
+
+  this->data = new uint8_t[pixels_size];
+  memcpy(this->data, header + 1, pixels_size);
+}
+
 /* Return a pointer to the data object at index.
  If size is non-NULL it will be set to the size of the data object.
  (There's no guarantee that size is correct!). */
@@ -128,20 +277,26 @@ data_source_dos_t::get_object(unsigned int index, size_t *size) {
     *size = 0;
   }
 
-  if (index <= 0 && index >= entry_count) {
+  if (index <= 0 || index >= entry_count) {
     return NULL;
   }
 
+  fixup_map_t::const_iterator fixup = fixups.find(index);
+  if (fixup != fixups.end()) {
+    index = fixup->second;
+  }
+
   spae_entry_t *entries = reinterpret_cast<spae_entry_t*>(sprites);
   uint8_t *bytes = reinterpret_cast<uint8_t*>(sprites);
 
   size_t offset = le32toh(entries[index].offset);
-  if (offset == 0) {
+  if (offset == 0 || offset >= sprites_size) {
     return NULL;
   }
 
   if (size != NULL) {
-    *size = le32toh(entries[index].size);
+    *size = std::min(static_cast<size_t>(le32toh(entries[index].size)),
+                     sprites_size - offset);
   }
 
   return &bytes[offset];
@@ -150,31 +305,26 @@ data_source_dos_t::get_object(unsigned int index, size_t *size) {
 /* Perform various fixups of the data file entries. */
 void
 data_source_dos_t::fixup() {
-  spae_entry_t *entries = reinterpret_cast<spae_entry_t*>(sprites);
-
   /* Fill out some undefined spaces in the index from other
      places in the data file index. */
+  fixups.clear();
 
   for (int i = 0; i < 48; i++) {
     for (int j = 1; j < 6; j++) {
-      entries[3450+6*i+j].size = entries[3450+6*i].size;
-      entries[3450+6*i+j].offset = entries[3450+6*i].offset;
+      fixups[3450+6*i+j] = 3450+6*i;
     }
   }
 
   for (int i = 0; i < 3; i++) {
-    entries[3765+i].size = entries[3762+i].size;
-    entries[3765+i].offset = entries[3762+i].offset;
+    fixups[3765+i] = 3762+i;
   }
 
   for (int i = 0; i < 6; i++) {
-    entries[1363+i].size = entries[1352].size;
-    entries[1363+i].offset = entries[1352].offset;
+    fixups[1363+i] = 1352;
   }
 
   for (int i = 0; i < 6; i++) {
-    entries[1613+i].size = entries[1602].size;
-    entries[1613+i].offset = entries[1602].offset;
+    fixups[1613+i] = 1602;
   }
 }
 
@@ -190,6 +340,11 @@ data_source_dos_t::fixup() {
 /* Create sprite object */
 sprite_t *
 data_source_dos_t::get_sprite(unsigned int index) {
+  sprite_t *sprite = get_cached_sprite(DATA_CACHE_SPRITE_SOLID, index, 0);
+  if (sprite != NULL) {
+    return sprite;
+  }
+
   size_t size = 0;
   void *data = get_object(index, &size);
   if (data == NULL) {
@@ -201,7 +356,9 @@ data_source_dos_t::get_sprite(unsigned int index) {
     return NULL;
   }
 
-  return new sprite_dos_solid_t(data, size, palette);
+  sprite = new sprite_dos_solid_t(data, size, palette);
+  cache_sprite(DATA_CACHE_SPRITE_SOLID, index, 0, sprite);
+  return sprite;
 }
 
 sprite_dos_solid_t::sprite_dos_solid_t(void *data, size_t size,
@@ -239,6 +396,12 @@ data_source_dos_t::get_empty_sprite(unsigned int index) {
 /* Create transparent sprite object */
 sprite_t *
 data_source_dos_t::get_transparent_sprite(unsigned int index, int color_off) {
+  sprite_t *sprite = get_cached_sprite(DATA_CACHE_SPRITE_TRANSPARENT, index,
+                                       color_off);
+  if (sprite != NULL) {
+    return sprite;
+  }
+
   size_t size = 0;
   void *data = get_object(index, &size);
   if (data == NULL) {
@@ -250,7 +413,9 @@ data_source_dos_t::get_transparent_sprite(unsigned int index, int color_off) {
     return NULL;
   }
 
-  return new sprite_dos_transparent_t(data, size, palette, color_off);
+  sprite = new sprite_dos_transparent_t(data, size, palette, color_off);
+  cache_sprite(DATA_CACHE_SPRITE_TRANSPARENT, index, color_off, sprite);
+  return sprite;
 }
 
 sprite_dos_transparent_t::sprite_dos_transparent_t(void *data, size_t size,
@@ -285,6 +450,11 @@ sprite_dos_transparent_t::sprite_dos_transparent_t(void *data, size_t size,
 
 sprite_t *
 data_source_dos_t::get_overlay_sprite(unsigned int index) {
+  sprite_t *sprite = get_cached_sprite(DATA_CACHE_SPRITE_OVERLAY, index, 0);
+  if (sprite != NULL) {
+    return sprite;
+  }
+
   size_t size = 0;
   void *data = get_object(index, &size);
   if (data == NULL) {
@@ -296,7 +466,9 @@ data_source_dos_t::get_overlay_sprite(unsigned int index) {
     return NULL;
   }
 
-  return new sprite_dos_overlay_t(data, size, palette, 0x80);
+  sprite = new sprite_dos_overlay_t(data, size, palette, 0x80);
+  cache_sprite(DATA_CACHE_SPRITE_OVERLAY, index, 0, sprite);
+  return sprite;
 }
 
 sprite_dos_overlay_t::sprite_dos_overlay_t(void *data, size_t size,
@@ -330,13 +502,20 @@ sprite_dos_overlay_t::sprite_dos_overlay_t(void *data, size_t size,
 
 sprite_t *
 data_source_dos_t::get_mask_sprite(unsigned int index) {
+  sprite_t *sprite = get_cached_sprite(DATA_CACHE_SPRITE_MASK, index, 0);
+  if (sprite != NULL) {
+    return sprite;
+  }
+
   size_t size = 0;
   void *data = get_object(index, &size);
   if (data == NULL) {
     return NULL;
   }
 
-  return new sprite_dos_mask_t(data, size);
+  sprite = new sprite_dos_mask_t(data, size);
+  cache_sprite(DATA_CACHE_SPRITE_MASK, index, 0, sprite);
+  return sprite;
 }
 
 sprite_dos_mask_t::sprite_dos_mask_t(void *data, size_t size)
@@ -504,6 +683,17 @@ data_source_dos_t::get_sound(unsigned int index, size_t *size) {
     *size = 0;
   }
 
+  size_t cached_size = 0;
+  void *cached = get_cached_blob(DATA_CACHE_SOUND, index, &cached_size);
+  if (cached != NULL) {
+    void *wav = malloc(cached_size);
+    if (wav != NULL) {
+      memcpy(wav, cached, cached_size);
+      if (size != NULL) *size = cached_size;
+    }
+    return wav;
+  }
+
   size_t sfx_size = 0;
   void *data = get_object(DATA_SFX_BASE + index, &sfx_size);
   if (data == NULL) {
@@ -517,6 +707,11 @@ data_source_dos_t::get_sound(unsigned int index, size_t *size) {
     return NULL;
   }
 
+  if (cache != NULL && size != NULL) {
+    cache->put(data_cache_t::make_key(DATA_CACHE_SOUND, index, 0),
+               wav, *size);
+  }
+
   return wav;
 }
 
@@ -526,6 +721,17 @@ data_source_dos_t::get_music(unsigned int index, size_t *size) {
     *size = 0;
   }
 
+  size_t cached_size = 0;
+  void *cached = get_cached_blob(DATA_CACHE_MUSIC, index, &cached_size);
+  if (cached != NULL) {
+    void *mid = malloc(cached_size);
+    if (mid != NULL) {
+      memcpy(mid, cached, cached_size);
+      if (size != NULL) *size = cached_size;
+    }
+    return mid;
+  }
+
   size_t xmi_size = 0;
   void *data = get_object(DATA_MUSIC_GAME + index, &xmi_size);
   if (data == NULL) {
@@ -539,6 +745,11 @@ data_source_dos_t::get_music(unsigned int index, size_t *size) {
     return NULL;
   }
 
+  if (cache != NULL && size != NULL) {
+    cache->put(data_cache_t::make_key(DATA_CACHE_MUSIC, index, 0),
+               mid, *size);
+  }
+
   return mid;
 }
 
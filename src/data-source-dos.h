@@ -22,9 +22,11 @@
 #ifndef SRC_DATA_SOURCE_DOS_H_
 #define SRC_DATA_SOURCE_DOS_H_
 
+#include <map>
 #include <string>
 
 #include "src/data-source.h"
+#include "src/data-cache.h"
 
 class sprite_dos_empty_t : public sprite_t {
  protected:
@@ -72,6 +74,8 @@ class sprite_dos_base_t : public sprite_dos_empty_t {
  protected:
   uint8_t *data;
 
+  sprite_dos_base_t() : data(NULL) {}
+
  public:
   sprite_dos_base_t(void *data, size_t size);
   explicit sprite_dos_base_t(sprite_t *base);
@@ -107,6 +111,24 @@ class sprite_dos_mask_t : public sprite_dos_base_t {
   virtual ~sprite_dos_mask_t() {}
 };
 
+/* Decoded sprite stored in the data cache. The cache entry is a
+   cached_sprite_header_t followed by the pixel data. */
+class sprite_dos_cached_t : public sprite_dos_base_t {
+ public:
+  typedef struct {
+    int32_t delta_x;
+    int32_t delta_y;
+    int32_t offset_x;
+    int32_t offset_y;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved[2];
+  } cached_sprite_header_t;
+
+  sprite_dos_cached_t(const void *data, size_t size);
+  virtual ~sprite_dos_cached_t() {}
+};
+
 class data_source_dos_t : public data_source_t {
  protected:
   /* These entries follow the 8 byte header of the data file. */
@@ -115,11 +137,30 @@ class data_source_dos_t : public data_source_t {
     uint32_t offset;
   } spae_entry_t;
 
+  /* The data file, either mapped read-only (if it is not compressed),
+     uncompressed into an allocated buffer or served from the cache. */
+  typedef enum {
+    STORAGE_ALLOCATED,
+    STORAGE_MAPPED,
+    STORAGE_CACHED,
+  } storage_t;
+
   void *sprites;
   size_t sprites_size;
+  storage_t storage;
   size_t entry_count;
   animation_t **animation_table;
 
+  /* Index entries that are undefined in the data file and are instead
+     served from another entry. This overlays the index table of the
+     data file so it is never modified. */
+  typedef std::map<unsigned int, unsigned int> fixup_map_t;
+  fixup_map_t fixups;
+
+  /* Optional persistent cache of the uncompressed data file and of
+     decoded sprites, sounds and music. */
+  data_cache_t *cache;
+
  public:
   data_source_dos_t();
   virtual ~data_source_dos_t();
@@ -143,6 +184,14 @@ class data_source_dos_t : public data_source_t {
 
  protected:
   void *get_object(unsigned int index, size_t *size);
+  void release_sprites();
+  void open_cache(const std::string &path);
+  sprite_t *get_cached_sprite(data_cache_kind_t kind, unsigned int index,
+                              unsigned int variant);
+  void cache_sprite(data_cache_kind_t kind, unsigned int index,
+                    unsigned int variant, sprite_t *sprite);
+  void *get_cached_blob(data_cache_kind_t kind, unsigned int index,
+                        size_t *size);
   void fixup();
   bool load_animation_table();
   color_dos_t *get_palette(unsigned int index);
@@ -24,6 +24,13 @@
 #include <algorithm>
 #include <fstream>
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
 #include "src/freeserf_endian.h"
 #include "src/log.h"
 #include "src/tpwm.h"
@@ -83,6 +90,42 @@ data_source_t::file_read(const std::string &path, size_t *size) {
   return data;
 }
 
+void *
+data_source_t::file_map(const std::string &path, size_t *size) {
+  *size = 0;
+
+#ifdef HAVE_SYS_MMAN_H
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+
+  *size = st.st_size;
+  return data;
+#else
+  return NULL;
+#endif
+}
+
+void
+data_source_t::file_unmap(void *data, size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+  munmap(data, size);
+#endif
+}
+
 /* Calculate hash of sprite identifier. */
 uint64_t
 sprite_t::create_sprite_id(uint64_t sprite, uint64_t mask, uint64_t offset) {
@@ -72,6 +72,7 @@ class data_source_t {
   virtual bool check(const std::string &path, std::string *load_path) = 0;
   virtual bool load(const std::string &path) = 0;
 
+  /* Sprites may be decoded on several threads at once. */
   virtual sprite_t *get_sprite(unsigned int index) = 0;
   virtual sprite_t *get_empty_sprite(unsigned int index) = 0;
   virtual sprite_t *get_transparent_sprite(unsigned int index,
@@ -87,8 +88,21 @@ class data_source_t {
   virtual void *get_sound(unsigned int index, size_t *size) = 0;
   virtual void *get_music(unsigned int index, size_t *size) = 0;
 
-  bool check_file(const std::string &path);
-  void *file_read(const std::string &path, size_t *size);
+  static bool check_file(const std::string &path);
+  static void *file_read(const std::string &path, size_t *size);
+
+  /* Map the file read-only into memory. Returns NULL if the file can
+     not be mapped (or mapping is not supported); file_read() can be
+     used instead then. */
+  static void *file_map(const std::string &path, size_t *size);
+  static void file_unmap(void *data, size_t size);
+
+  /* Directory for the cache of decoded resources; caching is disabled
+     when it is empty. Must be set before load(). */
+  void set_cache_dir(const std::string &dir) { cache_dir = dir; }
+
+ protected:
+  std::string cache_dir;
 };
 
 #endif  // SRC_DATA_SOURCE_H_
@@ -135,6 +135,7 @@ data_t::load(const std::string &path) {
       std::string res_path;
       if (data_sources[i]->check(*it, &res_path)) {
         LOGI("data", "Game data found in '%s'...", res_path.c_str());
+        data_sources[i]->set_cache_dir(cache_dir);
         if (data_sources[i]->load(res_path)) {
           data_source = data_sources[i];
           break;
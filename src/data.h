@@ -105,7 +105,8 @@
 
 /* undefined: 646-659 */
 
-#define DATA_FRAME_POPUP_BASE  660
+#define DATA_FRAME_POPUP_BASE   660
+#define DATA_FRAME_POPUP_COUNT  4
 
 /* undefined: 664-669 */
 /* undefined: 678-749 */
@@ -240,6 +241,7 @@ class data_t {
   static data_t *instance;
   data_source_t *data_source;
   std::list<std::string> search_paths;
+  std::string cache_dir;
 
   data_t();
 
@@ -248,6 +250,9 @@ class data_t {
 
   static data_t *get_instance();
 
+  /* Keep decoded resources in a cache file in dir. Must be called
+     before load(). */
+  void set_cache_dir(const std::string &dir) { cache_dir = dir; }
   bool load(const std::string &path);
 
   data_source_t *get_data_source() const { return data_source; }
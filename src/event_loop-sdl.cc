@@ -26,7 +26,6 @@
 #include "src/log.h"
 #include "src/gfx.h"
 #include "src/freeserf.h"
-#include "src/video-sdl.h"
 
 event_loop_t *
 event_loop_t::get_instance() {
@@ -114,6 +113,10 @@ event_loop_sdl_t::run() {
   gfx_t *gfx = gfx_t::get_instance();
   frame_t *screen = NULL;
 
+  /* The screen frame is only presented when the interface drew anything
+     into it, or when the window contents were lost. */
+  bool present = true;
+
   while (SDL_WaitEvent(&event)) {
     unsigned int current_ticks = SDL_GetTicks();
 
@@ -223,6 +226,12 @@ event_loop_sdl_t::run() {
           case SDLK_f:
             if (event.key.keysym.mod & KMOD_CTRL) {
               gfx->set_fullscreen(!gfx->is_fullscreen());
+
+              /* The screen was recreated and has to be drawn again. */
+              unsigned int width = 0;
+              unsigned int height = 0;
+              gfx->get_resolution(&width, &height);
+              notify_resize(width, height);
             }
             break;
           case SDLK_RIGHTBRACKET:
@@ -253,6 +262,8 @@ event_loop_sdl_t::run() {
           unsigned int height = event.window.data2;
           gfx->set_resolution(width, height, gfx->is_fullscreen());
           notify_resize(width, height);
+        } else if (SDL_WINDOWEVENT_EXPOSED == event.window.event) {
+          present = true;
         }
         break;
       case SDL_USEREVENT:
@@ -271,10 +282,15 @@ event_loop_sdl_t::run() {
             if (screen == NULL) {
               screen = gfx->get_screen_frame();
             }
-            notify_draw(screen);
+            if (notify_draw(screen)) {
+              present = true;
+            }
 
             /* Swap video buffers */
-            gfx->swap_buffers();
+            if (present) {
+              gfx->swap_buffers();
+              present = false;
+            }
             break;
           case USER_EVENT_CALL: {
             deferred_callee_t *deferred_callee =
@@ -302,7 +318,18 @@ void
 event_loop_sdl_t::zoom(float delta) {
   gfx_t *gfx = gfx_t::get_instance();
   float factor = gfx->get_zoom_factor();
-  if (gfx->set_zoom_factor(factor + delta)) {
+
+  /* Past full size each step out doubles the factor, which drops the
+     map view to the next level of detail. */
+  if (delta > 0.f && factor >= 1.f) {
+    factor *= 2.f;
+  } else if (delta < 0.f && factor > 1.f) {
+    factor /= 2.f;
+  } else {
+    factor += delta;
+  }
+
+  if (gfx->set_zoom_factor(factor)) {
     unsigned int width = 0;
     unsigned int height = 0;
     gfx->get_resolution(&width, &height);
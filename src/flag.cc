@@ -22,6 +22,7 @@
 #include "src/flag.h"
 
 #include <cassert>
+#include <climits>
 #include <algorithm>
 
 #include "src/game.h"
@@ -31,6 +32,15 @@
 
 #define SEARCH_MAX_DEPTH  0x10000
 
+/* Tables kept before the path cache starts over. */
+#define PATH_CACHE_MAX_TABLES  256
+
+/* Road load thresholds, see flag_t::get_road_load(). With the counters
+   halved every FLAG_LOAD_DECAY_TICKS, the queue load of a flag is about
+   FLAG_LOAD_DECAY_TICKS times the number of resources waiting. */
+#define ROAD_LOAD_FULL_ARRIVALS  4
+#define ROAD_LOAD_QUEUE          (4 * FLAG_LOAD_DECAY_TICKS)
+
 flag_search_t::flag_search_t(game_t *game) {
   this->game = game;
   id = game->next_search_id();
@@ -81,6 +91,76 @@ flag_search_t::single(flag_t *src, flag_search_func *callback,
   return search.execute(callback, land, transporter, data);
 }
 
+dir_t
+flag_path_cache_t::get_next_dir(flag_t *src, flag_t *dest) {
+  const distances_t &distances = get_distances(dest);
+
+  /* Same order as the sources of the search. A flag that is reached by
+     two roads is marked with the direction of the later one. */
+  flag_t *best_flag = NULL;
+  unsigned int best_distance = UINT_MAX;
+  dir_t best_dir = DIR_NONE;
+  for (int i = 0; i < 6; i++) {
+    dir_t dir = (dir_t)(5-i);
+    if (src->is_water_path(dir)) continue;
+
+    flag_t *other_flag = src->get_other_end_flag(dir);
+    if (other_flag == best_flag) {
+      best_dir = dir;
+      continue;
+    }
+
+    unsigned int index = other_flag->get_index();
+    if (index < distances.size() && distances[index] < best_distance) {
+      best_flag = other_flag;
+      best_distance = distances[index];
+      best_dir = dir;
+    }
+  }
+
+  return best_dir;
+}
+
+const flag_path_cache_t::distances_t &
+flag_path_cache_t::get_distances(flag_t *dest) {
+  tables_t::iterator it = tables.find(dest->get_index());
+  if (it != tables.end()) {
+    hits += 1;
+    return it->second;
+  }
+
+  if (tables.size() >= PATH_CACHE_MAX_TABLES) {
+    tables.clear();
+  }
+
+  builds += 1;
+  distances_t &distances = tables[dest->get_index()];
+  distances.resize(dest->get_index() + 1, UINT_MAX);
+  distances[dest->get_index()] = 0;
+
+  std::vector<flag_t*> queue;
+  queue.push_back(dest);
+  for (size_t i = 0; i < queue.size(); i++) {
+    flag_t *flag = queue[i];
+    unsigned int distance = distances[flag->get_index()] + 1;
+    for (int d = 0; d < 6; d++) {
+      if (flag->is_water_path((dir_t)d)) continue;
+
+      flag_t *other_flag = flag->get_other_end_flag((dir_t)d);
+      unsigned int index = other_flag->get_index();
+      if (index >= distances.size()) {
+        distances.resize(index + 1, UINT_MAX);
+      }
+      if (distances[index] == UINT_MAX) {
+        distances[index] = distance;
+        queue.push_back(other_flag);
+      }
+    }
+  }
+
+  return distances;
+}
+
 flag_t::flag_t(game_t *game, unsigned int index) : game_object_t(game, index) {
   pos = 0;
   search_num = 0;
@@ -90,6 +170,8 @@ flag_t::flag_t(game_t *game, unsigned int index) : game_object_t(game, index) {
   transporter = 0;
   for (int j = 0; j < FLAG_MAX_RES_COUNT; j++) {
     slot[j].type = RESOURCE_NONE;
+    slot[j].dir = DIR_NONE;
+    slot[j].dest = 0;
   }
   bld_flags = 0;
   bld2_flags = 0;
@@ -97,7 +179,20 @@ flag_t::flag_t(game_t *game, unsigned int index) : game_object_t(game, index) {
     length[i] = 0;
     other_end_dir[i] = 0;
     other_endpoint.f[i] = 0;
+    carried[i] = 0;
+    full_arrivals[i] = 0;
   }
+  queue_load = 0;
+  queue_tick = game->get_tick();
+
+  wake();
+}
+
+/* Put the flag back into the set of flags updated each tick. Called
+   whenever something that is_idle() depends on changes. */
+void
+flag_t::wake() {
+  game->activate_flag(index);
 }
 
 void
@@ -109,6 +204,8 @@ flag_t::add_path(dir_t dir, bool water) {
     endpoint |= BIT(dir);
   }
   transporter &= ~BIT(dir);
+  wake();
+  game->road_network_changed();
 }
 
 void
@@ -116,6 +213,8 @@ flag_t::del_path(dir_t dir) {
   path_con &= ~BIT(dir);
   endpoint &= ~BIT(dir);
   transporter &= ~BIT(dir);
+  wake();
+  game->road_network_changed();
 
   if (serf_requested(dir)) {
     cancel_serf_request(dir);
@@ -139,15 +238,21 @@ flag_t::del_path(dir_t dir) {
 bool
 flag_t::pick_up_resource(int slot, resource_type_t *res, unsigned int *dest) {
   if (this->slot[slot].type == RESOURCE_NONE) {
+    /* The schedule can be left behind when the path of the resource was
+       removed. The transporter then walks on with nothing. */
+    *res = RESOURCE_NONE;
     return false;
   }
 
+  update_queue_load();
+
   *res = this->slot[slot].type;
   *dest = this->slot[slot].dest;
   this->slot[slot].type = RESOURCE_NONE;
   this->slot[slot].dir = DIR_NONE;
 
   fix_scheduled();
+  wake();
 
   return true;
 }
@@ -156,10 +261,12 @@ bool
 flag_t::drop_resource(resource_type_t res, unsigned int dest) {
   for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
     if (slot[i].type == RESOURCE_NONE) {
+      update_queue_load();
       slot[i].type = res;
       slot[i].dest = dest;
       slot[i].dir = DIR_NONE;
       endpoint |= BIT(7);
+      wake();
       return true;
     }
   }
@@ -167,6 +274,61 @@ flag_t::drop_resource(resource_type_t res, unsigned int dest) {
   return false;
 }
 
+/* Add the resources that waited since the last change to the queue
+   load. */
+void
+flag_t::update_queue_load() {
+  unsigned int waiting = 0;
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    if (slot[i].type != RESOURCE_NONE) waiting++;
+  }
+
+  /* The counters are decayed at least this often, a longer time only
+     happens on the first change after loading a game. */
+  unsigned int tick = game->get_tick();
+  unsigned int ticks = std::min(tick - queue_tick,
+                                static_cast<unsigned int>(
+                                  FLAG_LOAD_DECAY_TICKS));
+  queue_load += waiting * ticks;
+  queue_tick = tick;
+}
+
+unsigned int
+flag_t::get_queue_load() {
+  update_queue_load();
+  return queue_load;
+}
+
+int
+flag_t::get_road_load(dir_t dir) {
+  flag_t *other_flag = other_endpoint.f[dir];
+  dir_t other_dir = get_other_end_dir(dir);
+
+  if (full_arrivals[dir] >= ROAD_LOAD_FULL_ARRIVALS ||
+      other_flag->full_arrivals[other_dir] >= ROAD_LOAD_FULL_ARRIVALS) {
+    return 3;
+  }
+  if (get_queue_load() >= ROAD_LOAD_QUEUE ||
+      other_flag->get_queue_load() >= ROAD_LOAD_QUEUE) {
+    return 2;
+  }
+  if (carried[dir] != 0 || other_flag->carried[other_dir] != 0) {
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+flag_t::decay_load() {
+  update_queue_load();
+  queue_load /= 2;
+  for (int i = 0; i < 6; i++) {
+    carried[i] /= 2;
+    full_arrivals[i] /= 2;
+  }
+}
+
 bool
 flag_t::has_empty_slot() {
   int scheduled_slots = 0;
@@ -215,6 +377,7 @@ flag_t::fix_scheduled() {
 typedef struct {
   resource_type_t resource;
   int max_prio;
+  int best_prio;
   flag_t *flag;
 } schedule_unknown_dest_data_t;
 
@@ -231,7 +394,11 @@ schedule_unknown_dest_cb(flag_t *flag, void *data) {
       dest_data->flag = flag;
     }
 
-    if (dest_data->max_prio > 204) return true;
+    /* Later buildings can't have a higher priority. */
+    if (dest_data->max_prio > 204 ||
+        dest_data->max_prio >= dest_data->best_prio) {
+      return true;
+    }
   }
 
   return false;
@@ -273,21 +440,29 @@ flag_t::schedule_slot_to_unknown_dest(int slot_num) {
   };
 
   resource_type_t res = slot[slot_num].type;
-  if (routable[res]) {
+
+  /* Handle food as one resource group */
+  if (res == RESOURCE_MEAT ||
+      res == RESOURCE_FISH ||
+      res == RESOURCE_BREAD) {
+    res = RESOURCE_GROUP_FOOD;
+  }
+
+  /* Only search when some building of the owner asks for it. */
+  int best_prio = 0;
+  if (routable[slot[slot_num].type]) {
+    best_prio = game->get_max_stock_priority(get_owner(), res);
+  }
+
+  if (best_prio > 0) {
     flag_search_t search(game);
     search.add_source(this);
 
-    /* Handle food as one resource group */
-    if (res == RESOURCE_MEAT ||
-        res == RESOURCE_FISH ||
-        res == RESOURCE_BREAD) {
-      res = RESOURCE_GROUP_FOOD;
-    }
-
     schedule_unknown_dest_data_t data;
     data.resource = res;
     data.flag = NULL;
     data.max_prio = 0;
+    data.best_prio = best_prio;
 
     search.execute(schedule_unknown_dest_cb, false, true, &data);
     if (data.flag != NULL) {
@@ -530,6 +705,7 @@ flag_t::invalidate_resource_path(dir_t dir) {
         slot[i].dir == dir) {
       slot[i].dir = DIR_NONE;
       endpoint |= BIT(7);
+      wake();
     }
   }
 }
@@ -613,6 +789,8 @@ flag_t::restore_path_serf_info(dir_t dir, serf_path_info_t *data) {
     length[dir] |= std::min(data->serf_count, max_serfs);
     other_flag->length[other_dir] |= std::min(data->serf_count, max_serfs);
   }
+
+  other_flag->wake();
 }
 
 bool
@@ -792,6 +970,7 @@ flag_t::merge_paths(map_pos_t pos) {
 
   flag_1->other_endpoint.f[dir_1] = flag_2;
   flag_2->other_endpoint.f[dir_2] = flag_1;
+  game->road_network_changed();
 
   flag_1->transporter &= ~BIT(dir_1);
   flag_2->transporter &= ~BIT(dir_2);
@@ -815,6 +994,9 @@ flag_t::merge_paths(map_pos_t pos) {
     flag_2->length[dir_2] += serf_count;
   }
 
+  flag_1->wake();
+  flag_2->wake();
+
   /* Update serfs with reference to this flag. */
   list_serfs_t serfs = game->get_serfs_related_to(flag_1->get_index(), dir_1);
   list_serfs_t serfs2 = game->get_serfs_related_to(flag_2->get_index(), dir_2);
@@ -826,13 +1008,15 @@ flag_t::merge_paths(map_pos_t pos) {
   }
 }
 
+/* Maximum number of transporters on a path by length category. */
+static const int max_transporters[] = { 1, 2, 3, 4, 6, 8, 11, 15 };
+
+/* Count and store in bitfield which directions
+ have strictly more than 0,1,2,3 slots waiting. */
 void
-flag_t::update() {
-  const int max_transporters[] = { 1, 2, 3, 4, 6, 8, 11, 15 };
+flag_t::get_res_waiting(unsigned int res_waiting[4]) {
+  for (int k = 0; k < 4; k++) res_waiting[k] = 0;
 
-  /* Count and store in bitfield which directions
-   have strictly more than 0,1,2,3 slots waiting. */
-  unsigned int res_waiting[4] = {0};
   for (int j = 0; j < FLAG_MAX_RES_COUNT; j++) {
     if (slot[j].type != RESOURCE_NONE &&
         slot[j].dir != DIR_NONE) {
@@ -845,6 +1029,12 @@ flag_t::update() {
       }
     }
   }
+}
+
+void
+flag_t::update() {
+  unsigned int res_waiting[4];
+  get_res_waiting(res_waiting);
 
   /* Count of total resources waiting at flag */
   int waiting_count = 0;
@@ -901,15 +1091,55 @@ flag_t::update() {
   }
 }
 
+/* Whether update() would leave the flag unchanged. This only depends on
+   the state of the flag itself, so an idle flag stays idle until one of
+   the methods calling wake() changes it. */
+bool
+flag_t::is_idle() {
+  /* Unscheduled resources and failed transporter requests are retried on
+   every update. */
+  if (has_resources() || serf_request_fail()) {
+    return false;
+  }
+
+  unsigned int res_waiting[4];
+  get_res_waiting(res_waiting);
+
+  /* Same decisions as in update(), with no resources waiting. */
+  for (int d = DIR_RIGHT; d <= DIR_UP; d++) {
+    dir_t dir = (dir_t)d;
+    if (!has_path(dir)) continue;
+
+    unsigned int free_count = free_transporter_count(dir);
+    if (serf_requested(dir)) {
+      if (!BIT_TEST(res_waiting[2], d) && free_count != 0 &&
+          !has_transporter(dir)) {
+        return false;
+      }
+    } else if (free_count == 0 || BIT_TEST(res_waiting[2], d)) {
+      int max_tr = max_transporters[length_category(dir)];
+      if (free_count < (unsigned int)max_tr) {
+        return false;
+      }
+    } else if (!has_transporter(dir)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 typedef struct {
   inventory_t *inventory;
   int water;
+  int visited;
 } send_serf_to_road_data_t;
 
 static bool
 send_serf_to_road_search_cb(flag_t *flag, void *data) {
   send_serf_to_road_data_t *road_data =
     static_cast<send_serf_to_road_data_t*>(data);
+  road_data->visited += 1;
   if (flag->has_inventory()) {
     /* Inventory reached */
     building_t *building = flag->get_building();
@@ -940,6 +1170,14 @@ flag_t::call_transporter(dir_t dir, bool water) {
   flag_t *src_2 = other_endpoint.f[dir];
   dir_t dir_2 = get_other_end_dir(dir);
 
+  /* Don't search if no inventory has a serf to send, or if both ends
+     were reached by a search that failed earlier in this pass. */
+  if (!game->can_send_transporter(get_owner(), water) ||
+      (game->is_transporter_search_failed(search_num, water) &&
+       game->is_transporter_search_failed(src_2->search_num, water))) {
+    return false;
+  }
+
   search_dir = DIR_RIGHT;
   src_2->search_dir = DIR_DOWN_RIGHT;
 
@@ -950,9 +1188,15 @@ flag_t::call_transporter(dir_t dir, bool water) {
   send_serf_to_road_data_t data;
   data.inventory = NULL;
   data.water = water;
+  data.visited = 0;
   search.execute(send_serf_to_road_search_cb, true, false, &data);
   inventory_t *inventory = data.inventory;
   if (inventory == NULL) {
+    /* Searches cut short at the depth limit tell nothing about the
+       flags they didn't reach. */
+    if (data.visited < SEARCH_MAX_DEPTH) {
+      game->transporter_search_failed(search.get_id(), water);
+    }
     return false;
   }
 
@@ -962,6 +1206,7 @@ flag_t::call_transporter(dir_t dir, bool water) {
 
   length[dir] |= BIT(7);
   src_2->length[dir_2] |= BIT(7);
+  src_2->wake();
 
   flag_t *src = this;
   if (dest_flag->search_dir == src_2->search_dir) {
@@ -981,6 +1226,7 @@ flag_t::reset_transport(flag_t *other) {
         other->slot[slot_].dest == index) {
       other->slot[slot_].dest = 0;
       other->endpoint |= BIT(7);
+      other->wake();
 
       if (other->slot[slot_].dir != DIR_NONE) {
         dir_t dir = other->slot[slot_].dir;
@@ -22,6 +22,7 @@
 #ifndef SRC_FLAG_H_
 #define SRC_FLAG_H_
 
+#include <map>
 #include <vector>
 
 #include "src/building.h"
@@ -39,6 +40,9 @@ typedef struct {
 /* Max number of resources waiting at a flag */
 #define FLAG_MAX_RES_COUNT  8
 
+/* Ticks between halvings of the road load counters. */
+#define FLAG_LOAD_DECAY_TICKS  1500
+
 class building_t;
 class player_t;
 class save_reader_binary_t;
@@ -73,6 +77,13 @@ class flag_t : public game_object_t {
   int bld_flags;
   int bld2_flags;
 
+  /* Road load counters, see get_road_load(). They are halved by
+     decay_load() every so often and are not saved with the game. */
+  unsigned int carried[6];
+  unsigned int full_arrivals[6];
+  unsigned int queue_load;
+  unsigned int queue_tick;
+
  public:
   flag_t(game_t *game, unsigned int index);
 
@@ -117,15 +128,16 @@ class flag_t : public game_object_t {
 
   /* Current number of transporters on path. */
   unsigned int free_transporter_count(dir_t dir) { return length[dir] & 0xf; }
-  void transporter_to_serve(dir_t dir) { length[dir] -= 1; }
+  void transporter_to_serve(dir_t dir) { length[dir] -= 1; wake(); }
   /* Length category of path determining max number of transporters. */
   unsigned int length_category(dir_t dir) { return (length[dir] >> 4) & 7; }
   /* Whether a transporter serf was successfully requested for this path. */
   bool serf_requested(dir_t dir) { return (length[dir] >> 7) & 1; }
-  void cancel_serf_request(dir_t dir) { length[dir] &= ~BIT(7); }
+  void cancel_serf_request(dir_t dir) { length[dir] &= ~BIT(7); wake(); }
   void complete_serf_request(dir_t dir) {
     length[dir] &= ~BIT(7);
     length[dir] += 1;
+    wake();
   }
 
   /* The slot that is scheduled for pickup by the given path. */
@@ -142,6 +154,22 @@ class flag_t : public game_object_t {
   void remove_all_resources();
   resource_type_t get_resource_at_slot(int slot);
 
+  /* Resources recently carried away on the path in the given
+     direction. */
+  unsigned int get_carried_count(dir_t dir) const { return carried[dir]; }
+  void resource_carried(dir_t dir) { carried[dir] += 1; }
+  /* Transporters on the path in the given direction that recently
+     found this flag full and had to turn back with their resource. */
+  unsigned int get_full_arrival_count(dir_t dir) const {
+    return full_arrivals[dir]; }
+  void transporter_found_full(dir_t dir) { full_arrivals[dir] += 1; }
+  /* Sum of resources waiting at the flag times ticks, recently. */
+  unsigned int get_queue_load();
+  /* Load of the road in the given direction, from 0 (unused) to 3
+     (transporters turn back because a flag at either end is full). */
+  int get_road_load(dir_t dir);
+  void decay_load();
+
   /* Whether this flag has an inventory building. */
   bool has_inventory() { return ((bld_flags >> 6) & 1); }
   /* Whether this inventory accepts resources. */
@@ -182,6 +210,8 @@ class flag_t : public game_object_t {
                       dir_t in_dir, dir_t out_dir);
 
   void update();
+  /* Whether update() has nothing to do until the flag is changed. */
+  bool is_idle();
 
   /* Get road length category value for real length.
    Determines number of serfs servicing the path segment.(?) */
@@ -201,7 +231,10 @@ class flag_t : public game_object_t {
                                   serf_path_info_t *data);
 
  protected:
+  void wake();
+  void update_queue_load();
   void fix_scheduled();
+  void get_res_waiting(unsigned int res_waiting[4]);
 
   void schedule_slot_to_unknown_dest(int slot);
   void schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]);
@@ -220,6 +253,8 @@ class flag_search_t {
 
  public:
   explicit flag_search_t(game_t *game);
+  /* Search with an id from game_t::reserve_search_ids(). */
+  flag_search_t(game_t *game, int id) : game(game), id(id) {}
 
   int get_id() { return id; }
   void add_source(flag_t *flag);
@@ -230,4 +265,37 @@ class flag_search_t {
                      bool land, bool transporter, void *data);
 };
 
+/* Hop counts over land roads to the flags that serfs walk to. A serf
+   walking to a flag picks the road at each flag on the way with a
+   search from the neighbouring flags, and that search ends up on the
+   first of them closest to the destination. The counts are kept per
+   destination until the roads change. */
+class flag_path_cache_t {
+ protected:
+  typedef std::vector<unsigned int> distances_t;
+  typedef std::map<unsigned int, distances_t> tables_t;
+
+  game_t *game;
+  tables_t tables;
+  unsigned int builds;
+  unsigned int hits;
+
+ public:
+  explicit flag_path_cache_t(game_t *game)
+    : game(game), builds(0), hits(0) {}
+
+  /* Direction to leave src in on the way to dest, as the walking serfs'
+     flag search would find it. DIR_NONE if dest can't be reached. */
+  dir_t get_next_dir(flag_t *src, flag_t *dest);
+
+  /* Drop all tables. Called whenever a road is added or removed. */
+  void clear() { tables.clear(); }
+
+  unsigned int get_builds() const { return builds; }
+  unsigned int get_hits() const { return hits; }
+
+ protected:
+  const distances_t &get_distances(flag_t *dest);
+};
+
 #endif  // SRC_FLAG_H_
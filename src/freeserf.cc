@@ -21,6 +21,7 @@
 
 #include "src/freeserf.h"
 
+#include <cstring>
 #include <ctime>
 #include <string>
 
@@ -42,11 +43,17 @@
 #include "src/version.h"
 #include "src/game.h"
 #include "src/data.h"
+#include "src/data-cache.h"
 #include "src/audio.h"
 #include "src/gfx.h"
-#include "src/video-sdl.h"
+#ifdef ENABLE_SOFTWARE_VIDEO
+# include "src/video-soft.h"
+#else
+# include "src/video-sdl.h"
+#endif
 #include "src/event_loop.h"
 #include "src/interface.h"
+#include "src/viewport.h"
 
 #define DEFAULT_SCREEN_WIDTH  800
 #define DEFAULT_SCREEN_HEIGHT 600
@@ -59,8 +66,7 @@
 # endif
 #endif
 
-/* Autosave interval */
-#define AUTOSAVE_INTERVAL  (10*60*TICKS_PER_SEC)
+static save_async_t *async_save = NULL;
 
 /* In target, replace any character from needle with replacement character. */
 static void
@@ -77,7 +83,14 @@ strreplace(char *target, const char *needle, char replace) {
 
 bool
 save_game(int autosave, game_t *game) {
-  size_t r;
+  /* Autosaves use the faster binary format and are written in the
+     background, saves made by the player stay readable text. Both are
+     detected on load. Each autosave replaces the last one, so they do
+     not pile up in long sessions. */
+  if (autosave) {
+    if (async_save == NULL) async_save = new save_async_t();
+    return async_save->save(AUTOSAVE_FILE, game);
+  }
 
   /* Build filename including time stamp. */
   char name[128];
@@ -86,13 +99,8 @@ save_game(int autosave, game_t *game) {
   struct tm *tm = std::localtime(&t);
   if (tm == NULL) return false;
 
-  if (!autosave) {
-    r = strftime(name, sizeof(name), "%c.save", tm);
-    if (r == 0) return false;
-  } else {
-    r = strftime(name, sizeof(name), "autosave-%c.save", tm);
-    if (r == 0) return false;
-  }
+  size_t r = strftime(name, sizeof(name), "%c.save", tm);
+  if (r == 0) return false;
 
   /* Substitute problematic characters. These are problematic
      particularly on windows platforms, but also in general on FAT
@@ -103,26 +111,67 @@ save_game(int autosave, game_t *game) {
   FILE *f = fopen(name, "wb");
   if (f == NULL) return false;
 
-  if (!save_text_state(f, game)) return false;
-
-  fclose(f);
+  bool saved = save_text_state(f, game);
+  saved = (fclose(f) == 0) && saved;
+  if (!saved) return false;
 
   LOGI("main", "Game saved to `%s'.", name);
 
   return true;
 }
 
+/* Progress bar shown while graphics are preloaded. */
+class loading_screen_t : public preload_progress_t {
+ protected:
+  gfx_t *gfx;
+
+ public:
+  explicit loading_screen_t(gfx_t *gfx) : gfx(gfx) {}
+
+  virtual void preload_progress(unsigned int done, unsigned int total) {
+    unsigned int width = 0;
+    unsigned int height = 0;
+    gfx->get_resolution(&width, &height);
+
+    int bar_width = width / 2;
+    int x = (width - bar_width) / 2;
+    int y = height / 2 - 4;
+    int filled = (total > 0) ? bar_width * done / total : bar_width;
+
+    frame_t *screen = gfx->get_screen_frame();
+    screen->fill_rect(0, 0, width, height, 1);
+    screen->draw_rect(x - 2, y - 2, bar_width + 4, 12, 31);
+    screen->fill_rect(x, y, filled, 8, 31);
+    delete screen;
+
+    gfx->swap_buffers();
+  }
+};
+
+#ifdef ENABLE_SOFTWARE_VIDEO
+# define FRAME_DUMP_OPT   "s:"
+# define FRAME_DUMP_HELP  " -s PREFIX\tWrite every frame to PREFIXnnnnnn.bmp\n"
+#else
+# define FRAME_DUMP_OPT   ""
+# define FRAME_DUMP_HELP  ""
+#endif
+
 #define USAGE                                               \
   "Usage: %s [-g DATA-FILE]\n"
 #define HELP                                                \
   USAGE                                                     \
+      " -c\t\tCache decoded game data for faster startup\n" \
       " -d NUM\t\tSet debug output level\n"                 \
       " -f\t\tFullscreen mode (CTRL-q to exit)\n"           \
       " -g DATA-FILE\tUse specified data file\n"            \
       " -h\t\tShow this help text\n"                        \
+      " -j NUM\t\tRun economy passes on NUM threads\n"      \
       " -l FILE\tLoad saved game\n"                         \
+      " -p\t\tDecode graphics on all CPU cores at startup\n"  \
       " -r RES\t\tSet display resolution (e.g. 800x600)\n"  \
+      FRAME_DUMP_HELP                                       \
       " -t GEN\t\tMap generator (0 or 1)\n"                 \
+      " -v\t\tVerify scheduling of flags and buildings\n"   \
       "\n"                                                  \
       "Please report bugs to <" PACKAGE_BUGREPORT ">\n"
 
@@ -135,15 +184,21 @@ main(int argc, char *argv[]) {
   int screen_height = DEFAULT_SCREEN_HEIGHT;
   bool fullscreen = false;
   int map_generator = 0;
+  bool use_cache = false;
+  bool preload = false;
+  std::string frame_dump;
 
   log_level_t log_level = DEFAULT_LOG_LEVEL;
 
 #ifdef HAVE_GETOPT_H
   while (true) {
-    char opt = getopt(argc, argv, "d:fg:hl:r:t:");
+    char opt = getopt(argc, argv, "cd:fg:hj:l:pr:" FRAME_DUMP_OPT "t:v");
     if (opt < 0) break;
 
     switch (opt) {
+      case 'c':
+        use_cache = true;
+        break;
       case 'd': {
           int d = atoi(optarg);
           if (d >= 0 && d < LOG_LEVEL_MAX) {
@@ -163,11 +218,19 @@ main(int argc, char *argv[]) {
         fprintf(stdout, HELP, argv[0]);
         exit(EXIT_SUCCESS);
         break;
+      case 'j': {
+          int j = atoi(optarg);
+          if (j >= 0) game_t::set_economy_threads(j);
+        }
+        break;
       case 'l':
         if (strlen(optarg) > 0) {
           save_file = optarg;
         }
         break;
+      case 'p':
+        preload = true;
+        break;
       case 'r': {
           char *hstr = strchr(optarg, 'x');
           if (hstr == NULL) {
@@ -178,9 +241,19 @@ main(int argc, char *argv[]) {
           screen_height = atoi(hstr+1);
         }
         break;
+#ifdef ENABLE_SOFTWARE_VIDEO
+      case 's':
+        if (strlen(optarg) > 0) {
+          frame_dump = optarg;
+        }
+        break;
+#endif
       case 't':
         map_generator = atoi(optarg);
         break;
+      case 'v':
+        game_t::set_verify_scheduling(true);
+        break;
       default:
         fprintf(stderr, USAGE, argv[0]);
         exit(EXIT_FAILURE);
@@ -196,6 +269,9 @@ main(int argc, char *argv[]) {
   LOGI("main", "freeserf %s", FREESERF_VERSION);
 
   data_t *data = data_t::get_instance();
+  if (use_cache) {
+    data->set_cache_dir(data_cache_t::get_default_dir());
+  }
   if (!data->load(data_file)) {
     delete data;
     LOGE("main", "Could not load game data.");
@@ -208,11 +284,25 @@ main(int argc, char *argv[]) {
   try {
     gfx = gfx_t::get_instance();
     gfx->set_resolution(screen_width, screen_height, fullscreen);
+#ifdef ENABLE_SOFTWARE_VIDEO
+    if (!frame_dump.empty()) {
+      video_soft_t *video = static_cast<video_soft_t*>(video_t::get_instance());
+      video->set_frame_dump(frame_dump);
+    }
+#endif
   } catch (Freeserf_Exception &e) {
     LOGE(e.get_system().c_str(), e.what());
     return -1;
   }
 
+  if (preload) {
+    loading_screen_t loading_screen(gfx);
+    sprite_preloader_t preloader;
+    preloader.add_defaults();
+    viewport_t::add_preload_sprites(&preloader);
+    preloader.run(&loading_screen);
+  }
+
   /* TODO move to right place */
   audio_t *audio = audio_t::get_instance();
   audio_volume_controller_t *volume_controller = audio->get_volume_controller();
@@ -260,6 +350,11 @@ main(int argc, char *argv[]) {
   LOGI("main", "Cleaning up...");
 
   /* Clean up */
+  if (async_save != NULL) {
+    delete async_save;
+    async_save = NULL;
+  }
+
   game = interface->get_game();
   delete interface;
   if (game != NULL) {
@@ -26,6 +26,13 @@
 #define TICK_LENGTH  20
 #define TICKS_PER_SEC  (1000/TICK_LENGTH)
 
+/* Autosave interval */
+#define AUTOSAVE_INTERVAL  (10*60*TICKS_PER_SEC)
+
+/* Autosaves go to this file in the current directory, replacing the
+   previous autosave. */
+#define AUTOSAVE_FILE  "autosave.save"
+
 class game_t;
 
 bool save_game(int autosave, game_t *game);
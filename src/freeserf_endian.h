@@ -83,7 +83,7 @@
 # define htobe64(x)  be64toh(x)
 # define htole16(x)  le16toh(x)
 # define htole32(x)  le32toh(x)
-# define htole64(x)  le32toh(x)
+# define htole64(x)  le64toh(x)
 
 #endif /* HAVE_SYS_ENDIAN_H */
 
@@ -0,0 +1,155 @@
+/*
+ * game-check.cc - Check that game updates are deterministic
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs two copies of a saved game side by side and compares them after
+   every tick. Usage:
+
+     game-check [-n TICKS] [-i INTERVAL] [-j THREADS] FILE
+
+   The reference copy updates every flag, building and serf on each
+   tick, as with -v, and runs the economy passes on the game thread.
+   The other copy is updated the way the game normally is, with the
+   economy passes on THREADS threads. Both must stay equal; on the first
+   difference the two games are saved as text next to FILE so that they
+   can be compared with diff. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "src/game.h"
+#include "src/savegame.h"
+#include "src/log.h"
+
+static game_t *
+load_game(const char *path) {
+  game_t *game = new game_t(0);
+  game->init();
+  if (!game->load_save_game(path)) {
+    delete game;
+    return NULL;
+  }
+  /* Saved games are loaded paused. */
+  game->pause();
+  return game;
+}
+
+static void
+write_text(const std::string &path, game_t *game) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to write '%s'.\n", path.c_str());
+    return;
+  }
+  save_text_state(f, game);
+  fclose(f);
+  printf("Saved '%s'.\n", path.c_str());
+}
+
+static double
+seconds_since(clock_t start) {
+  return static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char *argv[]) {
+  unsigned int ticks = 1000;
+  unsigned int interval = 1;
+  unsigned int threads = 0;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      ticks = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (path == NULL || ticks == 0 || interval == 0) {
+    fprintf(stderr, "Usage: %s [-n TICKS] [-i INTERVAL] [-j THREADS] FILE\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  log_set_file(stderr);
+  log_set_level(LOG_LEVEL_WARN);
+
+  game_t::set_economy_threads(0);
+  game_t *reference = load_game(path);
+  game_t::set_economy_threads(threads);
+  game_t *game = load_game(path);
+  if (reference == NULL || game == NULL) {
+    fprintf(stderr, "Unable to load '%s'.\n", path);
+    return EXIT_FAILURE;
+  }
+
+  double reference_seconds = 0;
+  double game_seconds = 0;
+  save_image_t reference_image;
+  save_image_t game_image;
+
+  for (unsigned int i = 1; i <= ticks; i++) {
+    game_t::set_verify_scheduling(true);
+    clock_t start = clock();
+    reference->update();
+    reference_seconds += seconds_since(start);
+
+    game_t::set_verify_scheduling(false);
+    start = clock();
+    game->update();
+    game_seconds += seconds_since(start);
+
+    if (i % interval != 0 && i != ticks) continue;
+
+    if (!reference_image.create(reference) || !game_image.create(game)) {
+      fprintf(stderr, "Unable to take snapshots of the games.\n");
+      return EXIT_FAILURE;
+    }
+
+    if (reference_image != game_image) {
+      printf("Games differ after %u ticks (game tick %u).\n", i,
+             reference->get_tick());
+      write_text(std::string(path) + ".reference.txt", reference);
+      write_text(std::string(path) + ".check.txt", game);
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("Games are equal after %u ticks.\n", ticks);
+  printf("%-12s %8.3f s\n", "reference", reference_seconds);
+  printf("%-12s %8.3f s\n", "checked", game_seconds);
+
+  flag_path_cache_t *path_cache = game->get_path_cache();
+  printf("Path tables built %u times, reused %u times.\n",
+         path_cache->get_builds(), path_cache->get_hits());
+
+  delete game;
+  delete reference;
+
+  return EXIT_SUCCESS;
+}
@@ -38,46 +38,143 @@
 #include "src/log.h"
 #include "src/misc.h"
 #include "src/inventory.h"
+#include "src/ai.h"
 
 #define GROUND_ANALYSIS_RADIUS  25
 
+/* Lowest stock priority that inventories send resources for. */
+#define INVENTORY_DEST_MIN_PRIO  16
+
+bool game_t::verify_scheduling = false;
+unsigned int game_t::economy_threads = 0;
+
 game_t::game_t(int map_generator)
   : players(this)
   , flags(this)
   , inventories(this)
   , buildings(this)
-  , serfs(this) {
+  , serfs(this)
+  , path_cache(this) {
   map = NULL;
   this->map_generator = map_generator;
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    player_priority_serial[i] = 0;
+  }
+  serf_update_tick = 0;
+  serf_update_prev_tick = 0;
+  serf_update_index = UINT_MAX;
+  serf_delete_count = 0;
+  road_load_counter = FLAG_LOAD_DECAY_TICKS;
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    ais[i] = NULL;
+  }
+  economy_pool = NULL;
+  if (economy_threads > 1) {
+    economy_pool = new thread_pool_t(economy_threads);
+  }
+  economy_running = false;
   allocate_objects();
 }
 
 game_t::~game_t() {
   deinit();
+  delete economy_pool;
 }
 
 /* Clear the serf request bit of all flags and buildings.
    This allows the flag or building to try and request a
-   serf again. */
+   serf again. The bit is only set by update() and idle objects
+   never have it set, so only the active objects are visited. */
 void
 game_t::clear_serf_request_failure() {
-  for (buildings_t::iterator i = buildings.begin(); i != buildings.end(); ++i) {
-    building_t *building = *i;
-    building->clear_serf_request_failure();
+  unsigned int index = 0;
+  while (active_buildings.next(&index)) {
+    building_t *building = buildings[index];
+    if (building != NULL) building->clear_serf_request_failure();
+    index++;
   }
 
-  for (flags_t::iterator i = flags.begin(); i != flags.end(); ++i) {
-    flag_t *flag = *i;
-    flag->serf_request_clear();
+  index = 0;
+  while (active_flags.next(&index)) {
+    flag_t *flag = flags[index];
+    if (flag != NULL) flag->serf_request_clear();
+    index++;
+  }
+}
+
+class game_t::knight_morale_task_t : public thread_task_t {
+ protected:
+  player_t *player;
+
+ public:
+  explicit knight_morale_task_t(player_t *player) : player(player) {}
+
+  virtual void run() { player->update_knight_morale(); }
+};
+
+class game_t::inventories_task_t : public thread_task_t {
+ protected:
+  game_t *game;
+  player_t *player;
+  const resource_type_t *resources;
+  int search_id;
+
+ public:
+  inventories_task_t(game_t *game, player_t *player,
+                     const resource_type_t *resources, int search_id)
+    : game(game), player(player), resources(resources),
+      search_id(search_id) {}
+
+  virtual void run() {
+    game->update_player_inventories(player, resources, search_id);
   }
+};
+
+/* Run the tasks of an economy pass, on the pool if there is one. */
+void
+game_t::run_economy_tasks(const std::vector<thread_task_t*> &tasks) {
+  if (economy_pool == NULL) {
+    for (std::vector<thread_task_t*>::const_iterator it = tasks.begin();
+         it != tasks.end(); ++it) {
+      (*it)->run();
+    }
+    return;
+  }
+
+  economy_running = true;
+  for (std::vector<thread_task_t*>::const_iterator it = tasks.begin();
+       it != tasks.end(); ++it) {
+    economy_pool->add_task(*it);
+  }
+  economy_pool->wait();
+  economy_running = false;
 }
 
+void
+game_t::activate_building(unsigned int index) {
+  /* The active set does not depend on the order of insertion, so the
+     economy tasks only need to take turns. */
+  if (economy_running) {
+    mutex_lock_t lock(&activation_mutex);
+    active_buildings.insert(index);
+  } else {
+    active_buildings.insert(index);
+  }
+}
+
+/* Knight morale of a player only depends on its own buildings and
+   inventories, and on the military scores of the others, which are not
+   changed here. */
 void
 game_t::update_knight_morale() {
+  std::vector<knight_morale_task_t> tasks;
   for (players_t::iterator it = players.begin(); it != players.end(); ++it) {
-    player_t *player = *it;
-    player->update_knight_morale();
+    tasks.push_back(knight_morale_task_t(*it));
   }
+
+  std::vector<thread_task_t*> pass;
+  for (size_t i = 0; i < tasks.size(); i++) pass.push_back(&tasks[i]);
+  run_economy_tasks(pass);
 }
 
 typedef struct {
@@ -94,7 +191,8 @@ game_t::update_inventories_cb(flag_t *flag, void *d) {
   if (data->max_prio[inv] < 255 && flag->has_building()) {
     building_t *building = flag->get_building();
 
-    int bld_prio = building->get_max_priority_for_resource(data->resource, 16);
+    int bld_prio = building->get_max_priority_for_resource(
+                                      data->resource, INVENTORY_DEST_MIN_PRIO);
     if (bld_prio > data->max_prio[inv]) {
       data->max_prio[inv] = bld_prio;
       data->flags[inv] = flag;
@@ -165,93 +263,157 @@ game_t::update_inventories() {
     default: arr = arr_1; break;
   }
 
-  while (arr[0] != RESOURCE_NONE) {
-    for (players_t::iterator it = players.begin(); it != players.end(); ++it) {
-      inventory_t *invs[256];
-      int n = 0;
-      for (inventories_t::iterator i = inventories.begin();
-           i != inventories.end(); ++i) {
-        inventory_t *inventory = *i;
-        if (inventory->get_owner() == (*it)->get_index() &&
-            !inventory->is_queue_full()) {
-          inventory_mode_t res_dir = inventory->get_res_mode();
-          if (res_dir == mode_in || res_dir == mode_stop) {  // In mode,
-                                                             // stop mode
-            if (arr[0] == RESOURCE_GROUP_FOOD) {
-              if (inventory->has_food()) {
-                invs[n++] = inventory;
-                if (n == 256) break;
-              }
-            } else if (inventory->get_count_of(arr[0]) != 0) {
-              invs[n++] = inventory;
-              if (n == 256) break;
+  /* Every player gets a search id for each resource of the pass, so
+     the ids do not depend on the order the players are handled in. */
+  unsigned int count = 0;
+  while (arr[count] != RESOURCE_NONE) count++;
+  int search_id = reserve_search_ids(count * players.size());
+
+  std::vector<inventories_task_t> tasks;
+  for (players_t::iterator it = players.begin(); it != players.end(); ++it) {
+    tasks.push_back(inventories_task_t(this, *it, arr, search_id));
+    search_id += count;
+  }
+
+  std::vector<thread_task_t*> pass;
+  for (size_t i = 0; i < tasks.size(); i++) pass.push_back(&tasks[i]);
+  run_economy_tasks(pass);
+}
+
+/* Inventory pass of one player. Roads only connect flags of the same
+   player, so the searches of different players never meet. */
+void
+game_t::update_player_inventories(player_t *player,
+                                  const resource_type_t *resources,
+                                  int search_id) {
+  /* Priorities only drop during the pass, so there is no need to
+     search for resources that no building asks for. */
+  int demand[RESOURCE_GROUP_FOOD+1];
+  get_stock_priorities(player->get_index(), demand);
+
+  std::vector<inventory_t*> invs;
+  std::vector<int> max_prio;
+  std::vector<flag_t*> flags_;
+
+  for (; resources[0] != RESOURCE_NONE; resources++, search_id++) {
+    invs.clear();
+    for (inventories_t::iterator i = inventories.begin();
+         i != inventories.end(); ++i) {
+      inventory_t *inventory = *i;
+      if (inventory->get_owner() == player->get_index() &&
+          !inventory->is_queue_full()) {
+        inventory_mode_t res_dir = inventory->get_res_mode();
+        if (res_dir == mode_in || res_dir == mode_stop) {  // In mode,
+                                                           // stop mode
+          if (demand[resources[0]] < INVENTORY_DEST_MIN_PRIO) continue;
+
+          if (resources[0] == RESOURCE_GROUP_FOOD) {
+            if (inventory->has_food()) {
+              invs.push_back(inventory);
             }
-          } else { /* Out mode */
-            player_t *player = *it;
-
-            int prio = 0;
-            resource_type_t type = RESOURCE_NONE;
-            for (int i = 0; i < 26; i++) {
-              if (inventory->get_count_of((resource_type_t)i) != 0 &&
-                  player->get_inventory_prio(i) >= prio) {
-                prio = player->get_inventory_prio(i);
-                type = (resource_type_t)i;
-              }
+          } else if (inventory->get_count_of(resources[0]) != 0) {
+            invs.push_back(inventory);
+          }
+        } else { /* Out mode */
+          int prio = 0;
+          resource_type_t type = RESOURCE_NONE;
+          for (int i = 0; i < 26; i++) {
+            if (inventory->get_count_of((resource_type_t)i) != 0 &&
+                player->get_inventory_prio(i) >= prio) {
+              prio = player->get_inventory_prio(i);
+              type = (resource_type_t)i;
             }
+          }
 
-            if (type != RESOURCE_NONE) {
-              inventory->add_to_queue(type, 0);
-            }
+          if (type != RESOURCE_NONE) {
+            inventory->add_to_queue(type, 0);
           }
         }
       }
+    }
 
-      if (n == 0) continue;
+    if (invs.empty()) continue;
 
-      flag_search_t search(this);
+    size_t n = invs.size();
+    max_prio.assign(n, 0);
+    flags_.assign(n, NULL);
 
-      int max_prio[256];
-      flag_t *flags_[256];
+    flag_search_t search(this, search_id);
 
-      for (int i = 0; i < n; i++) {
-        max_prio[i] = 0;
-        flags_[i] = NULL;
-        flag_t *flag = flags[invs[i]->get_flag_index()];
-        flag->set_search_dir((dir_t)i);
-        search.add_source(flag);
-      }
+    for (size_t i = 0; i < n; i++) {
+      flag_t *flag = flags[invs[i]->get_flag_index()];
+      flag->set_search_dir((dir_t)i);
+      search.add_source(flag);
+    }
 
-      update_inventories_data_t data;
-      data.resource = arr[0];
-      data.max_prio = max_prio;
-      data.flags = flags_;
-      search.execute(update_inventories_cb, false, true, &data);
+    update_inventories_data_t data;
+    data.resource = resources[0];
+    data.max_prio = &max_prio[0];
+    data.flags = &flags_[0];
+    search.execute(update_inventories_cb, false, true, &data);
 
-      for (int i = 0; i < n; i++) {
-        if (max_prio[i] > 0) {
-          LOGV("game", " dest for inventory %i found", i);
-          resource_type_t res = (resource_type_t)arr[0];
+    for (size_t i = 0; i < n; i++) {
+      if (max_prio[i] > 0) {
+        LOGV("game", " dest for inventory %i found", static_cast<int>(i));
+        resource_type_t res = (resource_type_t)resources[0];
 
-          building_t *dest_bld = flags_[i]->get_building();
-          bool r = dest_bld->add_requested_resource(res, false);
-          assert(r);
+        building_t *dest_bld = flags_[i]->get_building();
+        bool r = dest_bld->add_requested_resource(res, false);
+        assert(r);
 
-          /* Put resource in out queue */
-          inventory_t *src_inv = invs[i];
-          src_inv->add_to_queue(res, dest_bld->get_flag_index());
-        }
+        /* Put resource in out queue */
+        inventory_t *src_inv = invs[i];
+        src_inv->add_to_queue(res, dest_bld->get_flag_index());
       }
     }
-    arr += 1;
   }
 }
 
 /* Update flags as part of the game progression. */
 void
 game_t::update_flags() {
+  failed_transporter_searches[0].clear();
+  failed_transporter_searches[1].clear();
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    stock_priorities_valid[i] = false;
+  }
+
+  if (verify_scheduling) {
+    for (flags_t::iterator i = flags.begin(); i != flags.end(); ++i) {
+      flag_t *flag = *i;
+      unsigned int index = flag->get_index();
+      if (!active_flags.contains(index) && !flag->is_idle()) {
+        LOGW("game", "Flag %u changed without being scheduled.", index);
+      }
+
+      flag->update();
+
+      if (flag->is_idle()) {
+        active_flags.erase(index);
+      } else {
+        active_flags.insert(index);
+      }
+    }
+    return;
+  }
+
+  unsigned int index = 0;
+  while (active_flags.next(&index)) {
+    flag_t *flag = flags[index];
+    if (flag != NULL) flag->update();
+    if (flag == NULL || flag->is_idle()) {
+      active_flags.erase(index);
+    }
+    index++;
+  }
+}
+
+/* Halve the road load counters of all flags so that they follow the
+   recent traffic. */
+void
+game_t::decay_road_load() {
   for (flags_t::iterator i = flags.begin(); i != flags.end(); ++i) {
-    flag_t *flag = *i;
-    flag->update();
+    (*i)->decay_load();
   }
 }
 
@@ -418,24 +580,272 @@ game_t::send_geologist(flag_t *dest) {
                            RESOURCE_NONE);
 }
 
+/* Wake the buildings of a player whose stock priorities depend on the
+   priority settings of the player. */
+void
+game_t::activate_player_buildings(unsigned int player) {
+  for (buildings_t::iterator i = buildings.begin(); i != buildings.end(); ++i) {
+    building_t *building = *i;
+    if (building->get_owner() == player) {
+      active_buildings.insert(building->get_index());
+    }
+  }
+}
+
 /* Update buildings as part of the game progression. */
 void
 game_t::update_buildings() {
-  buildings_t::iterator i = buildings.begin();
-  while (i != buildings.end()) {
-    building_t *building = *i;
-    ++i;
-    building->update(tick);
+  for (players_t::iterator it = players.begin(); it != players.end(); ++it) {
+    player_t *player = *it;
+    unsigned int serial = player->get_priority_serial();
+    if (player_priority_serial[player->get_index()] != serial) {
+      player_priority_serial[player->get_index()] = serial;
+      activate_player_buildings(player->get_index());
+    }
+  }
+
+  if (verify_scheduling) {
+    buildings_t::iterator i = buildings.begin();
+    while (i != buildings.end()) {
+      building_t *building = *i;
+      ++i;
+
+      unsigned int index = building->get_index();
+      bool active = active_buildings.contains(index);
+      int prio_0 = building->get_priority_in_stock(0);
+      int prio_1 = building->get_priority_in_stock(1);
+      if (!active && !building->is_idle()) {
+        LOGW("game", "Building %u changed without being scheduled.", index);
+      }
+
+      building->update(tick);
+
+      building = buildings[index];
+      if (building == NULL) {
+        active_buildings.erase(index);
+        continue;
+      }
+      if (!active && (building->get_priority_in_stock(0) != prio_0 ||
+                      building->get_priority_in_stock(1) != prio_1)) {
+        LOGW("game", "Building %u changed priorities without being"
+             " scheduled.", index);
+      }
+      if (building->is_idle()) {
+        active_buildings.erase(index);
+      } else {
+        active_buildings.insert(index);
+      }
+    }
+    return;
+  }
+
+  unsigned int index = 0;
+  while (active_buildings.next(&index)) {
+    building_t *building = buildings[index];
+    if (building != NULL) {
+      building->update(tick);
+      /* A burning building is deleted by its last update. */
+      building = buildings[index];
+    }
+    if (building == NULL || building->is_idle()) {
+      active_buildings.erase(index);
+    }
+    index++;
+  }
+}
+
+/* Side of the square map regions that serfs are updated ahead in, in
+   tiles, and the least number of serfs to update ahead for the hand-over
+   to the economy pool to pay off. */
+#define SERF_REGION_SIZE  32
+#define SERF_AHEAD_MIN_SERFS  256
+
+/* Serfs of one map region whose next update only changes the serf
+   itself. The updates run on copies of the serfs. */
+class game_t::serf_region_task_t : public thread_task_t {
+ public:
+  std::vector<serf_t*> serfs;
+  std::vector<serf_t> before;
+  std::vector<serf_t> after;
+
+  virtual void run() {
+    for (std::vector<serf_t*>::iterator it = serfs.begin();
+         it != serfs.end(); ++it) {
+      before.push_back(**it);
+      after.push_back(**it);
+      after.back().update();
+    }
+  }
+};
+
+/* Updates that ran ahead of the serf pass, looked up in serf order. */
+class game_t::serf_updates_ahead_t {
+ protected:
+  typedef std::pair<const serf_t*, const serf_t*> update_t;
+  typedef std::vector<std::pair<unsigned int, update_t> > updates_t;
+
+  updates_t updates;
+  size_t next;
+
+ public:
+  std::vector<serf_region_task_t> regions;
+
+  serf_updates_ahead_t() : next(0) {}
+
+  /* Collect the results of the region tasks once they have run. */
+  void sort() {
+    for (size_t r = 0; r < regions.size(); r++) {
+      const serf_region_task_t &region = regions[r];
+      for (size_t i = 0; i < region.serfs.size(); i++) {
+        updates.push_back(std::make_pair(region.serfs[i]->get_index(),
+                                         update_t(&region.before[i],
+                                                  &region.after[i])));
+      }
+    }
+    std::sort(updates.begin(), updates.end());
+  }
+
+  /* Take over the update of the serf if it ran ahead and the serf did
+     not change since. Serfs must be passed in increasing index order. */
+  bool take(serf_t *serf) {
+    unsigned int index = serf->get_index();
+    while (next < updates.size() && updates[next].first < index) next++;
+    if (next == updates.size() || updates[next].first != index) return false;
+    return serf->take_update(*updates[next].second.first,
+                             *updates[next].second.second);
+  }
+};
+
+/* Serfs interact through the map, flags, inventories and the random
+   generator, in the order of the serf pass. Only updates that change
+   nothing but the serf itself can run out of that order. They run on
+   the economy pool, one task per map region, and update_serfs() takes
+   them over in serf order. */
+void
+game_t::update_serfs_ahead(serf_updates_ahead_t *ahead) {
+  std::vector<serf_t*> alone;
+  unsigned int index = 0;
+  while (woken_serfs.next(&index)) {
+    serf_t *serf = serfs[index];
+    if (serf != NULL && active_serfs.contains(index) &&
+        serf->can_update_alone()) {
+      alone.push_back(serf);
+    }
+    index++;
+  }
+  woken_serfs.clear();
+
+  if (alone.size() < SERF_AHEAD_MIN_SERFS) return;
+
+  unsigned int region_cols =
+                   (map->get_cols() + SERF_REGION_SIZE - 1) / SERF_REGION_SIZE;
+  unsigned int region_rows =
+                   (map->get_rows() + SERF_REGION_SIZE - 1) / SERF_REGION_SIZE;
+  ahead->regions.resize(region_cols * region_rows);
+
+  for (std::vector<serf_t*>::iterator it = alone.begin();
+       it != alone.end(); ++it) {
+    map_pos_t pos = (*it)->get_pos();
+    unsigned int region =
+              (map->pos_row(pos) / SERF_REGION_SIZE) * region_cols +
+              map->pos_col(pos) / SERF_REGION_SIZE;
+    ahead->regions[region].serfs.push_back(*it);
+  }
+
+  std::vector<thread_task_t*> pass;
+  for (size_t i = 0; i < ahead->regions.size(); i++) {
+    if (!ahead->regions[i].serfs.empty()) pass.push_back(&ahead->regions[i]);
   }
+  run_economy_tasks(pass);
+  ahead->sort();
 }
 
 /* Update serfs as part of the game progression. */
 void
 game_t::update_serfs() {
-  for (serfs_t::iterator i = serfs.begin(); i != serfs.end(); ++i) {
-    serf_t *serf = *i;
-    serf->update();
+  serf_update_prev_tick = serf_update_tick;
+  serf_update_tick = tick;
+  serf_update_index = 0;
+
+  /* Serfs whose timer expires have skipped the countdown since their
+     last update. Apply it before other serfs get to change them. */
+  serf_timers.advance(tick, &expired_serfs);
+  unsigned int index = 0;
+  while (expired_serfs.next(&index)) {
+    serf_t *serf = serfs[index];
+    if (serf != NULL) serf->count_down_to(serf_update_prev_tick);
+    active_serfs.insert(index);
+    index++;
+  }
+  expired_serfs.clear();
+
+  /* Waiting serfs are updated as well, after checking that they are
+     still only counting down to their timer. */
+  if (verify_scheduling) {
+    for (serfs_t::iterator i = serfs.begin(); i != serfs.end(); ++i) {
+      serf_t *serf = *i;
+      unsigned int index = serf->get_index();
+      if (active_serfs.contains(index)) continue;
+
+      unsigned int wake_tick = 0;
+      if (!serf_timers.is_scheduled(index) ||
+          !serf->get_wake_tick(&wake_tick) ||
+          serf_timers.get_tick(index) > wake_tick) {
+        LOGW("game", "Serf %u changed without being scheduled.", index);
+        serf_timers.cancel(index);
+      }
+      active_serfs.insert(index);
+    }
+  }
+
+  /* The reference run of the determinism check keeps every update in
+     the serf pass. */
+  serf_updates_ahead_t ahead;
+  if (economy_pool != NULL && !verify_scheduling) update_serfs_ahead(&ahead);
+
+  /* The collection is walked along with the set to find the serfs.
+     It is searched again only when serfs were deleted by an update. */
+  serfs_t::iterator it = serfs.begin();
+  index = 0;
+  while (active_serfs.next(&index)) {
+    serf_update_index = index;
+    while (it != serfs.end() && (*it)->get_index() < index) ++it;
+    serf_t *serf = NULL;
+    if (it != serfs.end() && (*it)->get_index() == index) {
+      serf = *it;
+      unsigned int delete_count = serf_delete_count;
+      if (!ahead.take(serf)) serf->update();
+      if (serf_delete_count != delete_count) {
+        it = serfs.lower_bound(index);
+        serf = NULL;
+        if (it != serfs.end() && (*it)->get_index() == index) serf = *it;
+      }
+    }
+
+    unsigned int wake_tick = 0;
+    if (serf == NULL || serf_timers.is_scheduled(index)) {
+      active_serfs.erase(index);
+    } else if (serf->get_wake_tick(&wake_tick)) {
+      active_serfs.erase(index);
+      serf_timers.schedule(index, wake_tick);
+    }
+    index++;
   }
+
+  serf_update_index = UINT_MAX;
+}
+
+/* Put serf back into the update sweep, applying the countdown it
+   skipped while waiting on its timer. */
+void
+game_t::activate_serf(serf_t *serf) {
+  unsigned int index = serf->get_index();
+  if (serf_timers.is_scheduled(index)) {
+    serf->catch_up();
+    serf_timers.cancel(index);
+  }
+  active_serfs.insert(index);
+  if (economy_pool != NULL) woken_serfs.insert(index);
 }
 
 /* Update historical player statistics for one measure. */
@@ -609,33 +1019,38 @@ game_t::update() {
     inventory_schedule_counter += 64;
   }
 
-#if 0
-  /* AI related updates */
-  game.next_index = (game.next_index + 1) % game.max_next_index;
-  if (game.next_index > 32) {
-    for (int i = 0; i < game.max_next_index) {
-      int i = 33 - game.next_index;
-      player_t *player = game.player[i & 3];
-      if (PLAYER_IS_ACTIVE(player) && PLAYER_IS_AI(player)) {
-        /* AI */
-        /* TODO */
-      }
-      game.next_index += 1;
-    }
-  } else if (game.game_speed > 0 &&
-       game.max_flag_index < 50) {
-    player_t *player = game.player[game.next_index & 3];
-    if (PLAYER_IS_ACTIVE(player) && PLAYER_IS_AI(player)) {
-      /* AI */
-      /* TODO */
-    }
-  }
-#endif
+  update_ai();
 
   update_flags();
   update_buildings();
   update_serfs();
   update_game_stats();
+
+  /* Age the road load counters */
+  road_load_counter -= tick_diff;
+  if (road_load_counter < 0) {
+    decay_road_load();
+    road_load_counter += FLAG_LOAD_DECAY_TICKS;
+  }
+}
+
+/* Let the computer players act. They take turns, one on each tick,
+   and spend the work saved up since their last turn, so the AI work
+   of a tick stays bounded however many players there are. */
+void
+game_t::update_ai() {
+  if (tick_diff == 0) return;
+
+  for (unsigned int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    player_t *player = players[i];
+    if (player == NULL || !player->is_ai()) continue;
+
+    if (ais[i] == NULL) ais[i] = new ai_t(this, player);
+    ais[i]->add_credit(tick_diff);
+    if (const_tick % GAME_MAX_PLAYER_COUNT == i) {
+      ais[i]->update();
+    }
+  }
 }
 
 /* Pause or unpause the game. */
@@ -2138,6 +2553,11 @@ game_t::init_map(int size, const random_state_t &rnd, bool preserve_bugs) {
 
 void
 game_t::deinit() {
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    delete ais[i];
+    ais[i] = NULL;
+  }
+
   while (serfs.size()) {
     serfs_t::iterator it = serfs.begin();
     serfs.erase((*it)->get_index());
@@ -2163,6 +2583,14 @@ game_t::deinit() {
     players.erase((*it)->get_index());
   }
 
+  active_flags.clear();
+  active_buildings.clear();
+  path_cache.clear();
+  active_serfs.clear();
+  expired_serfs.clear();
+  woken_serfs.clear();
+  serf_timers.clear();
+
   if (map != NULL) {
     delete map;
     map = NULL;
@@ -2171,14 +2599,18 @@ game_t::deinit() {
 
 void
 game_t::allocate_objects() {
+  /* The games loaded from text saves already have these from the
+     constructor. Allocating them again would leave a stray object at
+     index 1 in saves without one. */
+
   /* Create NULL-serf */
-  serfs.allocate();
+  serfs.get_or_insert(0);
 
   /* Create NULL-building (index 0 is undefined) */
-  buildings.allocate();
+  buildings.get_or_insert(0);
 
   /* Create NULL-flag (index 0 is undefined) */
-  flags.allocate();
+  flags.get_or_insert(0);
 }
 
 bool
@@ -2191,7 +2623,7 @@ game_t::load_mission_map(int level) {
 
   mission_t *mission = mission_t::get_mission(level);
 
-  init_map_rnd = mission->rnd;
+  rnd = mission->rnd;
 
   mission_level = level;
 
@@ -2227,6 +2659,8 @@ game_t::load_random_map(int size, const random_state_t &rnd) {
   init_map(size, rnd, false);
   allocate_objects();
 
+  this->rnd = rnd;
+
   return true;
 }
 
@@ -2253,6 +2687,33 @@ game_t::cancel_transported_resource(resource_type_t res, unsigned int dest) {
   building->cancel_transported_resource(res);
 }
 
+/* The total gold of the map is not saved. Count it like for a new game
+   from the gold left in the ground and the gold ore and bars in stock. */
+void
+game_t::init_gold_deposit() {
+  map->init_ground_gold_deposit();
+
+  for (inventories_t::iterator i = inventories.begin();
+       i != inventories.end(); ++i) {
+    inventory_t *inventory = *i;
+    map->add_gold_deposit(static_cast<int>(
+                                    inventory->get_count_of(RESOURCE_GOLDBAR)));
+    map->add_gold_deposit(static_cast<int>(
+                                    inventory->get_count_of(RESOURCE_GOLDORE)));
+  }
+
+  for (buildings_t::iterator i = buildings.begin(); i != buildings.end(); ++i) {
+    building_t *building = *i;
+    for (int j = 0; j < BUILDING_MAX_STOCK; j++) {
+      resource_type_t type = building->get_res_type_in_stock(j);
+      if (type == RESOURCE_GOLDBAR || type == RESOURCE_GOLDORE) {
+        map->add_gold_deposit(static_cast<int>(
+                                          building->get_res_count_in_stock(j)));
+      }
+    }
+  }
+}
+
 /* Called when a resource is lost forever from the game. This will
    update any global state keeping track of that resource. */
 void
@@ -2265,7 +2726,7 @@ game_t::lose_resource(resource_type_t res) {
 
 uint16_t
 game_t::random_int() {
-  return init_map_rnd.random();
+  return rnd.random();
 }
 
 bool
@@ -2295,6 +2756,21 @@ game_t::next_search_id() {
   return flag_search_counter;
 }
 
+/* Reserve count consecutive search ids and return the first. Searches
+   with these ids may run at the same time as long as they do not reach
+   the same flags. */
+int
+game_t::reserve_search_ids(unsigned int count) {
+  if (flag_search_counter + count > 0xffff) {
+    flag_search_counter = 0;
+    clear_search_id();
+  }
+
+  int first = flag_search_counter + 1;
+  flag_search_counter += count;
+  return first;
+}
+
 serf_t *
 game_t::create_serf(int index) {
   if (index == -1) {
@@ -2306,6 +2782,8 @@ game_t::create_serf(int index) {
 
 void
 game_t::delete_serf(serf_t *serf) {
+  serf_timers.cancel(serf->get_index());
+  serf_delete_count++;
   serfs.erase(serf->get_index());
 }
 
@@ -2385,6 +2863,61 @@ game_t::get_player_inventories(player_t *player) {
   return player_inventories;
 }
 
+/* Highest stock priority of each resource among the buildings of the
+   player, -1 for resources none of them stocks. */
+void
+game_t::get_stock_priorities(unsigned int player, int *priorities) {
+  std::fill(priorities, priorities + RESOURCE_GROUP_FOOD + 1, -1);
+  for (buildings_t::iterator i = buildings.begin(); i != buildings.end(); ++i) {
+    building_t *building = *i;
+    if (building->get_owner() != player) continue;
+    for (int j = 0; j < BUILDING_MAX_STOCK; j++) {
+      resource_type_t type = building->get_res_type_in_stock(j);
+      if (type != RESOURCE_NONE) {
+        priorities[type] = std::max(priorities[type],
+                                    building->get_priority_in_stock(j));
+      }
+    }
+  }
+}
+
+int
+game_t::get_max_stock_priority(unsigned int player, resource_type_t res) {
+  if (!stock_priorities_valid[player]) {
+    get_stock_priorities(player, stock_priorities[player]);
+    stock_priorities_valid[player] = true;
+  }
+  return stock_priorities[player][res];
+}
+
+bool
+game_t::can_send_transporter(unsigned int player, bool water) {
+  for (inventories_t::iterator i = inventories.begin();
+       i != inventories.end(); ++i) {
+    inventory_t *inventory = *i;
+    if (inventory->get_owner() != player) continue;
+
+    if (water) {
+      if (inventory->have_serf(SERF_SAILOR) ||
+          (inventory->have_serf(SERF_GENERIC) &&
+           inventory->get_count_of(RESOURCE_BOAT) > 0)) {
+        return true;
+      }
+    } else if (inventory->have_serf(SERF_TRANSPORTER) ||
+               inventory->have_serf(SERF_GENERIC)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+game_t::is_transporter_search_failed(int search_id, bool water) const {
+  const std::vector<int> &failed = failed_transporter_searches[water ? 1 : 0];
+  return std::find(failed.begin(), failed.end(), search_id) != failed.end();
+}
+
 list_serfs_t
 game_t::get_serfs_at_pos(map_pos_t pos) {
   list_serfs_t result;
@@ -2596,6 +3129,7 @@ operator >> (save_reader_binary_t &reader, game_t &game) {
   game.load_flags(&reader, max_flag_index);
   game.load_buildings(&reader, max_building_index);
   game.load_inventories(&reader, max_inventory_index);
+  game.init_gold_deposit();
 
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
@@ -2759,6 +3293,13 @@ operator >> (save_reader_text_t &reader, game_t &game) {
     ss >> r1 >> c >> r2 >> c >> r3;
     game.rnd = random_state_t(r1, r2, r3);
   }
+  try {
+    game_reader->value("map.random") >> rnd_str;
+    game.map->set_random_state(random_state_t(rnd_str));
+  } catch (...) {
+    /* Older saves lack the map state, start it off the game state. */
+    game.map->set_random_state(game.rnd);
+  }
   game_reader->value("next_index") >> game.next_index;
   game_reader->value("flag_search_counter") >> game.flag_search_counter;
   for (int i = 0; i < 4; i++) {
@@ -2849,6 +3390,8 @@ operator >> (save_reader_text_t &reader, game_t &game) {
     game.map->set_obj_index(flag->get_position(), flag->get_index());
   }
 
+  game.init_gold_deposit();
+
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
 
@@ -2863,6 +3406,7 @@ operator << (save_writer_text_t &writer, game_t &game) {
   writer.value("game_stats_counter") << game.game_stats_counter;
   writer.value("history_counter") << game.history_counter;
   writer.value("random") << (std::string)game.rnd;
+  writer.value("map.random") << (std::string)game.map->get_random_state();
 
   writer.value("next_index") << game.next_index;
   writer.value("flag_search_counter") << game.flag_search_counter;
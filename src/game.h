@@ -34,6 +34,7 @@
 #include "src/random.h"
 #include "src/objects.h"
 #include "src/event_loop.h"
+#include "src/thread-pool.h"
 
 #define DEFAULT_GAME_SPEED  2
 
@@ -52,6 +53,7 @@ typedef std::list<inventory_t*> list_inventories_t;
 class save_reader_binary_t;
 class save_reader_text_t;
 class save_writer_text_t;
+class ai_t;
 
 class game_t : public event_handler_t {
  protected:
@@ -66,7 +68,6 @@ class game_t : public event_handler_t {
   buildings_t buildings;
   serfs_t serfs;
 
-  random_state_t init_map_rnd;
   unsigned int game_speed_save;
   unsigned int game_speed;
   unsigned int tick;
@@ -99,6 +100,62 @@ class game_t : public event_handler_t {
 
   int knight_morale_counter;
   int inventory_schedule_counter;
+  int road_load_counter;
+
+  /* Flags and buildings to update on the next tick. Idle objects leave
+     the sets after their update and are put back when they change. */
+  active_set_t active_flags;
+  active_set_t active_buildings;
+  unsigned int player_priority_serial[GAME_MAX_PLAYER_COUNT];
+
+  /* Transporter searches of the current flag pass that reached every
+     flag they could without finding a serf, for land and water paths.
+     Serfs only leave the inventories during the pass, so the flags they
+     reached cannot get a transporter until the next one. */
+  std::vector<int> failed_transporter_searches[2];
+
+  /* Highest stock priority of each resource among the buildings of
+     each player, taken at most once per flag pass. Priorities only
+     drop while the flags are updated, so the values stay upper bounds
+     for the rest of the pass. */
+  int stock_priorities[GAME_MAX_PLAYER_COUNT][RESOURCE_GROUP_FOOD+1];
+  bool stock_priorities_valid[GAME_MAX_PLAYER_COUNT];
+
+  flag_path_cache_t path_cache;
+  static bool verify_scheduling;
+
+  /* Computer players, created on their first turn. They are not saved
+     and start over from the game state after loading. */
+  ai_t *ais[GAME_MAX_PLAYER_COUNT];
+
+  /* Serfs to update on the next tick. Serfs that are only counting
+     down wait on a timer instead. Serfs below serf_update_index have
+     been updated on serf_update_tick, the others on the sweep before. */
+  active_set_t active_serfs;
+  active_set_t expired_serfs;
+  timer_wheel_t serf_timers;
+  /* Serfs activated while the economy pool is in use. A serf that stays
+     active after its update could not wait for its timer, so only these
+     are looked at for updating ahead, see update_serfs_ahead(). */
+  active_set_t woken_serfs;
+  unsigned int serf_update_tick;
+  unsigned int serf_update_prev_tick;
+  unsigned int serf_update_index;
+  unsigned int serf_delete_count;
+
+  /* The periodic economy passes (inventories, knight morale) run one
+     task per player. The tasks only change objects of their player,
+     except for waking buildings, which takes activation_mutex while
+     the tasks run on the pool. The pool also updates serfs ahead of
+     the serf pass, see update_serfs_ahead(). */
+  class inventories_task_t;
+  class knight_morale_task_t;
+  class serf_region_task_t;
+  class serf_updates_ahead_t;
+  static unsigned int economy_threads;
+  thread_pool_t *economy_pool;
+  bool economy_running;
+  mutex_t activation_mutex;
 
  public:
   explicit game_t(int map_generator);
@@ -182,6 +239,7 @@ class game_t : public event_handler_t {
   int get_resource_history_index() const { return resource_history_index; }
 
   int next_search_id();
+  int reserve_search_ids(unsigned int count);
 
   serf_t *create_serf(int index = -1);
   void delete_serf(serf_t *serf);
@@ -210,18 +268,58 @@ class game_t : public event_handler_t {
   void building_captured(building_t *building);
   void clear_search_id();
 
+  void activate_flag(unsigned int index) { active_flags.insert(index); }
+  flag_path_cache_t *get_path_cache() { return &path_cache; }
+  void road_network_changed() { path_cache.clear(); }
+  /* Whether an inventory of the player has a serf that can be sent out
+     to serve a land or water path. */
+  bool can_send_transporter(unsigned int player, bool water);
+  bool is_transporter_search_failed(int search_id, bool water) const;
+  void transporter_search_failed(int search_id, bool water) {
+    failed_transporter_searches[water ? 1 : 0].push_back(search_id); }
+  /* No building of the player asks for the resource with a higher
+     priority than this during the flag pass; -1 if none asks for it. */
+  int get_max_stock_priority(unsigned int player, resource_type_t res);
+  void activate_building(unsigned int index);
+  void activate_serf(serf_t *serf);
+  bool is_serf_waiting(unsigned int index) const {
+    return serf_timers.is_scheduled(index); }
+  unsigned int get_serf_update_tick(unsigned int index) const {
+    return (index < serf_update_index) ? serf_update_tick :
+                                         serf_update_prev_tick; }
+
+  /* Update every flag, building and serf as before the active sets,
+     warning about objects that should have been in the sets. */
+  static void set_verify_scheduling(bool verify) {
+    verify_scheduling = verify; }
+  /* Run the economy passes of the players on a pool of count threads
+     in games created afterwards. With 0 or 1 they run on the game
+     thread. The result is the same either way. */
+  static void set_economy_threads(unsigned int count) {
+    economy_threads = count; }
+
  protected:
   void allocate_objects();
   void deinit();
+  void init_gold_deposit();
 
   void clear_serf_request_failure();
+  void get_stock_priorities(unsigned int player, int *priorities);
+  void run_economy_tasks(const std::vector<thread_task_t*> &tasks);
   void update_knight_morale();
   static bool update_inventories_cb(flag_t *flag, void *data);
   void update_inventories();
+  void update_player_inventories(player_t *player,
+                                 const resource_type_t *resources,
+                                 int search_id);
+  void update_ai();
   void update_flags();
+  void decay_road_load();
   static bool send_serf_to_flag_search_cb(flag_t *flag, void *data);
   void update_buildings();
+  void activate_player_buildings(unsigned int player);
   void update_serfs();
+  void update_serfs_ahead(serf_updates_ahead_t *ahead);
   void record_player_history(int max_level, int aspect,
                              const int history_index[], const values_t &values);
   int calculate_clear_winner(const values_t &values);
@@ -21,10 +21,14 @@
 
 #include "src/gfx.h"
 
+#include <algorithm>
+#include <sstream>
+
 #include "src/log.h"
 #include "src/data.h"
 #include "src/video.h"
 #include "src/data-source.h"
+#include "src/thread-pool.h"
 
 GFX_Exception::GFX_Exception(const std::string &description) throw()
   : Freeserf_Exception(description) {
@@ -44,6 +48,18 @@ image_t::image_t(video_t *video, sprite_t *sprite) {
   video_image = video->create_image(sprite->get_data(), width, height);
 }
 
+image_t::image_t(video_t *video, void *data, unsigned int width,
+                 unsigned int height) {
+  this->video = video;
+  this->width = width;
+  this->height = height;
+  offset_x = 0;
+  offset_y = 0;
+  delta_x = 0;
+  delta_y = 0;
+  video_image = video->create_image(data, width, height);
+}
+
 image_t::~image_t() {
   if (video_image != NULL) {
     video->destroy_image(video_image);
@@ -77,6 +93,373 @@ image_t::clear_cache() {
     image_cache.erase(image_cache.begin());
     delete image;
   }
+
+  while (!string_cache.empty()) {
+    image_t *image = string_cache.begin()->second;
+    string_cache.erase(string_cache.begin());
+    delete image;
+  }
+}
+
+/* String cache. Numbers in the statistics popups change all the time,
+   so the cache is simply emptied when it grows beyond this size. */
+#define STRING_CACHE_MAX  1024
+
+image_t::string_cache_t image_t::string_cache;
+
+void
+image_t::cache_string(const std::string &str, unsigned char color, int shadow,
+                      image_t *image) {
+  if (string_cache.size() >= STRING_CACHE_MAX) {
+    while (!string_cache.empty()) {
+      delete string_cache.begin()->second;
+      string_cache.erase(string_cache.begin());
+    }
+  }
+
+  string_cache[string_key_t(str, (shadow << 8) | color)] = image;
+}
+
+image_t *
+image_t::get_cached_string(const std::string &str, unsigned char color,
+                           int shadow) {
+  string_cache_t::iterator result =
+    string_cache.find(string_key_t(str, (shadow << 8) | color));
+  if (result == string_cache.end()) {
+    return NULL;
+  }
+  return result->second;
+}
+
+/* Glyph atlas cache, keyed by glyph base index and colour. */
+glyph_atlas_t::atlas_cache_t glyph_atlas_t::atlas_cache;
+
+glyph_atlas_t::glyph_atlas_t(data_source_t *data_source, unsigned int base,
+                             unsigned int count, unsigned char color) {
+  this->count = count;
+  glyph_width = 0;
+  glyph_height = 0;
+
+  sprite_t **glyphs = new sprite_t*[count];
+  for (unsigned int i = 0; i < count; i++) {
+    glyphs[i] = data_source->get_transparent_sprite(base + i, color);
+    if (glyphs[i] == NULL) {
+      LOGW("graphics", "Failed to decode sprite #%i", base + i);
+      continue;
+    }
+    glyph_width = std::max(glyph_width, glyphs[i]->get_width());
+    glyph_height = std::max(glyph_height, glyphs[i]->get_height());
+  }
+
+  unsigned int pitch = glyph_width * count;
+  pixels = new uint32_t[pitch * glyph_height]();
+  for (unsigned int i = 0; i < count; i++) {
+    if (glyphs[i] == NULL) continue;
+    const uint32_t *src =
+      reinterpret_cast<const uint32_t*>(glyphs[i]->get_data());
+    for (unsigned int y = 0; y < glyphs[i]->get_height(); y++) {
+      std::copy(src + y * glyphs[i]->get_width(),
+                src + (y + 1) * glyphs[i]->get_width(),
+                pixels + y * pitch + i * glyph_width);
+    }
+    delete glyphs[i];
+  }
+  delete[] glyphs;
+}
+
+glyph_atlas_t::~glyph_atlas_t() {
+  delete[] pixels;
+}
+
+/* Blend a pixel with straight alpha over another. */
+static uint32_t
+blend_over(uint32_t dest, uint32_t src) {
+  unsigned int sa = src >> 24;
+  if (sa == 0xff) return src;
+  if (sa == 0) return dest;
+
+  unsigned int da = ((dest >> 24) * (0xff - sa) + 0x7f) / 0xff;
+  unsigned int a = sa + da;
+  uint32_t result = a << 24;
+  for (int shift = 0; shift < 24; shift += 8) {
+    unsigned int c = ((src >> shift) & 0xff) * sa +
+                     ((dest >> shift) & 0xff) * da;
+    result |= ((c + a/2) / a) << shift;
+  }
+  return result;
+}
+
+void
+glyph_atlas_t::draw_glyph(unsigned int glyph, uint32_t *dest,
+                          unsigned int pitch, int x, int y) const {
+  if (glyph >= count) return;
+
+  const uint32_t *src = pixels + glyph * glyph_width;
+  for (unsigned int row = 0; row < glyph_height; row++) {
+    uint32_t *d = dest + (y + row) * pitch + x;
+    const uint32_t *s = src + row * glyph_width * count;
+    for (unsigned int col = 0; col < glyph_width; col++) {
+      d[col] = blend_over(d[col], s[col]);
+    }
+  }
+}
+
+glyph_atlas_t *
+glyph_atlas_t::get_atlas(data_source_t *data_source, unsigned int base,
+                         unsigned int count, unsigned char color) {
+  unsigned int id = (base << 8) | color;
+  atlas_cache_t::iterator result = atlas_cache.find(id);
+  if (result != atlas_cache.end()) {
+    return result->second;
+  }
+
+  glyph_atlas_t *atlas = new glyph_atlas_t(data_source, base, count, color);
+  atlas_cache[id] = atlas;
+  return atlas;
+}
+
+void
+glyph_atlas_t::cache_atlas(unsigned int base, unsigned char color,
+                           glyph_atlas_t *atlas) {
+  unsigned int id = (base << 8) | color;
+  atlas_cache_t::iterator result = atlas_cache.find(id);
+  if (result != atlas_cache.end()) {
+    delete result->second;
+  }
+  atlas_cache[id] = atlas;
+}
+
+void
+glyph_atlas_t::clear_cache() {
+  while (!atlas_cache.empty()) {
+    glyph_atlas_t *atlas = atlas_cache.begin()->second;
+    atlas_cache.erase(atlas_cache.begin());
+    delete atlas;
+  }
+}
+
+/* Number of sprites decoded by one task. */
+#define PRELOAD_BATCH_SIZE  32
+
+/* Milliseconds between progress reports. */
+#define PRELOAD_PROGRESS_INTERVAL  40
+
+/* A range of entries decoded by one worker task. */
+class sprite_preloader_t::batch_t : public thread_task_t {
+ protected:
+  sprite_preloader_t *preloader;
+  mutex_t *mutex;
+  bool done;
+
+ public:
+  size_t first;
+  size_t last;
+  bool stored;
+
+  batch_t(sprite_preloader_t *preloader, mutex_t *mutex, size_t first,
+          size_t last)
+    : preloader(preloader), mutex(mutex), done(false), first(first),
+      last(last), stored(false) {}
+
+  virtual void run() {
+    for (size_t i = first; i < last; i++) {
+      preloader->decode(&preloader->entries[i]);
+    }
+    mutex_lock_t lock(mutex);
+    done = true;
+  }
+
+  bool is_done() {
+    mutex_lock_t lock(mutex);
+    return done;
+  }
+};
+
+sprite_preloader_t::sprite_preloader_t() {
+  video = video_t::get_instance();
+  data_source = data_t::get_instance()->get_data_source();
+}
+
+sprite_preloader_t::~sprite_preloader_t() {
+  for (std::vector<entry_t>::iterator it = entries.begin();
+       it != entries.end(); ++it) {
+    delete it->result;
+    delete it->atlas;
+  }
+}
+
+void
+sprite_preloader_t::add(type_t type, unsigned int sprite, unsigned int mask,
+                        unsigned char color) {
+  uint64_t id = sprite_t::create_sprite_id(sprite, mask, color);
+  if (!added.insert(std::make_pair(type, id)).second) {
+    return;
+  }
+
+  entry_t entry = { type, sprite, mask, color, NULL, NULL };
+  entries.push_back(entry);
+}
+
+void
+sprite_preloader_t::add_range(type_t type, unsigned int base,
+                              unsigned int count, unsigned char color) {
+  for (unsigned int i = 0; i < count; i++) {
+    add(type, base + i, 0, color);
+  }
+}
+
+void
+sprite_preloader_t::add_defaults() {
+  /* Frames, panel and icons */
+  add_range(PRELOAD_SOLID, DATA_FRAME_TOP_BASE, DATA_FRAME_TOP_COUNT);
+  add_range(PRELOAD_SOLID, DATA_FRAME_POPUP_BASE, DATA_FRAME_POPUP_COUNT);
+  add_range(PRELOAD_SOLID, DATA_PANEL_BUTTON_BASE, DATA_PANEL_BUTTON_COUNT);
+  add_range(PRELOAD_SOLID, DATA_FRAME_BOTTOM_BASE,
+            DATA_SERF_ARMS_BASE - DATA_FRAME_BOTTOM_BASE);
+  add_range(PRELOAD_SOLID, DATA_FRAME_SPLIT_SVGA_BASE,
+            DATA_FRAME_SPLIT_SVGA_COUNT);
+  add_range(PRELOAD_SOLID, DATA_ICON_BASE, DATA_ICON_COUNT);
+
+  /* Buildings and other game objects */
+  add_range(PRELOAD_TRANSPARENT, DATA_GAME_OBJECT_BASE,
+            DATA_FRAME_TOP_BASE - DATA_GAME_OBJECT_BASE);
+
+  /* Map objects, their shadows, borders and waves */
+  add_range(PRELOAD_TRANSPARENT, DATA_MAP_OBJECT_BASE, DATA_MAP_OBJECT_COUNT);
+  add_range(PRELOAD_OVERLAY, DATA_MAP_SHADOW_BASE, DATA_MAP_SHADOW_COUNT);
+  add_range(PRELOAD_TRANSPARENT, DATA_MAP_BORDER_BASE, DATA_MAP_BORDER_COUNT);
+  for (unsigned int i = 0; i < DATA_MAP_WAVES_COUNT; i++) {
+    add(PRELOAD_WAVES, DATA_MAP_WAVES_BASE + i, 0);
+    add(PRELOAD_WAVES, DATA_MAP_WAVES_BASE + i, DATA_MAP_MASK_UP_BASE + 40);
+    add(PRELOAD_WAVES, DATA_MAP_WAVES_BASE + i, DATA_MAP_MASK_DOWN_BASE + 40);
+  }
+
+  /* Serfs; the torso is coloured with the default player colours. */
+  const unsigned char player_colors[] = { 64, 72, 68, 76 };
+  add(PRELOAD_OVERLAY, DATA_SERF_SHADOW);
+  add_range(PRELOAD_TRANSPARENT, DATA_SERF_ARMS_BASE,
+            DATA_SERF_TORSO_BASE - DATA_SERF_ARMS_BASE);
+  for (int i = 0; i < 4; i++) {
+    add_range(PRELOAD_TRANSPARENT, DATA_SERF_TORSO_BASE,
+              DATA_SERF_HEAD_BASE - DATA_SERF_TORSO_BASE, player_colors[i]);
+  }
+  add_range(PRELOAD_TRANSPARENT, DATA_SERF_HEAD_BASE,
+            DATA_FRAME_SPLIT_SVGA_BASE - DATA_SERF_HEAD_BASE);
+
+  /* Fonts in the colours used by the interface */
+  add(PRELOAD_FONT, DATA_FONT_BASE, DATA_FONT_COUNT, 31);
+  add(PRELOAD_FONT, DATA_FONT_SHADOW_BASE, DATA_FONT_SHADOW_COUNT, 1);
+}
+
+/* Called on a worker thread. Undefined sprites are skipped silently. */
+void
+sprite_preloader_t::decode(entry_t *entry) {
+  sprite_t *s = NULL;
+  sprite_t *m = NULL;
+
+  switch (entry->type) {
+    case PRELOAD_SOLID:
+      entry->result = data_source->get_sprite(entry->sprite);
+      break;
+    case PRELOAD_TRANSPARENT:
+      entry->result = data_source->get_transparent_sprite(entry->sprite,
+                                                          entry->color);
+      break;
+    case PRELOAD_OVERLAY:
+      entry->result = data_source->get_overlay_sprite(entry->sprite);
+      break;
+    case PRELOAD_MASKED:
+    case PRELOAD_WAVES:
+      if (entry->type == PRELOAD_MASKED) {
+        s = data_source->get_sprite(entry->sprite);
+      } else {
+        s = data_source->get_transparent_sprite(entry->sprite, 0);
+      }
+      if (s == NULL) break;
+      if (entry->mask == 0) {
+        entry->result = s;
+        break;
+      }
+      m = data_source->get_mask_sprite(entry->mask);
+      if (m != NULL) {
+        entry->result = s->get_masked(m);
+        delete m;
+      }
+      delete s;
+      break;
+    case PRELOAD_FONT:
+      entry->atlas = new glyph_atlas_t(data_source, entry->sprite,
+                                       entry->mask, entry->color);
+      break;
+  }
+}
+
+/* Move a decoded entry into the image cache, unless it was already
+   created by drawing. Called on the main thread. */
+void
+sprite_preloader_t::store(entry_t *entry) {
+  if (entry->atlas != NULL) {
+    glyph_atlas_t::cache_atlas(entry->sprite, entry->color, entry->atlas);
+    entry->atlas = NULL;
+  }
+
+  if (entry->result == NULL) {
+    return;
+  }
+
+  uint64_t id = sprite_t::create_sprite_id(entry->sprite, entry->mask,
+                                           entry->color);
+  if (image_t::get_cached_image(id) == NULL) {
+    image_t::cache_image(id, new image_t(video, entry->result));
+  }
+
+  delete entry->result;
+  entry->result = NULL;
+}
+
+void
+sprite_preloader_t::run(preload_progress_t *progress) {
+  mutex_t mutex;
+  std::vector<batch_t*> batches;
+  for (size_t i = 0; i < entries.size(); i += PRELOAD_BATCH_SIZE) {
+    size_t last = std::min(i + PRELOAD_BATCH_SIZE, entries.size());
+    batches.push_back(new batch_t(this, &mutex, i, last));
+  }
+
+  thread_pool_t pool;
+  LOGI("graphics", "Preloading %u sprites on %u threads...",
+       static_cast<unsigned int>(entries.size()), pool.get_thread_count());
+  for (std::vector<batch_t*>::iterator it = batches.begin();
+       it != batches.end(); ++it) {
+    pool.add_task(*it);
+  }
+
+  unsigned int done = 0;
+  bool finished = false;
+  while (!finished) {
+    finished = pool.wait(PRELOAD_PROGRESS_INTERVAL);
+
+    for (std::vector<batch_t*>::iterator it = batches.begin();
+         it != batches.end(); ++it) {
+      batch_t *batch = *it;
+      if (batch->stored || !batch->is_done()) continue;
+
+      for (size_t i = batch->first; i < batch->last; i++) {
+        store(&entries[i]);
+      }
+      batch->stored = true;
+      done += batch->last - batch->first;
+    }
+
+    if (progress != NULL) {
+      progress->preload_progress(done, entries.size());
+    }
+  }
+
+  for (std::vector<batch_t*>::iterator it = batches.begin();
+       it != batches.end(); ++it) {
+    delete *it;
+  }
 }
 
 gfx_t *gfx_t::instance = NULL;
@@ -99,11 +482,14 @@ gfx_t::gfx_t() throw(Freeserf_Exception) {
                     sprite->get_height());
   delete sprite;
 
+  zoom_factor = video->get_zoom_factor();
+
   gfx_t::instance = this;
 }
 
 gfx_t::~gfx_t() {
   image_t::clear_cache();
+  glyph_atlas_t::clear_cache();
 
   if (video != NULL) {
     delete video;
@@ -328,10 +714,10 @@ frame_t::draw_waves_sprite(int x, int y, unsigned int mask,
   video->draw_image(image->get_video_image(), x, y, 0, video_frame);
 }
 
-/* Draw a character at x, y in the dest frame. */
-void
-frame_t::draw_char_sprite(int x, int y, unsigned char c, unsigned char color,
-                          unsigned char shadow) {
+/* Glyph index in the font of a character or -1 if it is not
+   available. */
+static int
+glyph_from_ascii(unsigned char c) {
   static const int sprite_offset_from_ascii[] = {
     -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1,
@@ -368,53 +754,72 @@ frame_t::draw_char_sprite(int x, int y, unsigned char c, unsigned char color,
     -1, -1, -1, -1, -1, -1, -1, -1,
   };
 
-  int s = sprite_offset_from_ascii[c];
-  if (s < 0) return;
+  return sprite_offset_from_ascii[c];
+}
 
+/* Return the image of a laid out string, composing it from the glyph
+   atlases of the colours when it is not cached. */
+image_t *
+frame_t::get_string_image(const std::string &str, unsigned char color,
+                          int shadow) {
+  image_t *image = image_t::get_cached_string(str, color, shadow);
+  if (image != NULL) {
+    return image;
+  }
+
+  glyph_atlas_t *font = glyph_atlas_t::get_atlas(data_source, DATA_FONT_BASE,
+                                                 DATA_FONT_COUNT, color);
+  glyph_atlas_t *font_shadow = NULL;
+  unsigned int glyph_width = font->get_glyph_width();
+  unsigned int glyph_height = font->get_glyph_height();
   if (shadow) {
-    draw_transp_sprite(x, y, DATA_FONT_SHADOW_BASE + s, false, shadow);
+    font_shadow = glyph_atlas_t::get_atlas(data_source, DATA_FONT_SHADOW_BASE,
+                                           DATA_FONT_SHADOW_COUNT, shadow);
+    glyph_width = std::max(glyph_width, font_shadow->get_glyph_width());
+    glyph_height = std::max(glyph_height, font_shadow->get_glyph_height());
   }
-  draw_transp_sprite(x, y, DATA_FONT_BASE + s, false, color);
+
+  /* Characters are placed 8 pixels apart. */
+  unsigned int width = 8 * (str.length() - 1) + glyph_width;
+  unsigned int height = glyph_height;
+  uint32_t *pixels = new uint32_t[width * height]();
+
+  int x = 0;
+  for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+    int glyph = glyph_from_ascii(*it);
+    if (glyph >= 0) {
+      if (font_shadow != NULL) {
+        font_shadow->draw_glyph(glyph, pixels, width, x, 0);
+      }
+      font->draw_glyph(glyph, pixels, width, x, 0);
+    }
+    x += 8;
+  }
+
+  image = new image_t(video, pixels, width, height);
+  image_t::cache_string(str, color, shadow, image);
+  delete[] pixels;
+
+  return image;
 }
 
-/* Draw the string str at x, y in the dest frame. */
+/* Draw the string str at x, y in the dest frame. The laid out string
+   is drawn as a single image. */
 void
 frame_t::draw_string(int x, int y, unsigned char color, int shadow,
                      const std::string &str) {
-  for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
-/*
-    if (string_bg) {
-      fill_rect(x, y, 8, 8, 0);
-    }
-*/
-
-    draw_char_sprite(x, y, *it, color, shadow);
+  if (str.empty()) return;
 
-    x += 8;
-  }
+  image_t *image = get_string_image(str, color, shadow);
+  video->draw_image(image->get_video_image(), x, y, 0, video_frame);
 }
 
 /* Draw the number n at x, y in the dest frame. */
 void
 frame_t::draw_number(int x, int y, unsigned char color, int shadow, int n) {
-  if (n < 0) {
-    draw_char_sprite(x, y, '-', color, shadow);
-    x += 8;
-    n *= -1;
-  }
-
-  if (n == 0) {
-    draw_char_sprite(x, y, '0', color, shadow);
-    return;
-  }
-
-  int digits = 0;
-  for (int i = n; i > 0; i /= 10) digits += 1;
-
-  for (int i = digits-1; i >= 0; i--) {
-    draw_char_sprite(x+8*i, y, '0'+(n % 10), color, shadow);
-    n /= 10;
-  }
+  std::ostringstream str;
+  str << n;
+  draw_string(x, y, color, shadow, str.str());
 }
 
 /* Draw a rectangle with color at x, y in the dest frame. */
@@ -468,6 +873,13 @@ frame_t::draw_frame(int dx, int dy, int sx, int sy, frame_t *src,
   video->draw_frame(dx, dy, video_frame, sx, sy, src->video_frame, w, h);
 }
 
+void
+frame_t::draw_frame_scaled(int dx, int dy, int dw, int dh,
+                           int sx, int sy, frame_t *src, int sw, int sh) {
+  video->draw_frame_scaled(dx, dy, dw, dh, video_frame,
+                           sx, sy, sw, sh, src->video_frame);
+}
+
 frame_t *
 gfx_t::create_frame(unsigned int width, unsigned int height) {
   return new frame_t(video, width, height);
@@ -508,10 +920,18 @@ gfx_t::swap_buffers() {
 
 float
 gfx_t::get_zoom_factor() {
-  return video->get_zoom_factor();
+  return zoom_factor;
 }
 
+/* Zoom factors up to 1 scale the output of the video backend. Larger
+   factors keep the output at full size; the map view then draws the map
+   at a lower level of detail instead, see viewport_t::layout(). */
 bool
 gfx_t::set_zoom_factor(float factor) {
-  return video->set_zoom_factor(factor);
+  if (factor > GFX_MAX_ZOOM_FACTOR) return false;
+
+  if (!video->set_zoom_factor(std::min(factor, 1.f))) return false;
+
+  zoom_factor = factor;
+  return true;
 }
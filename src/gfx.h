@@ -23,7 +23,10 @@
 #define SRC_GFX_H_
 
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #ifdef HAVE_CONFIG_H
 # include <config.h>
@@ -63,8 +66,14 @@ class image_t {
   typedef std::map<uint64_t, image_t*> image_cache_t;
   static image_cache_t image_cache;
 
+  /* Laid out strings keyed by text and colour/shadow. */
+  typedef std::pair<std::string, unsigned int> string_key_t;
+  typedef std::map<string_key_t, image_t*> string_cache_t;
+  static string_cache_t string_cache;
+
  public:
   image_t(video_t *video, sprite_t *sprite);
+  image_t(video_t *video, void *data, unsigned int width, unsigned int height);
   virtual ~image_t();
 
   unsigned int get_width() const { return width; }
@@ -81,9 +90,46 @@ class image_t {
   static image_t *get_cached_image(uint64_t id);
   static void clear_cache();
 
+  static void cache_string(const std::string &str, unsigned char color,
+                           int shadow, image_t *image);
+  static image_t *get_cached_string(const std::string &str,
+                                    unsigned char color, int shadow);
+
   video_image_t *get_video_image() const { return video_image; }
 };
 
+/* Font glyphs of one colour decoded once and packed side by side into
+   a single pixel buffer. Strings are composed from the atlas. */
+class glyph_atlas_t {
+ protected:
+  unsigned int glyph_width;
+  unsigned int glyph_height;
+  unsigned int count;
+  uint32_t *pixels;
+
+  typedef std::map<unsigned int, glyph_atlas_t*> atlas_cache_t;
+  static atlas_cache_t atlas_cache;
+
+ public:
+  glyph_atlas_t(data_source_t *data_source, unsigned int base,
+                unsigned int count, unsigned char color);
+  virtual ~glyph_atlas_t();
+
+  unsigned int get_glyph_width() const { return glyph_width; }
+  unsigned int get_glyph_height() const { return glyph_height; }
+
+  /* Blend glyph over the pixel buffer dest at x, y. */
+  void draw_glyph(unsigned int glyph, uint32_t *dest, unsigned int pitch,
+                  int x, int y) const;
+
+  static glyph_atlas_t *get_atlas(data_source_t *data_source,
+                                  unsigned int base, unsigned int count,
+                                  unsigned char color);
+  static void cache_atlas(unsigned int base, unsigned char color,
+                          glyph_atlas_t *atlas);
+  static void clear_cache();
+};
+
 /* Frame. Keeps track of a specific rectangular area of a surface.
    Multiple frames can refer to the same surface. */
 class frame_t {
@@ -123,18 +169,88 @@ class frame_t {
 
   /* Frame functions */
   void draw_frame(int dx, int dy, int sx, int sy, frame_t *src, int w, int h);
+  void draw_frame_scaled(int dx, int dy, int dw, int dh,
+                         int sx, int sy, frame_t *src, int sw, int sh);
 
  protected:
-  void draw_char_sprite(int x, int y, unsigned char c, unsigned char color,
-                        unsigned char shadow);
+  image_t *get_string_image(const std::string &str, unsigned char color,
+                            int shadow);
   void draw_transp_sprite(int x, int y, unsigned int sprite, bool use_off,
                           unsigned char color_off, float progress);
 };
 
+class preload_progress_t {
+ public:
+  virtual ~preload_progress_t() {}
+
+  virtual void preload_progress(unsigned int done, unsigned int total) = 0;
+};
+
+/* Decodes sprites ahead of their first use so that drawing does not
+   stall on decoding. Sprites are decoded on worker threads into memory;
+   the images are then created on the calling thread, as the video
+   backend may only be used from there. */
+class sprite_preloader_t {
+ public:
+  typedef enum {
+    PRELOAD_SOLID,        /* frame_t::draw_sprite() */
+    PRELOAD_TRANSPARENT,  /* frame_t::draw_transp_sprite() */
+    PRELOAD_OVERLAY,      /* frame_t::draw_overlay_sprite() */
+    PRELOAD_MASKED,       /* frame_t::draw_masked_sprite() */
+    PRELOAD_WAVES,        /* frame_t::draw_waves_sprite() */
+    PRELOAD_FONT,         /* Glyph atlas of count sprites from sprite */
+  } type_t;
+
+ protected:
+  class batch_t;
+
+  typedef struct {
+    type_t type;
+    unsigned int sprite;
+    unsigned int mask;     /* Glyph count for PRELOAD_FONT */
+    unsigned char color;
+    sprite_t *result;
+    glyph_atlas_t *atlas;
+  } entry_t;
+
+  std::vector<entry_t> entries;
+  std::set<std::pair<type_t, uint64_t> > added;
+  video_t *video;
+  data_source_t *data_source;
+
+ public:
+  sprite_preloader_t();
+  virtual ~sprite_preloader_t();
+
+  void add(type_t type, unsigned int sprite, unsigned int mask = 0,
+           unsigned char color = 0);
+  void add_range(type_t type, unsigned int base, unsigned int count,
+                 unsigned char color = 0);
+
+  /* Add the sprite ranges of the game objects, serfs, map objects,
+     frames, icons and fonts. */
+  void add_defaults();
+
+  unsigned int get_count() const { return entries.size(); }
+
+  /* Decode all added sprites and put them in the image cache. Progress
+     is reported on the calling thread while decoding goes on. */
+  void run(preload_progress_t *progress);
+
+ protected:
+  void decode(entry_t *entry);
+  void store(entry_t *entry);
+};
+
+/* Largest zoom factor. Factors above 1 zoom out further than the video
+   output can, see gfx_t::set_zoom_factor(). */
+#define GFX_MAX_ZOOM_FACTOR  8.f
+
 class gfx_t {
  protected:
   static gfx_t *instance;
   video_t *video;
+  float zoom_factor;
 
   gfx_t() throw(Freeserf_Exception);
 
@@ -37,6 +37,37 @@ gui_object_t::layout() {
 }
 
 gui_object_t *gui_object_t::focused_object = NULL;
+bool gui_object_t::debug_redraw = false;
+gui_object_t::rect_list_t gui_object_t::debug_rects;
+gui_object_t::rect_list_t gui_object_t::debug_flashed;
+
+static bool
+rect_is_empty(const gui_rect_t &r) {
+  return (r.width <= 0 || r.height <= 0);
+}
+
+static gui_rect_t
+rect_union(const gui_rect_t &a, const gui_rect_t &b) {
+  if (rect_is_empty(a)) return b;
+  if (rect_is_empty(b)) return a;
+
+  int x0 = std::min(a.x, b.x);
+  int y0 = std::min(a.y, b.y);
+  int x1 = std::max(a.x + a.width, b.x + b.width);
+  int y1 = std::max(a.y + a.height, b.y + b.height);
+  gui_rect_t r = { x0, y0, x1 - x0, y1 - y0 };
+  return r;
+}
+
+static gui_rect_t
+rect_intersect(const gui_rect_t &a, const gui_rect_t &b) {
+  int x0 = std::max(a.x, b.x);
+  int y0 = std::max(a.y, b.y);
+  int x1 = std::min(a.x + a.width, b.x + b.width);
+  int y1 = std::min(a.y + a.height, b.y + b.height);
+  gui_rect_t r = { x0, y0, x1 - x0, y1 - y0 };
+  return r;
+}
 
 gui_object_t::gui_object_t() {
   x = 0;
@@ -49,6 +80,10 @@ gui_object_t::gui_object_t() {
   parent = NULL;
   frame = NULL;
   focused = false;
+  dirty.x = 0;
+  dirty.y = 0;
+  dirty.width = 0;
+  dirty.height = 0;
 }
 
 gui_object_t::~gui_object_t() {
@@ -63,27 +98,114 @@ gui_object_t::delete_frame() {
   }
 }
 
+/* Bring the cached frame up to date. The object itself is only drawn
+   when it was invalidated by set_redraw(); otherwise only the dirty part
+   is composed again from the floats, which keep their own caches. */
 void
-gui_object_t::draw(frame_t *frame) {
-  if (!displayed) {
+gui_object_t::update_frame() {
+  if (frame == NULL) {
+    frame = gfx_t::get_instance()->create_frame(width, height);
+    redraw = true;
+  }
+
+  if (redraw) {
+    internal_draw();
+    redraw = false;
+
+    gui_rect_t all = { 0, 0, width, height };
+    dirty = all;
+
+    if (debug_redraw) {
+      gui_rect_t r = all;
+      for (gui_object_t *obj = this; obj != NULL; obj = obj->parent) {
+        r.x += obj->x;
+        r.y += obj->y;
+      }
+      debug_rects.push_back(r);
+    }
+  }
+
+  if (rect_is_empty(dirty)) {
     return;
   }
 
-  if (this->frame == NULL) {
-    this->frame = gfx_t::get_instance()->create_frame(width, height);
+  gui_rect_t region = dirty;
+  float_list_t::iterator fl = floats.begin();
+  for ( ; fl != floats.end() ; ++fl) {
+    gui_object_t *obj = *fl;
+    if (!obj->displayed) continue;
+
+    gui_rect_t r = { obj->x, obj->y, obj->width, obj->height };
+    if (!rect_is_empty(rect_intersect(region, r))) {
+      obj->draw_clipped(frame, region);
+    }
   }
 
-  if (redraw) {
-    internal_draw();
+  /* Changes made while drawing were already picked up. */
+  dirty.width = 0;
+  dirty.height = 0;
+}
+
+/* Draw the part of the object inside clip (in coordinates of the
+   parent) to frame. */
+void
+gui_object_t::draw_clipped(frame_t *frame, const gui_rect_t &clip) {
+  update_frame();
+
+  gui_rect_t bounds = { x, y, width, height };
+  gui_rect_t r = rect_intersect(clip, bounds);
+  if (rect_is_empty(r)) {
+    return;
+  }
+
+  frame->draw_frame(r.x, r.y, r.x - x, r.y - y, this->frame,
+                    r.width, r.height);
+}
 
-    float_list_t::iterator fl = floats.begin();
-    for ( ; fl != floats.end() ; ++fl) {
-      (*fl)->draw(this->frame);
+/* Draw the changed parts of the object to frame. Returns true if
+   anything was drawn. */
+bool
+gui_object_t::draw(frame_t *frame) {
+  if (!displayed) {
+    return false;
+  }
+
+  gui_rect_t clip = dirty;
+  if (this->frame == NULL || redraw) {
+    gui_rect_t all = { 0, 0, width, height };
+    clip = all;
+  }
+
+  /* Restore the regions flashed on the previous draw. */
+  if (parent == NULL) {
+    rect_list_t::iterator it = debug_flashed.begin();
+    for ( ; it != debug_flashed.end() ; ++it) {
+      gui_rect_t r = { it->x - x, it->y - y, it->width, it->height };
+      clip = rect_union(clip, r);
     }
+    debug_flashed.clear();
+  }
 
-    redraw = false;
+  if (rect_is_empty(clip)) {
+    return false;
+  }
+
+  clip.x += x;
+  clip.y += y;
+  draw_clipped(frame, clip);
+
+  if (parent == NULL) {
+    if (debug_redraw) {
+      rect_list_t::iterator it = debug_rects.begin();
+      for ( ; it != debug_rects.end() ; ++it) {
+        frame->draw_rect(it->x, it->y, it->width, it->height, 76);
+      }
+      debug_flashed.swap(debug_rects);
+    }
+    debug_rects.clear();
   }
-  frame->draw_frame(x, y, 0, 0, this->frame, width, height);
+
+  return true;
 }
 
 bool
@@ -156,6 +278,7 @@ gui_object_t::move_to(int x, int y) {
   this->x = x;
   this->y = y;
   set_redraw();
+  set_parent_redraw();
 }
 
 void
@@ -175,6 +298,7 @@ gui_object_t::set_size(int width, int height) {
   this->height = height;
   layout();
   set_redraw();
+  set_parent_redraw();
 }
 
 void
@@ -190,7 +314,11 @@ gui_object_t::get_size(int *width, int *height) {
 void
 gui_object_t::set_displayed(bool displayed) {
   this->displayed = displayed;
-  set_redraw();
+  if (displayed) {
+    set_redraw();
+  } else {
+    set_parent_redraw();
+  }
 }
 
 void
@@ -198,9 +326,35 @@ gui_object_t::set_enabled(bool enabled) {
   this->enabled = enabled;
 }
 
+/* Invalidate the contents of the object. Only the area of the object
+   is recomposed in the parents, they are not drawn again. */
 void
 gui_object_t::set_redraw() {
   redraw = true;
+  add_dirty(0, 0, width, height);
+}
+
+/* Mark a region of the object as changed, and propagate it up the tree
+   as a dirty rectangle in each parent. */
+void
+gui_object_t::add_dirty(int x, int y, int width, int height) {
+  gui_rect_t r = { x, y, width, height };
+  gui_rect_t bounds = { 0, 0, this->width, this->height };
+  r = rect_intersect(r, bounds);
+  if (rect_is_empty(r)) {
+    return;
+  }
+
+  dirty = rect_union(dirty, r);
+
+  if (displayed && (parent != NULL)) {
+    parent->add_dirty(this->x + r.x, this->y + r.y, r.width, r.height);
+  }
+}
+
+/* Uncovering part of the parent requires it to be drawn again. */
+void
+gui_object_t::set_parent_redraw() {
   if (parent != NULL) {
     parent->set_redraw();
   }
@@ -27,11 +27,27 @@
 #include "src/gfx.h"
 #include "src/event_loop.h"
 
+/* Rectangle in the coordinate space of a GUI object. */
+typedef struct {
+  int x, y;
+  int width, height;
+} gui_rect_t;
+
 class gui_object_t : public event_handler_t {
  private:
   typedef std::list<gui_object_t*> float_list_t;
   float_list_t floats;
 
+  /* Part of the cached frame that has to be composed again from the
+     floats, and copied to the parent. */
+  gui_rect_t dirty;
+
+  /* Flash regions that are redrawn (debug). */
+  typedef std::list<gui_rect_t> rect_list_t;
+  static bool debug_redraw;
+  static rect_list_t debug_rects;
+  static rect_list_t debug_flashed;
+
  protected:
   int x, y;
   int width, height;
@@ -54,12 +70,16 @@ class gui_object_t : public event_handler_t {
   virtual bool handle_focus_loose() { return 0; }
 
   void delete_frame();
+  void update_frame();
+  void draw_clipped(frame_t *frame, const gui_rect_t &clip);
+  void add_dirty(int x, int y, int width, int height);
+  void set_parent_redraw();
 
  public:
   gui_object_t();
   virtual ~gui_object_t();
 
-  void draw(frame_t *frame);
+  bool draw(frame_t *frame);
   void move_to(int x, int y);
   void get_position(int *x, int *y);
   void set_size(int width, int height);
@@ -72,6 +92,9 @@ class gui_object_t : public event_handler_t {
   void set_parent(gui_object_t *parent) { this->parent = parent; }
   bool point_inside(int point_x, int point_y);
 
+  static void set_debug_redraw(bool enable) { debug_redraw = enable; }
+  static bool get_debug_redraw() { return debug_redraw; }
+
   void add_float(gui_object_t *obj, int x, int y);
   void del_float(gui_object_t *obj);
 
@@ -383,6 +383,9 @@ interface_t::set_game(game_t *game) {
   player = NULL;
 
   if (game != NULL) {
+    last_const_tick = game->get_const_tick();
+    autosave_timeout = AUTOSAVE_INTERVAL;
+
     viewport = new viewport_t(this, game->get_map());
     viewport->set_displayed(true);
     add_float(viewport, 0, 0);
@@ -721,6 +724,7 @@ interface_t::interface_t() {
   map_cursor_sprites[6].sprite = 33;
 
   last_const_tick = 0;
+  autosave_timeout = AUTOSAVE_INTERVAL;
 
   viewport = NULL;
   panel = NULL;
@@ -766,6 +770,14 @@ interface_t::update() {
     return_timeout -= tick_diff;
   }
 
+  /* Save the game regularly. Only the snapshot is taken here, the file
+     is written in the background. */
+  autosave_timeout -= tick_diff;
+  if (autosave_timeout <= 0) {
+    save_game(1, game);
+    autosave_timeout = AUTOSAVE_INTERVAL;
+  }
+
   const int msg_category[] = {
     -1, 5, 5, 5, 4, 0, 4, 3, 4, 5,
     5, 5, 4, 4, 4, 4, 0, 0, 0, 0
@@ -800,7 +812,9 @@ interface_t::update() {
   }
 
   viewport->update();
-  set_redraw();
+  if (panel != NULL) {
+    panel->update_notification();
+  }
 }
 
 bool
@@ -867,12 +881,20 @@ interface_t::handle_key_pressed(char key, int modifier) {
       viewport->switch_layer(VIEWPORT_LAYER_GRID);
       break;
     }
+    case 'r': {
+      gui_object_t::set_debug_redraw(!gui_object_t::get_debug_redraw());
+      break;
+    }
 
     /* Game control */
     case 'b': {
       viewport->switch_layer(VIEWPORT_LAYER_BUILDS);
       break;
     }
+    case 'l': {
+      viewport->switch_layer(VIEWPORT_LAYER_ROAD_LOAD);
+      break;
+    }
     case 'j': {
       unsigned int index = game->get_next_player(player)->get_index();
       set_player(index);
@@ -912,8 +934,7 @@ interface_t::handle_event(const event_t *event) {
       update();
       break;
     case EVENT_DRAW:
-      draw(reinterpret_cast<frame_t*>(event->object));
-      break;
+      return draw(reinterpret_cast<frame_t*>(event->object));
 
     default:
       return gui_object_t::handle_event(event);
@@ -105,6 +105,8 @@ class interface_t : public gui_object_t {
   int return_timeout;
   int return_pos;
 
+  int autosave_timeout;
+
  public:
   interface_t();
   virtual ~interface_t();
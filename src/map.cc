@@ -1805,33 +1805,42 @@ operator >> (save_reader_text_t &reader, map_t &map) {
   reader.value("pos")[1] >> y;
   map_pos_t pos = map.pos(x, y);
 
+  save_reader_text_value_t paths = reader.value("paths");
+  save_reader_text_value_t height = reader.value("height");
+  save_reader_text_value_t type_up = reader.value("type.up");
+  save_reader_text_value_t type_down = reader.value("type.down");
+  save_reader_text_value_t object = reader.value("object");
+  save_reader_text_value_t serf = reader.value("serf");
+  save_reader_text_value_t resource_type = reader.value("resource.type");
+  save_reader_text_value_t resource_amount = reader.value("resource.amount");
+
   for (int y = 0; y < SAVE_MAP_TILE_SIZE; y++) {
     for (int x = 0; x < SAVE_MAP_TILE_SIZE; x++) {
       map_pos_t p = map.pos_add(pos, map.pos(x, y));
       unsigned int val;
 
-      reader.value("paths")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      paths[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].paths = val & 0x3f;
 
-      reader.value("height")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      height[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].height = val & 0x1f;
 
-      reader.value("type.up")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      type_up[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].type = ((val & 0xf) << 4) | (map.tiles[p].type & 0xf);
 
-      reader.value("type.down")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      type_down[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].type = (map.tiles[p].type & 0xf0) | (val & 0xf);
 
-      reader.value("object")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      object[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].obj = val & 0x7f;
 
-      reader.value("serf")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      serf[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].serf = val;
 
-      reader.value("resource.type")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      resource_type[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].resource = ((val & 7) << 5) | (map.tiles[p].resource & 0x1f);
 
-      reader.value("resource.amount")[y*SAVE_MAP_TILE_SIZE+x] >> val;
+      resource_amount[y*SAVE_MAP_TILE_SIZE+x] >> val;
       map.tiles[p].resource = (map.tiles[p].resource & 0xe0) | (val & 0x1f);
     }
   }
@@ -1850,23 +1859,34 @@ operator << (save_writer_text_t &writer, map_t &map) {
       map_writer.value("pos") << tx;
       map_writer.value("pos") << ty;
 
+      save_writer_text_value_t &height = map_writer.value("height");
+      save_writer_text_value_t &type_up = map_writer.value("type.up");
+      save_writer_text_value_t &type_down = map_writer.value("type.down");
+      save_writer_text_value_t &paths = map_writer.value("paths");
+      save_writer_text_value_t &object = map_writer.value("object");
+      save_writer_text_value_t &serf = map_writer.value("serf");
+      save_writer_text_value_t &resource_type =
+                                              map_writer.value("resource.type");
+      save_writer_text_value_t &resource_amount =
+                                            map_writer.value("resource.amount");
+
       for (int y = 0; y < SAVE_MAP_TILE_SIZE; y++) {
         for (int x = 0; x < SAVE_MAP_TILE_SIZE; x++) {
           map_pos_t pos = map.pos(tx+x, ty+y);
 
-          map_writer.value("height") << map.get_height(pos);
-          map_writer.value("type.up") << map.type_up(pos);
-          map_writer.value("type.down") << map.type_down(pos);
-          map_writer.value("paths") << map.paths(pos);
-          map_writer.value("object") << map.get_obj(pos);
-          map_writer.value("serf") << map.get_serf_index(pos);
+          height << map.get_height(pos);
+          type_up << map.type_up(pos);
+          type_down << map.type_down(pos);
+          paths << map.paths(pos);
+          object << map.get_obj(pos);
+          serf << map.get_serf_index(pos);
 
           if (map.is_in_water(pos)) {
-            map_writer.value("resource.type") << 0;
-            map_writer.value("resource.amount") << map.get_res_fish(pos);
+            resource_type << 0;
+            resource_amount << map.get_res_fish(pos);
           } else {
-            map_writer.value("resource.type") << map.get_res_type(pos);
-            map_writer.value("resource.amount") << map.get_res_amount(pos);
+            resource_type << map.get_res_type(pos);
+            resource_amount << map.get_res_amount(pos);
           }
         }
       }
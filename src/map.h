@@ -381,6 +381,7 @@ class map_t {
 
   unsigned int get_gold_deposit() const { return gold_deposit; }
   void add_gold_deposit(int delta) { gold_deposit += delta; }
+  void init_ground_gold_deposit();
 
   void init(unsigned int size);
   void init_dimensions();
@@ -413,6 +414,11 @@ class map_t {
  public:
   uint16_t random_int();
 
+  /* State of the random generator used for map updates. Saved with the
+     game so that two copies of a loaded game stay the same. */
+  const random_state_t &get_random_state() const { return rnd; }
+  void set_random_state(const random_state_t &state) { rnd = state; }
+
  protected:
   void init_minimap();
 
@@ -470,7 +476,6 @@ class map_t {
   void init_resources();
   void init_clean_up();
   void init_sub();
-  void init_ground_gold_deposit();
   void init_spiral_pos_pattern();
 
   void update_public(map_pos_t pos);
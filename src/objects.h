@@ -25,6 +25,7 @@
 #include <map>
 #include <algorithm>
 #include <set>
+#include <vector>
 #include <climits>
 
 class game_t;
@@ -103,7 +104,7 @@ class collection_t {
 
     if (last_object_index <= index) {
       for (unsigned int i = last_object_index; i < index; i++) {
-        free_object_indexes.insert(index);
+        free_object_indexes.insert(i);
       }
       last_object_index = index + 1;
     }
@@ -113,10 +114,11 @@ class collection_t {
 
   object_t*
   operator[] (unsigned int index) {
-    if (!exists(index)) {
+    typename objects_t::iterator i = objects.find(index);
+    if (i == objects.end()) {
       return NULL;
     }
-    return objects[index];
+    return i->second;
   }
 
   class iterator {
@@ -160,6 +162,12 @@ class collection_t {
     return iterator(objects.end());
   }
 
+  /* First object with an index not less than index. */
+  iterator
+  lower_bound(unsigned int index) {
+    return iterator(objects.lower_bound(index));
+  }
+
   void
   erase(unsigned int index) {
     /* Decrement max_flag_index as much as possible. */
@@ -183,4 +191,209 @@ class collection_t {
   size() { return objects.size(); }
 };
 
+/* Set of object indexes that need attention, kept as a bitmap. Walking
+   the set with next() visits indexes in ascending order and also sees
+   indexes inserted ahead of the current one during the walk. */
+class active_set_t {
+ protected:
+  typedef unsigned int word_t;
+  static const unsigned int word_bits = sizeof(word_t) * CHAR_BIT;
+
+  std::vector<word_t> words;
+
+ public:
+  void
+  insert(unsigned int index) {
+    size_t word = index / word_bits;
+    if (word >= words.size()) {
+      words.resize(word + 1, 0);
+    }
+    words[word] |= 1u << (index % word_bits);
+  }
+
+  void
+  erase(unsigned int index) {
+    size_t word = index / word_bits;
+    if (word < words.size()) {
+      words[word] &= ~(1u << (index % word_bits));
+    }
+  }
+
+  bool
+  contains(unsigned int index) const {
+    size_t word = index / word_bits;
+    if (word >= words.size()) {
+      return false;
+    }
+    return ((words[word] >> (index % word_bits)) & 1) != 0;
+  }
+
+  /* Move index to the first member at or after it. Returns false if
+     there is none. */
+  bool
+  next(unsigned int *index) const {
+    size_t word = *index / word_bits;
+    if (word >= words.size()) {
+      return false;
+    }
+
+    word_t bits = words[word] & (~0u << (*index % word_bits));
+    while (bits == 0) {
+      if (++word >= words.size()) {
+        return false;
+      }
+      bits = words[word];
+    }
+
+    unsigned int bit = 0;
+    while (((bits >> bit) & 1) == 0) {
+      bit++;
+    }
+    *index = static_cast<unsigned int>(word * word_bits + bit);
+    return true;
+  }
+
+  void
+  clear() { words.clear(); }
+};
+
+/* Hierarchical timing wheel of object indexes keyed by game tick.
+   Level 0 has a slot for each tick, a slot on the next level covers a
+   whole turn of the level below. Timers move down a level when the
+   wheel reaches their slot and expire into an active_set_t on their
+   tick. A timer can be replaced or cancelled at any time, the stale
+   entry is dropped when its slot is reached. */
+class timer_wheel_t {
+ protected:
+  static const unsigned int slot_bits = 6;
+  static const unsigned int slot_count = 1 << slot_bits;
+  static const unsigned int level_count = 4;
+
+  typedef struct {
+    unsigned int index;
+    unsigned int tick;
+  } entry_t;
+  typedef std::vector<entry_t> slot_t;
+
+  slot_t slots[level_count][slot_count];
+  std::vector<unsigned int> ticks;
+  active_set_t scheduled;
+  unsigned int count;
+  unsigned int now;
+
+ public:
+  timer_wheel_t() : count(0), now(0) {}
+
+  /* Expire index on tick, or on the next tick if tick has already been
+     reached. An earlier timer for the same index is replaced. */
+  void
+  schedule(unsigned int index, unsigned int tick) {
+    if (static_cast<int>(tick - now) <= 0) {
+      tick = now + 1;
+    }
+    if (index >= ticks.size()) {
+      ticks.resize(index + 1, 0);
+    }
+    if (!scheduled.contains(index)) {
+      scheduled.insert(index);
+      count++;
+    }
+    ticks[index] = tick;
+
+    entry_t entry = { index, tick };
+    add(entry);
+  }
+
+  void
+  cancel(unsigned int index) {
+    if (scheduled.contains(index)) {
+      scheduled.erase(index);
+      count--;
+    }
+  }
+
+  bool
+  is_scheduled(unsigned int index) const {
+    return scheduled.contains(index);
+  }
+
+  unsigned int
+  get_tick(unsigned int index) const {
+    return is_scheduled(index) ? ticks[index] : 0;
+  }
+
+  /* Move the wheel forward to tick and insert the indexes of all timers
+     that expire on the way into expired. */
+  void
+  advance(unsigned int tick, active_set_t *expired) {
+    if (count == 0) {
+      now = tick;
+      return;
+    }
+
+    while (now != tick) {
+      now++;
+
+      /* Cascade from the top so that timers moving down more than one
+         level still reach the slots handled below. */
+      for (unsigned int level = level_count - 1; level > 0; level--) {
+        unsigned int shift = slot_bits * level;
+        if ((now & ((1u << shift) - 1)) != 0) continue;
+
+        slot_t entries;
+        entries.swap(slots[level][(now >> shift) & (slot_count - 1)]);
+        for (slot_t::iterator it = entries.begin(); it != entries.end();
+             ++it) {
+          if (is_current(*it)) add(*it);
+        }
+      }
+
+      slot_t entries;
+      entries.swap(slots[0][now & (slot_count - 1)]);
+      for (slot_t::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (!is_current(*it)) continue;
+        if (it->tick == now) {
+          cancel(it->index);
+          expired->insert(it->index);
+        } else {
+          add(*it);
+        }
+      }
+    }
+  }
+
+  void
+  clear() {
+    for (unsigned int level = 0; level < level_count; level++) {
+      for (unsigned int slot = 0; slot < slot_count; slot++) {
+        slots[level][slot].clear();
+      }
+    }
+    ticks.clear();
+    scheduled.clear();
+    count = 0;
+    now = 0;
+  }
+
+ protected:
+  bool
+  is_current(const entry_t &entry) const {
+    return scheduled.contains(entry.index) && ticks[entry.index] == entry.tick;
+  }
+
+  /* Put the entry on the lowest level where its tick falls into the
+     current turn. Ticks too far ahead wait on the top level. */
+  void
+  add(const entry_t &entry) {
+    unsigned int level = 0;
+    while (level < level_count - 1 &&
+           (entry.tick >> (slot_bits * (level + 1))) !=
+           (now >> (slot_bits * (level + 1)))) {
+      level++;
+    }
+    unsigned int slot = (entry.tick >> (slot_bits * level)) & (slot_count - 1);
+    slots[level][slot].push_back(entry);
+  }
+};
+
 #endif  // SRC_OBJECTS_H_
@@ -372,6 +372,9 @@ panel_bar_t::panel_bar_t(interface_t *interface) {
   panel_btns[2] = PANEL_BTN_MAP;
   panel_btns[3] = PANEL_BTN_STATS;
   panel_btns[4] = PANEL_BTN_SETT;
+
+  show_message = false;
+  show_return_arrow = false;
 }
 
 panel_bar_t::panel_btn_t
@@ -501,3 +504,21 @@ panel_bar_t::update() {
   }
   set_redraw();
 }
+
+/* Called periodically. Only redraw the panel when the blinking message
+   icon or the return arrow changes. */
+void
+panel_bar_t::update_notification() {
+  bool message = false;
+  player_t *player = interface->get_player();
+  if ((player != NULL) && player->has_notification()) {
+    message = ((player->get_game()->get_const_tick() & 0x30) != 0);
+  }
+  bool return_arrow = interface->get_msg_flag(3);
+
+  if ((message != show_message) || (return_arrow != show_return_arrow)) {
+    show_message = message;
+    show_return_arrow = return_arrow;
+    set_redraw();
+  }
+}
@@ -58,11 +58,14 @@ class panel_bar_t : public gui_object_t {
 
   interface_t *interface;
   int panel_btns[5];
+  bool show_message;
+  bool show_return_arrow;
 
  public:
   explicit panel_bar_t(interface_t *interface);
 
   void update();
+  void update_notification();
 
  protected:
   void draw_panel_frame();
@@ -31,6 +31,53 @@
 
 player_t::player_t(game_t *game, unsigned int index)
   : game_object_t(game, index) {
+  priority_serial = 0;
+
+  /* Values that are not part of saved games must not depend on the
+     memory the player happens to be allocated in, or two copies of a
+     loaded game would not play out the same. */
+  flags = 0;
+  building = 0;
+  castle_inventory = 0;
+  cont_search_after_non_optimal_find = 7;
+  total_land_area = 0;
+  analysis_goldore = 0;
+  analysis_ironore = 0;
+  analysis_coal = 0;
+  analysis_stone = 0;
+  send_generic_delay = 0;
+  serf_index = 0;
+  knight_cycle_counter = 0;
+  send_knight_delay = 0;
+  military_max_gold = 0;
+  knight_morale = 0;
+  gold_deposited = 0;
+  ai_value_0 = 0;
+  ai_value_1 = 0;
+  ai_value_2 = 0;
+  ai_value_3 = 0;
+  ai_value_4 = 0;
+  ai_value_5 = 0;
+  ai_intelligence = 0;
+  temp_index = 0;
+
+  for (int i = 0; i < 16; i++) {
+    for (int j = 0; j < 112; j++) {
+      player_stat_history[i][j] = 0;
+    }
+  }
+
+  for (int i = 0; i < 26; i++) {
+    for (int j = 0; j < 120; j++) {
+      resource_count_history[i][j] = 0;
+    }
+  }
+
+  /* Saves of the original game have no count for the last type. */
+  for (int i = 0; i < 24; i++) {
+    completed_building_count[i] = 0;
+    incomplete_building_count[i] = 0;
+  }
 }
 
 void
@@ -195,6 +242,7 @@ player_t::reset_food_priority() {
   food_coalmine = 45850;
   food_ironmine = 45850;
   food_goldmine = 65500;
+  priority_serial++;
 }
 
 /* Set defaults for planks distribution priorities. */
@@ -203,6 +251,7 @@ player_t::reset_planks_priority() {
   planks_construction = 65500;
   planks_boatbuilder = 3275;
   planks_toolmaker = 19650;
+  priority_serial++;
 }
 
 /* Set defaults for steel distribution priorities. */
@@ -210,6 +259,7 @@ void
 player_t::reset_steel_priority() {
   steel_toolmaker = 45850;
   steel_weaponsmith = 65500;
+  priority_serial++;
 }
 
 /* Set defaults for coal distribution priorities. */
@@ -218,6 +268,7 @@ player_t::reset_coal_priority() {
   coal_steelsmelter = 32750;
   coal_goldsmelter = 65500;
   coal_weaponsmith = 52400;
+  priority_serial++;
 }
 
 /* Set defaults for coal distribution priorities. */
@@ -225,6 +276,7 @@ void
 player_t::reset_wheat_priority() {
   wheat_pigfarm = 65500;
   wheat_mill = 32750;
+  priority_serial++;
 }
 
 /* Set defaults for tool production priorities. */
@@ -380,12 +432,12 @@ player_t::available_knights_at_pos(map_pos_t pos, int index_, int dist) {
   case BUILDING_HUT: min_level = min_level_hut; break;
   case BUILDING_TOWER: min_level = min_level_tower; break;
   case BUILDING_FORTRESS: min_level = min_level_fortress; break;
-  default: return index; break;
+  default: return index_; break;
   }
 
-  if (index >= 64) return index_;
+  if (index_ >= 64) return index_;
 
-  attacking_buildings[index] = bld_index;
+  attacking_buildings[index_] = bld_index;
 
   int state = building->get_state();
   int knights_present = building->get_knight_count();
@@ -1164,6 +1216,7 @@ operator >> (save_reader_binary_t &reader, player_t &player)  {
   player.wheat_pigfarm = v16;
   reader >> v16;  // 474
   player.wheat_mill = v16;
+  player.priority_serial++;
 
   reader >> v16;  // 476
 //  player.current_sett_6_item = v16;
@@ -1196,7 +1249,7 @@ operator >> (save_reader_text_t &reader, player_t &player) {
     reader.value("knight_occupation")[i] >> player.knight_occupation[i];
     reader.value("attacking_knights")[i] >> player.attacking_knights[i];
   }
-  for (int i = 0; i < 23; i++) {
+  for (int i = 0; i < BUILDING_GOLDSMELTER + 1; i++) {
     reader.value("completed_building_count")[i] >>
       player.completed_building_count[i];
     reader.value("incomplete_building_count")[i] >>
@@ -1232,6 +1285,7 @@ operator >> (save_reader_text_t &reader, player_t &player) {
   reader.value("coal_weaponsmith") >> player.coal_weaponsmith;
   reader.value("wheat_pigfarm") >> player.wheat_pigfarm;
   reader.value("wheat_mill") >> player.wheat_mill;
+  player.priority_serial++;
   reader.value("castle_score") >> player.castle_score;
   reader.value("castle_knights") >> player.castle_knights;
   reader.value("castle_knights_wanted") >> player.castle_knights_wanted;
@@ -1263,7 +1317,7 @@ operator << (save_writer_text_t &writer, player_t &player) {
     writer.value("attacking_knights") << player.attacking_knights[i];
   }
 
-  for (int i = 0; i < 23; i++) {
+  for (int i = 0; i < BUILDING_GOLDSMELTER + 1; i++) {
     writer.value("completed_building_count") <<
       player.completed_building_count[i];
     writer.value("incomplete_building_count") <<
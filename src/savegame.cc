@@ -21,6 +21,8 @@
 
 #include "src/savegame.h"
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <vector>
 #include <map>
@@ -29,6 +31,34 @@
 #include "src/game.h"
 #include "src/log.h"
 #include "src/debug.h"
+#include "src/tpwm.h"
+#include "src/data-cache.h"
+#include "src/freeserf_endian.h"
+
+#define SAVE_BINARY_MAGIC       "FSBS"
+#define SAVE_BINARY_VERSION     1
+
+/* Flags of the binary save header. */
+#define SAVE_BINARY_COMPRESSED  1
+
+/* The binary save starts with this header, followed by the (possibly
+   TPWM packed) payload of size bytes. The payload is a sequence of
+   sections, each holding its name, number and values:
+
+     u8 name length, name, u32 number, u32 value count,
+     then for each value:
+       u8 key length, key, u8 type, u32 count, data
+
+   where data is count numbers of the width given by the type, or a
+   string of count bytes. The checksum is over the unpacked payload.
+   All values are little endian. */
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t size;
+  uint64_t checksum;
+} save_binary_header_t;
 
 /* Load a save game. */
 bool
@@ -59,89 +89,178 @@ load_v0_state(FILE *f) {
 }
 
 
+/* Append the decimal representation of val. */
+static void
+append_number(std::string *text, uint64_t val, bool negative = false) {
+  char buffer[24];
+  char *pos = buffer + sizeof(buffer);
+  do {
+    *--pos = static_cast<char>('0' + val % 10);
+    val /= 10;
+  } while (val != 0);
+  if (negative) *--pos = '-';
+  text->append(pos, buffer + sizeof(buffer) - pos);
+}
+
+static void
+append_number(std::string *text, int64_t val) {
+  if (val < 0) {
+    append_number(text, static_cast<uint64_t>(0) - static_cast<uint64_t>(val),
+                  true);
+  } else {
+    append_number(text, static_cast<uint64_t>(val));
+  }
+}
+
+/* Buffered output of a text save. */
+class save_text_output_t {
+ protected:
+  FILE *file;
+  std::string buffer;
+  bool failed;
+
+ public:
+  explicit save_text_output_t(FILE *file) : file(file), failed(false) {
+    buffer.reserve(1024 * 1024);
+  }
+
+  void write(const std::string &text) {
+    buffer += text;
+    if (buffer.length() >= 1024 * 1024) flush();
+  }
+
+  bool flush() {
+    if (!buffer.empty() &&
+        fwrite(buffer.data(), buffer.length(), 1, file) != 1) {
+      failed = true;
+    }
+    buffer.clear();
+    return !failed;
+  }
+};
+
+/* Section of a text save. The values of a section are written, sorted
+   by key, when its first subsection is added or the section is
+   finished; a section is finished when its parent adds the next one.
+   Only the sections currently being filled are kept in memory, so all
+   values of a section must be added before its subsections. */
 class save_writer_text_section_t : public save_writer_text_t {
  protected:
   typedef std::map<std::string, save_writer_text_value_t> values_t;
-  typedef std::vector<save_writer_text_section_t*> sections_t;
 
  protected:
   std::string name;
   unsigned int number;
   values_t values;
-  sections_t sections;
+  save_writer_text_section_t *child;
+  save_text_output_t *output;
+  bool written;
 
  public:
-  save_writer_text_section_t(std::string name, unsigned int number) {
-    this->name = name;
-    this->number = number;
+  save_writer_text_section_t(const std::string &name, unsigned int number,
+                             save_text_output_t *output)
+    : name(name), number(number), child(NULL), output(output),
+      written(false) {}
+  virtual ~save_writer_text_section_t() {
+    delete child;
   }
 
   virtual save_writer_text_value_t &value(const std::string &name) {
-    values_t::iterator i = values.find(name);
-    if (i != values.end()) {
-      return i->second;
+    if (written) {
+      throw Freeserf_Exception("Value \"" + name +
+                               "\" added after the section was written");
     }
-
-    values[name] = save_writer_text_value_t();
-    i = values.find(name);
-    return i->second;
+    return values[name];
   }
 
-  bool save(FILE *file) {
-    fprintf(file, "[%s %i]\n", name.c_str(), number);
+  virtual save_writer_text_t &add_section(const std::string &name,
+                                          unsigned int number) {
+    write_values();
+    finish_child();
+    child = new save_writer_text_section_t(name, number, output);
+    return *child;
+  }
 
-    for (values_t::iterator i = values.begin(); i != values.end(); ++i) {
-      fprintf(file, "%s=%s\n", i->first.c_str(), i->second.get_value().c_str());
-    }
+  void finish() {
+    write_values();
+    finish_child();
+  }
 
-    fprintf(file, "\n");
+ protected:
+  void write_values() {
+    if (written) return;
+    written = true;
 
-    for (sections_t::iterator i = sections.begin(); i != sections.end(); ++i) {
-      (*i)->save(file);
+    std::string text = "[" + name + " ";
+    append_number(&text, static_cast<int64_t>(static_cast<int>(number)));
+    text += "]\n";
+    for (values_t::iterator i = values.begin(); i != values.end(); ++i) {
+      text += i->first;
+      text += "=";
+      text += i->second.get_value();
+      text += "\n";
     }
+    text += "\n";
+    output->write(text);
 
-    return true;
+    values.clear();
   }
 
-  save_writer_text_t &add_section(const std::string &name,
-                                  unsigned int number) {
-    save_writer_text_section_t *new_section =
-                                   new save_writer_text_section_t(name, number);
-
-    sections.push_back(new_section);
-
-    return *new_section;
+  void finish_child() {
+    if (child != NULL) {
+      child->finish();
+      delete child;
+      child = NULL;
+    }
   }
 };
 
 bool
 save_text_state(FILE *f, game_t *game) {
-  save_writer_text_section_t writer("game", 0);
-
-  writer << *game;
+  save_text_output_t output(f);
+  try {
+    save_writer_text_section_t writer("game", 0, &output);
+    writer << *game;
+    writer.finish();
+  } catch (Freeserf_Exception &e) {
+    LOGE("savegame", "Unable to save game: %s", e.get_description().c_str());
+    return false;
+  }
 
-  return writer.save(f);
+  return output.flush();
 }
 
 class save_reader_text_section_t : public save_reader_text_t {
  protected:
-  typedef std::map<std::string, std::string> values_t;
+  /* Key and value refer to the buffer of the file, the items of the
+     value to the item table of the file. */
+  typedef struct {
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+    size_t first_item;
+    size_t item_count;
+  } entry_t;
+  typedef std::vector<entry_t> entries_t;
+
   std::string name;
-  int number;
-  values_t values;
-  readers_t readers_stub;
+  unsigned int number;
+  entries_t values;
+  const std::vector<const char*> *items;
 
  public:
-  explicit save_reader_text_section_t(const std::string &header) {
-    name = header.substr(1, header.length() - 2);
-    size_t pos = name.find(' ');
+  save_reader_text_section_t(const char *header, size_t length,
+                             const std::vector<const char*> *items)
+    : number(0), items(items) {
+    /* Header is "[name number]". */
+    std::string title(header + 1, (length >= 2) ? length - 2 : 0);
+    size_t pos = title.find(' ');
     if (pos != std::string::npos) {
-      std::string value = name.substr(pos + 1, name.length() - pos - 1);
-      name = name.substr(0, pos);
-      std::stringstream ss;
-      ss << value;
-      ss >> number;
+      number = atoi(title.c_str() + pos + 1);
+      title = title.substr(0, pos);
     }
+    name = title;
   }
 
   virtual std::string get_name() const {
@@ -154,60 +273,133 @@ class save_reader_text_section_t : public save_reader_text_t {
 
   virtual save_reader_text_value_t
   value(const std::string &name) const throw(Freeserf_Exception) {
-    values_t::const_iterator it = values.find(name);
-    if (it == values.end()) {
+    /* Values are sorted by key. With duplicate keys the last one is
+       used. */
+    entries_t::const_iterator it = std::upper_bound(values.begin(),
+                                                    values.end(), name,
+                                                    key_less);
+    if (it == values.begin() ||
+        compare_key(*(it - 1), name.c_str(), name.length()) != 0) {
       throw Freeserf_Exception("failed to load value");
     }
+    --it;
 
-    return save_reader_text_value_t(it->second);
+    return save_reader_text_value_t(it->value, it->value_length,
+                                    &(*items)[it->first_item], it->item_count);
   }
 
   virtual readers_t get_sections(const std::string &name) {
     throw Freeserf_Exception("Recursive sections are not allowed");
-    return readers_stub;
   }
 
-  void add_value(std::string line) {
-    size_t pos = line.find('=');
-    if (pos == std::string::npos) {
+  void add_value(const char *line, size_t length, size_t first_item,
+                 size_t item_count) {
+    const char *sep = reinterpret_cast<const char*>(memchr(line, '=', length));
+    if (sep == NULL) {
       throw Freeserf_Exception("Wrong save file format");
     }
-    std::string name = line.substr(0, pos);
-    std::string value = line.substr(pos + 1, line.length() - pos - 1);
-    values[name] = value;
+    entry_t entry;
+    entry.key = line;
+    entry.key_length = sep - line;
+    entry.value = sep + 1;
+    entry.value_length = length - entry.key_length - 1;
+    entry.first_item = first_item;
+    entry.item_count = item_count;
+    values.push_back(entry);
+  }
+
+  /* Called when all values are added. The writer already emits keys in
+     order, so sorting is usually skipped. */
+  void finish() {
+    for (size_t i = 1; i < values.size(); i++) {
+      if (entry_less(values[i], values[i-1])) {
+        std::stable_sort(values.begin(), values.end(), entry_less);
+        break;
+      }
+    }
+  }
+
+ protected:
+  static int compare_key(const entry_t &entry, const char *key,
+                         size_t length) {
+    int r = memcmp(entry.key, key, std::min(entry.key_length, length));
+    if (r != 0) return r;
+    if (entry.key_length == length) return 0;
+    return (entry.key_length < length) ? -1 : 1;
   }
-};
 
-typedef std::list<save_reader_text_section_t*> reader_sections_t;
+  static bool key_less(const std::string &key, const entry_t &entry) {
+    return compare_key(entry, key.c_str(), key.length()) > 0;
+  }
 
+  static bool entry_less(const entry_t &a, const entry_t &b) {
+    return compare_key(a, b.key, b.key_length) < 0;
+  }
+};
+
+/* Text save parsed in a single pass over the file contents. Values are
+   not copied but refer to the buffer, which must stay alive and be
+   terminated by a null character. The start of every comma separated
+   item is recorded while parsing, so list elements are found directly. */
 class save_reader_text_file_t : public save_reader_text_t {
  protected:
-  reader_sections_t sections;
+  typedef std::map<std::string, readers_t> index_t;
+
+  std::list<save_reader_text_section_t*> sections;
+  index_t index;
+  std::vector<const char*> items;
 
  public:
-  explicit save_reader_text_file_t(std::istream *file) {
+  save_reader_text_file_t(const char *data, size_t size) {
+    const char *pos = data;
+    const char *end = data + size;
+
     save_reader_text_section_t *section =
-                                       new save_reader_text_section_t("[main]");
+                              new save_reader_text_section_t("[main]", 6,
+                                                             &items);
     sections.push_back(section);
-    while (!file->eof()) {
-      char c = file->peek();
-      while (c == ' ' || c == '\t' || c == '\n') {
-        file->get(c);
-        c = file->peek();
+    while (pos < end) {
+      while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' ||
+                           *pos == '\r')) {
+        pos++;
       }
-
-      std::string line;
-      getline(*file, line);
-
-      if (c == '[') {
-        section = new save_reader_text_section_t(line);
+      if (pos >= end) break;
+
+      const char *line = pos;
+      const char *line_end = reinterpret_cast<const char*>(
+                                             memchr(pos, '\n', end - pos));
+      if (line_end == NULL) line_end = end;
+      pos = line_end + 1;
+      if (line_end > line && line_end[-1] == '\r') line_end--;
+
+      if (*line == '[') {
+        section->finish();
+        section = new save_reader_text_section_t(line, line_end - line,
+                                                 &items);
         sections.push_back(section);
+        index[section->get_name()].push_back(section);
       } else {
-        if (line.length() != 0) {
-          section->add_value(line);
+        const char *sep = reinterpret_cast<const char*>(
+                                           memchr(line, '=', line_end - line));
+        size_t first_item = items.size();
+        if (sep != NULL) {
+          items.push_back(sep + 1);
+          for (const char *c = sep + 1; c < line_end; c++) {
+            if (*c == ',') items.push_back(c + 1);
+          }
         }
+        section->add_value(line, line_end - line, first_item,
+                           items.size() - first_item);
       }
     }
+    section->finish();
+  }
+
+  virtual ~save_reader_text_file_t() {
+    while (!sections.empty()) {
+      delete sections.front();
+      sections.pop_front();
+    }
   }
 
   virtual std::string get_name() const {
@@ -220,55 +412,559 @@ class save_reader_text_file_t : public save_reader_text_t {
 
   virtual save_reader_text_value_t
   value(const std::string &name) const throw(Freeserf_Exception) {
-    reader_sections_t result;
+    return sections.front()->value(name);
+  }
+
+  virtual readers_t get_sections(const std::string &name) {
+    index_t::const_iterator it = index.find(name);
+    if (it == index.end()) {
+      return readers_t();
+    }
+    return it->second;
+  }
+};
+
+static void
+put_u8(std::vector<uint8_t> *output, unsigned int val) {
+  output->push_back(static_cast<uint8_t>(val));
+}
 
-    reader_sections_t::const_iterator it = sections.begin();
-    for (; it != sections.end(); ++it) {
-      if ((*it)->get_name() == "main") {
-        return (*it)->value(name);
+static void
+put_u32(std::vector<uint8_t> *output, uint32_t val) {
+  for (int i = 0; i < 4; i++) {
+    output->push_back(static_cast<uint8_t>(val >> (8*i)));
+  }
+}
+
+static void
+put_name(std::vector<uint8_t> *output, const std::string &name) {
+  if (name.length() > 0xff) {
+    throw Freeserf_Exception("Name \"" + name + "\" is too long");
+  }
+  put_u8(output, static_cast<unsigned int>(name.length()));
+  output->insert(output->end(), name.begin(), name.end());
+}
+
+static uint32_t
+get_u32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+/* Value of a binary save section. Numbers are collected as they are
+   added and written as one block; a value that also holds strings is
+   kept as text. */
+class save_writer_binary_value_t : public save_writer_text_value_t {
+ protected:
+  std::vector<int64_t> numbers;
+  bool is_text;
+
+ public:
+  save_writer_binary_value_t() : is_text(false) {}
+
+  virtual save_writer_text_value_t& operator << (int val) {
+    return add(val);
+  }
+  virtual save_writer_text_value_t& operator << (unsigned int val) {
+    return add(val);
+  }
+#if defined(_M_AMD64) || defined(__x86_64__)
+  virtual save_writer_text_value_t& operator << (size_t val) {
+    return add(val);
+  }
+#endif  // defined(_M_AMD64) || defined(__x86_64__)
+  virtual save_writer_text_value_t& operator << (dir_t val) {
+    return add(val);
+  }
+  virtual save_writer_text_value_t& operator << (resource_type_t val) {
+    return add(val);
+  }
+  virtual save_writer_text_value_t& operator << (const std::string &val) {
+    if (!is_text) {
+      is_text = true;
+      for (size_t i = 0; i < numbers.size(); i++) {
+        if (!value.empty()) value += ",";
+        append_number(&value, numbers[i]);
       }
+      numbers.clear();
     }
+    return save_writer_text_value_t::operator << (val);
+  }
 
-    throw Freeserf_Exception("Value \"" + name + "\" not found");
+  void write(std::vector<uint8_t> *output) const {
+    if (is_text) {
+      put_u8(output, SAVE_BINARY_STRING);
+      put_u32(output, static_cast<uint32_t>(value.length()));
+      output->insert(output->end(), value.begin(), value.end());
+      return;
+    }
 
-    return save_reader_text_value_t("");
+    int64_t min = 0;
+    int64_t max = 0;
+    for (size_t i = 0; i < numbers.size(); i++) {
+      min = std::min(min, numbers[i]);
+      max = std::max(max, numbers[i]);
+    }
+
+    unsigned int width = 8;
+    unsigned int type = 0;
+    if (min >= 0) {
+      if (max <= 0xff) {
+        width = 1;
+      } else if (max <= 0xffff) {
+        width = 2;
+      } else if (max <= 0xffffffffll) {
+        width = 4;
+      }
+    } else {
+      type = SAVE_BINARY_SIGNED;
+      if (min >= -0x80 && max <= 0x7f) {
+        width = 1;
+      } else if (min >= -0x8000 && max <= 0x7fff) {
+        width = 2;
+      } else if (min >= -0x80000000ll && max <= 0x7fffffffll) {
+        width = 4;
+      }
+    }
+
+    put_u8(output, type | width);
+    put_u32(output, static_cast<uint32_t>(numbers.size()));
+
+    size_t pos = output->size();
+    output->resize(pos + numbers.size() * width);
+    uint8_t *data = &(*output)[0] + pos;
+    for (size_t i = 0; i < numbers.size(); i++) {
+      uint64_t number = static_cast<uint64_t>(numbers[i]);
+      for (unsigned int b = 0; b < width; b++) {
+        *data++ = static_cast<uint8_t>(number >> (8*b));
+      }
+    }
+  }
+
+ protected:
+  save_writer_text_value_t &add(int64_t val) {
+    if (is_text) {
+      if (!value.empty()) value += ",";
+      append_number(&value, val);
+      return *this;
+    }
+    numbers.push_back(val);
+    return *this;
+  }
+};
+
+/* Section of a binary save. A section is written to the output when it
+   is finished, i.e. when its parent starts the next section or is
+   finished itself, so only the sections being filled are kept. */
+class save_writer_binary_section_t : public save_writer_text_t {
+ protected:
+  typedef std::map<std::string, save_writer_binary_value_t> values_t;
+
+  std::string name;
+  unsigned int number;
+  values_t values;
+  save_writer_binary_section_t *child;
+  std::vector<uint8_t> *output;
+
+ public:
+  save_writer_binary_section_t(const std::string &name, unsigned int number,
+                               std::vector<uint8_t> *output)
+    : name(name), number(number), child(NULL), output(output) {}
+  virtual ~save_writer_binary_section_t() {
+    delete child;
+  }
+
+  virtual save_writer_text_value_t &value(const std::string &name) {
+    return values[name];
+  }
+
+  virtual save_writer_text_t &add_section(const std::string &name,
+                                          unsigned int number) {
+    finish_child();
+    child = new save_writer_binary_section_t(name, number, output);
+    return *child;
+  }
+
+  void finish() {
+    finish_child();
+
+    put_name(output, name);
+    put_u32(output, number);
+    put_u32(output, static_cast<uint32_t>(values.size()));
+    for (values_t::const_iterator i = values.begin(); i != values.end(); ++i) {
+      put_name(output, i->first);
+      i->second.write(output);
+    }
+    values.clear();
+  }
+
+ protected:
+  void finish_child() {
+    if (child != NULL) {
+      child->finish();
+      delete child;
+      child = NULL;
+    }
+  }
+};
+
+bool
+save_binary_state(FILE *f, game_t *game, bool compress) {
+  save_image_t image;
+  return image.create(game) && image.write(f, compress);
+}
+
+bool
+save_image_t::create(game_t *game) {
+  payload.clear();
+  try {
+    save_writer_binary_section_t writer("game", 0, &payload);
+    writer << *game;
+    writer.finish();
+  } catch (Freeserf_Exception &e) {
+    LOGE("savegame", "Unable to save game: %s", e.get_description().c_str());
+    payload.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool
+save_image_t::write(FILE *f, bool compress) const {
+  if (payload.empty()) return false;
+
+  save_binary_header_t header;
+  memcpy(header.magic, SAVE_BINARY_MAGIC, 4);
+  header.version = htole32(SAVE_BINARY_VERSION);
+  header.flags = 0;
+  header.size = htole32(static_cast<uint32_t>(payload.size()));
+  header.checksum = htole64(data_cache_t::hash(&payload[0], payload.size()));
+
+  void *packed = NULL;
+  size_t packed_size = 0;
+  if (compress && tpwm_compress(&payload[0], payload.size(),
+                                &packed, &packed_size)) {
+    header.flags = htole32(SAVE_BINARY_COMPRESSED);
+  }
+
+  bool written = (fwrite(&header, sizeof(header), 1, f) == 1);
+  if (packed != NULL) {
+    written = written && (fwrite(packed, packed_size, 1, f) == 1);
+    free(packed);
+  } else {
+    written = written && (fwrite(&payload[0], payload.size(), 1, f) == 1);
+  }
+
+  return written;
+}
+
+bool
+save_image_t::write(const std::string &path, bool compress) const {
+  std::string temp_path = path + ".tmp";
+  FILE *f = fopen(temp_path.c_str(), "wb");
+  if (f == NULL) {
+    LOGE("savegame", "Unable to write save game file `%s'.",
+         temp_path.c_str());
+    return false;
+  }
+  bool written = write(f, compress);
+  written = (fclose(f) == 0) && written;
+
+#ifdef _WIN32
+  if (written) remove(path.c_str());
+#endif
+  if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOGE("savegame", "Unable to write save game file `%s'.", path.c_str());
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+save_async_t::save_async_t() : pool(1) {
+  busy = false;
+}
+
+save_async_t::~save_async_t() {
+  pool.wait();
+}
+
+bool
+save_async_t::save(const std::string &path, game_t *game) {
+  if (is_busy()) {
+    LOGW("savegame", "Previous save is still being written, skipping `%s'.",
+         path.c_str());
+    return false;
+  }
+
+  if (!image.create(game)) return false;
+  this->path = path;
+
+  mutex.lock();
+  busy = true;
+  mutex.unlock();
+
+  pool.add_task(this);
+
+  return true;
+}
+
+bool
+save_async_t::is_busy() {
+  mutex_lock_t lock(&mutex);
+  return busy;
+}
+
+void
+save_async_t::run() {
+  if (image.write(path, true)) {
+    LOGI("savegame", "Game saved to `%s'.", path.c_str());
+  }
+  image.clear();
+
+  mutex_lock_t lock(&mutex);
+  busy = false;
+}
+
+class save_reader_binary_section_t : public save_reader_text_t {
+ protected:
+  typedef struct {
+    unsigned int type;
+    size_t count;
+    const uint8_t *data;
+  } entry_t;
+  typedef std::map<std::string, entry_t> values_t;
+
+  std::string name;
+  unsigned int number;
+  values_t values;
+
+ public:
+  /* Parse the section at *pos and advance *pos past it. */
+  save_reader_binary_section_t(const uint8_t **pos, const uint8_t *end) {
+    const uint8_t *p = *pos;
+    name = get_name(&p, end);
+    need(p, end, 8);
+    number = get_u32(p);
+    size_t value_count = get_u32(p + 4);
+    p += 8;
+
+    for (size_t i = 0; i < value_count; i++) {
+      std::string key = get_name(&p, end);
+      need(p, end, 5);
+      entry_t entry;
+      entry.type = p[0];
+      entry.count = get_u32(p + 1);
+      p += 5;
+      size_t width = (entry.type == SAVE_BINARY_STRING) ? 1 :
+                     (entry.type & SAVE_BINARY_WIDTH_MASK);
+      if (width != 1 && width != 2 && width != 4 && width != 8) {
+        throw Freeserf_Exception("Unknown value type in save game");
+      }
+      if (entry.count > static_cast<size_t>(end - p) / width) {
+        throw Freeserf_Exception("Save game is truncated");
+      }
+      entry.data = p;
+      p += entry.count * width;
+      values[key] = entry;
+    }
+
+    *pos = p;
+  }
+
+  virtual std::string get_name() const {
+    return name;
+  }
+
+  virtual unsigned int get_number() const {
+    return number;
+  }
+
+  virtual save_reader_text_value_t
+  value(const std::string &name) const throw(Freeserf_Exception) {
+    values_t::const_iterator it = values.find(name);
+    if (it == values.end()) {
+      throw Freeserf_Exception("failed to load value");
+    }
+
+    const entry_t &entry = it->second;
+    if (entry.type == SAVE_BINARY_STRING) {
+      const char *text = reinterpret_cast<const char*>(entry.data);
+      return save_reader_text_value_t(std::string(text, entry.count));
+    }
+
+    return save_reader_text_value_t(entry.data, entry.count, entry.type);
   }
 
   virtual readers_t get_sections(const std::string &name) {
-    readers_t result;
+    throw Freeserf_Exception("Recursive sections are not allowed");
+  }
+
+ protected:
+  static void need(const uint8_t *pos, const uint8_t *end, size_t size) {
+    if (static_cast<size_t>(end - pos) < size) {
+      throw Freeserf_Exception("Save game is truncated");
+    }
+  }
 
-    reader_sections_t::const_iterator it = sections.begin();
-    for (; it != sections.end(); ++it) {
-      if ((*it)->get_name() == name) {
-        result.push_back(*it);
+  static std::string get_name(const uint8_t **pos, const uint8_t *end) {
+    need(*pos, end, 1);
+    size_t length = **pos;
+    need(*pos + 1, end, length);
+    std::string name(reinterpret_cast<const char*>(*pos + 1), length);
+    *pos += 1 + length;
+    return name;
+  }
+};
+
+class save_reader_binary_file_t : public save_reader_text_t {
+ protected:
+  typedef std::map<std::string, readers_t> index_t;
+
+  index_t index;
+
+ public:
+  save_reader_binary_file_t(const uint8_t *data, size_t size) {
+    const uint8_t *end = data + size;
+    try {
+      while (data < end) {
+        save_reader_binary_section_t *section =
+                                   new save_reader_binary_section_t(&data, end);
+        index[section->get_name()].push_back(section);
       }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  virtual ~save_reader_binary_file_t() {
+    clear();
+  }
+
+  virtual std::string get_name() const {
+    return std::string();
+  }
+
+  virtual unsigned int get_number() const {
+    return 0;
+  }
+
+  virtual save_reader_text_value_t
+  value(const std::string &name) const throw(Freeserf_Exception) {
+    throw Freeserf_Exception("Value \"" + name + "\" not found");
+  }
+
+  virtual readers_t get_sections(const std::string &name) {
+    index_t::const_iterator it = index.find(name);
+    if (it == index.end()) {
+      return readers_t();
     }
+    return it->second;
+  }
 
-    return result;
+ protected:
+  void clear() {
+    for (index_t::iterator it = index.begin(); it != index.end(); ++it) {
+      for (readers_t::iterator s = it->second.begin();
+           s != it->second.end(); ++s) {
+        delete *s;
+      }
+    }
+    index.clear();
   }
 };
 
 bool
-load_state(const std::string &path, game_t *game) {
-  std::ifstream file;
-  file.open(path.c_str());
+load_binary_state(const void *data, size_t size, game_t *game) {
+  save_binary_header_t header;
+  if (size < sizeof(header)) {
+    LOGE("savegame", "Save game is truncated.");
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, SAVE_BINARY_MAGIC, 4) != 0) {
+    LOGE("savegame", "Not a binary save game.");
+    return false;
+  }
+  if (le32toh(header.version) != SAVE_BINARY_VERSION) {
+    LOGE("savegame", "Unsupported save game version %u.",
+         le32toh(header.version));
+    return false;
+  }
+
+  const uint8_t *payload = reinterpret_cast<const uint8_t*>(data) +
+                           sizeof(header);
+  size_t payload_size = le32toh(header.size);
+  std::vector<uint8_t> unpacked;
+  if (le32toh(header.flags) & SAVE_BINARY_COMPRESSED) {
+    const char *error = NULL;
+    size_t packed_size = size - sizeof(header);
+    if (tpwm_uncompressed_size(payload, packed_size) != payload_size) {
+      LOGE("savegame", "Save game is corrupted.");
+      return false;
+    }
+    unpacked.resize(payload_size + 1);
+    if (!tpwm_uncompress_into(payload, packed_size, &unpacked[0],
+                              payload_size, &error)) {
+      LOGE("savegame", "Unable to unpack save game: %s", error);
+      return false;
+    }
+    payload = &unpacked[0];
+  } else if (size - sizeof(header) < payload_size) {
+    LOGE("savegame", "Save game is truncated.");
+    return false;
+  }
 
+  if (data_cache_t::hash(payload, payload_size) != le64toh(header.checksum)) {
+    LOGE("savegame", "Save game checksum does not match.");
+    return false;
+  }
+
+  try {
+    save_reader_binary_file_t reader(payload, payload_size);
+    reader >> *game;
+  } catch (Freeserf_Exception &e) {
+    LOGE("savegame", "Failed to load save game: %s", e.get_description().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool
+load_state(const std::string &path, game_t *game) {
+  /* The file is read as a whole. The buffer is null terminated so that
+     numbers can be parsed from text in place. */
+  std::ifstream file(path.c_str(), std::ios::binary);
   if (!file.is_open()) {
     LOGE("savegame", "Unable to open save game file: `%s'.", path.c_str());
     return false;
   }
+  file.seekg(0, std::ios::end);
+  size_t size = static_cast<size_t>(file.tellg());
+  file.seekg(0, std::ios::beg);
+  std::vector<char> buffer(size + 1, '\0');
+  file.read(&buffer[0], size);
+  if (!file) {
+    LOGE("savegame", "Unable to read save game file: `%s'.", path.c_str());
+    return false;
+  }
+  file.close();
+
+  /* Binary saves are recognized by their header. */
+  if (size >= 4 && memcmp(&buffer[0], SAVE_BINARY_MAGIC, 4) == 0) {
+    return load_binary_state(&buffer[0], size, game);
+  }
 
   try {
-    save_reader_text_file_t reader_text(&file);
+    save_reader_text_file_t reader_text(&buffer[0], size);
     reader_text >> *game;
-    file.close();
   } catch (...) {
-    file.close();
     LOGW("savegame", "Unable to load save game, trying compatability mode...");
-    std::ifstream input(path.c_str(), std::ios::binary);
-    std::vector<char> buffer((std::istreambuf_iterator<char>(input)),
-                             (std::istreambuf_iterator<char>()));
-    save_reader_binary_t reader(&buffer[0], buffer.size());
+    save_reader_binary_t reader(&buffer[0], size);
     try {
       reader >> *game;
     } catch (...) {
@@ -285,8 +981,8 @@ save_state(const std::string &path, game_t *game) {
   FILE *f = fopen(path.c_str(), "wb");
   if (f == NULL) return false;
 
-  bool r = save_text_state(f, game);
-  fclose(f);
+  bool r = save_binary_state(f, game, true);
+  r = (fclose(f) == 0) && r;
 
   return r;
 }
@@ -347,20 +1043,77 @@ save_reader_binary_t::read(size_t size) {
 
 save_reader_text_value_t::save_reader_text_value_t(std::string value) {
   this->value = value;
+  text = NULL;
+  length = 0;
+  items = NULL;
+  item_count = 0;
+  data = NULL;
+  count = 0;
+  type = SAVE_BINARY_STRING;
+}
+
+save_reader_text_value_t::save_reader_text_value_t(const char *text,
+                                                   size_t length,
+                                                   const char *const *items,
+                                                   size_t item_count) {
+  this->text = text;
+  this->length = length;
+  this->items = items;
+  this->item_count = item_count;
+  data = NULL;
+  count = 0;
+  type = SAVE_BINARY_STRING;
+}
+
+save_reader_text_value_t::save_reader_text_value_t(const uint8_t *data,
+                                                   size_t count,
+                                                   unsigned int type) {
+  text = NULL;
+  length = 0;
+  items = NULL;
+  item_count = 0;
+  this->data = data;
+  this->count = count;
+  this->type = type;
+}
+
+/* First number of the value. */
+int64_t
+save_reader_text_value_t::get_number() const {
+  if (type == SAVE_BINARY_STRING) {
+    /* Text is followed by a separator or the end of the buffer, so it
+       can be parsed in place. */
+    if (get_length() == 0) return 0;
+    return atoi(get_text());
+  }
+
+  if (count == 0) {
+    return 0;
+  }
+
+  unsigned int width = type & SAVE_BINARY_WIDTH_MASK;
+  uint64_t result = 0;
+  for (unsigned int i = 0; i < width; i++) {
+    result |= static_cast<uint64_t>(data[i]) << (8*i);
+  }
+  if ((type & SAVE_BINARY_SIGNED) && width < 8) {
+    uint64_t sign = static_cast<uint64_t>(1) << (8*width - 1);
+    result = (result ^ sign) - sign;
+  }
+
+  return static_cast<int64_t>(result);
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (int &val) {
-  int result = atoi(value.c_str());
-  val = result;
+  val = static_cast<int>(get_number());
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (unsigned int &val) {
-  int result = atoi(value.c_str());
-  val = result;
+  val = static_cast<unsigned int>(get_number());
 
   return *this;
 }
@@ -368,8 +1121,7 @@ save_reader_text_value_t::operator >> (unsigned int &val) {
 #if defined(_M_AMD64) || defined(__x86_64__)
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (size_t &val) {
-  int result = atoi(value.c_str());
-  val = result;
+  val = static_cast<size_t>(get_number());
 
   return *this;
 }
@@ -377,64 +1129,90 @@ save_reader_text_value_t::operator >> (size_t &val) {
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (dir_t &val) {
-  int result = atoi(value.c_str());
-  val = (dir_t)result;
+  val = (dir_t)get_number();
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (resource_type_t &val) {
-  int result = atoi(value.c_str());
-  val = (resource_type_t)result;
+  val = (resource_type_t)get_number();
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (building_type_t &val) {
-  int result = atoi(value.c_str());
-  val = (building_type_t)result;
+  val = (building_type_t)get_number();
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (serf_state_t &val) {
-  int result = atoi(value.c_str());
-  val = (serf_state_t)result;
+  val = (serf_state_t)get_number();
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (uint16_t &val) {
-  int result = atoi(value.c_str());
-  val = (uint16_t)result;
+  val = (uint16_t)get_number();
 
   return *this;
 }
 
 save_reader_text_value_t&
 save_reader_text_value_t::operator >> (std::string &val) {
-  val = value;
+  if (type == SAVE_BINARY_STRING) {
+    val.assign(get_text(), get_length());
+    return *this;
+  }
+
+  std::ostringstream ss;
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) ss << ",";
+    ss << (*this)[i].get_number();
+  }
+  val = ss.str();
+
   return *this;
 }
 
 save_reader_text_value_t
 save_reader_text_value_t::operator[] (size_t pos) {
-  std::vector<std::string> parts;
-  std::istringstream iss(value);
-  std::string item;
-  while (std::getline(iss, item, ',')) {
-    parts.push_back(item);
+  if (type != SAVE_BINARY_STRING) {
+    if (pos >= count) {
+      return save_reader_text_value_t(NULL, 0, type);
+    }
+    unsigned int width = type & SAVE_BINARY_WIDTH_MASK;
+    return save_reader_text_value_t(data + pos * width, 1, type);
+  }
+
+  if (items != NULL) {
+    if (pos >= item_count) {
+      return save_reader_text_value_t("");
+    }
+    const char *end = (pos + 1 < item_count) ? items[pos + 1] - 1 :
+                                               text + length;
+    return save_reader_text_value_t(items[pos], end - items[pos], NULL, 0);
   }
 
-  if (pos >= parts.size()) {
+  /* Items are not known, find the requested one. */
+  const char *begin = get_text();
+  const char *end = begin + get_length();
+  for (; pos > 0 && begin < end; begin++) {
+    if (*begin == ',') pos--;
+  }
+  if (pos > 0) {
     return save_reader_text_value_t("");
   }
+  const char *item_end = std::find(begin, end, ',');
+  if (text == NULL) {
+    return save_reader_text_value_t(std::string(begin, item_end));
+  }
 
-  return save_reader_text_value_t(parts[pos]);
+  return save_reader_text_value_t(begin, item_end - begin, NULL, 0);
 }
 
 save_writer_text_value_t&
@@ -443,9 +1221,7 @@ save_writer_text_value_t::operator << (int val) {
     value += ",";
   }
 
-  std::ostringstream ss;
-  ss << val;
-  value += ss.str();
+  append_number(&value, static_cast<int64_t>(val));
 
   return *this;
 }
@@ -456,9 +1232,7 @@ save_writer_text_value_t::operator << (unsigned int val) {
     value += ",";
   }
 
-  std::ostringstream ss;
-  ss << val;
-  value += ss.str();
+  append_number(&value, static_cast<uint64_t>(val));
 
   return *this;
 }
@@ -470,9 +1244,7 @@ save_writer_text_value_t::operator << (size_t val) {
     value += ",";
   }
 
-  std::ostringstream ss;
-  ss << val;
-  value += ss.str();
+  append_number(&value, static_cast<uint64_t>(val));
 
   return *this;
 }
@@ -484,9 +1256,7 @@ save_writer_text_value_t::operator << (dir_t val) {
     value += ",";
   }
 
-  std::ostringstream ss;
-  ss << static_cast<int>(val);
-  value += ss.str();
+  append_number(&value, static_cast<int64_t>(val));
 
   return *this;
 }
@@ -497,9 +1267,7 @@ save_writer_text_value_t::operator << (resource_type_t val) {
     value += ",";
   }
 
-  std::ostringstream ss;
-  ss << static_cast<int>(val);
-  value += ss.str();
+  append_number(&value, static_cast<int64_t>(val));
 
   return *this;
 }
@@ -24,6 +24,7 @@
 
 #include <string>
 #include <list>
+#include <vector>
 
 #ifdef HAVE_CONFIG_H
 # include <config.h>
@@ -38,6 +39,7 @@
 #include "src/building.h"
 #include "src/serf.h"
 #include "src/debug.h"
+#include "src/thread-pool.h"
 
 /* Original game format */
 bool load_v0_state(FILE *f);
@@ -46,6 +48,12 @@ bool load_v0_state(FILE *f);
 bool save_text_state(FILE *f, game_t *game);
 bool load_text_state(FILE *f, game_t *game);
 
+/* Binary format. Holds the same sections and values as the text format
+   but stores lists of numbers as little endian blocks of the smallest
+   fitting width, optionally packed as TPWM. */
+bool save_binary_state(FILE *f, game_t *game, bool compress);
+bool load_binary_state(const void *data, size_t size, game_t *game);
+
 /* Generic save/load function that will try to detect the right
    format on load and save to the best format on write. */
 bool save_state(const std::string &path, game_t *game);
@@ -53,6 +61,51 @@ bool load_state(const std::string &path, game_t *game);
 
 bool save_game(int autosave, game_t *game);
 
+/* Snapshot of a game in the binary format. Creating it only serializes
+   the game into memory; packing and writing can then be done on any
+   thread while the game goes on. */
+class save_image_t {
+ protected:
+  std::vector<uint8_t> payload;
+
+ public:
+  bool create(game_t *game);
+  void clear() { std::vector<uint8_t>().swap(payload); }
+  bool is_empty() const { return payload.empty(); }
+  bool operator==(const save_image_t &other) const {
+    return payload == other.payload; }
+  bool operator!=(const save_image_t &other) const {
+    return payload != other.payload; }
+
+  bool write(FILE *f, bool compress) const;
+  /* Write to a temporary file next to path that replaces path when
+     complete, so an existing file is never left half written. */
+  bool write(const std::string &path, bool compress) const;
+};
+
+/* Saves games on a worker thread. The game is only accessed by save()
+   itself; one save is written at a time. */
+class save_async_t : public thread_task_t {
+ protected:
+  thread_pool_t pool;
+  mutex_t mutex;
+  bool busy;
+  save_image_t image;
+  std::string path;
+
+ public:
+  save_async_t();
+  virtual ~save_async_t();
+
+  /* Returns false if the snapshot failed or the previous save is still
+     being written. */
+  bool save(const std::string &path, game_t *game);
+  bool is_busy();
+  void wait() { pool.wait(); }
+
+  virtual void run();
+};
+
 class save_reader_binary_t {
  protected:
   uint8_t *start;
@@ -74,12 +127,27 @@ class save_reader_binary_t {
   uint8_t *read(size_t size);
 };
 
+/* Value of a section. Either text or a block of count numbers from a
+   binary save, see save_binary_type_t. Text is held as a string or
+   refers to the buffer of a save file being read, together with the
+   start of each comma separated item if these are known. */
 class save_reader_text_value_t {
  protected:
   std::string value;
+  const char *text;
+  size_t length;
+  const char *const *items;
+  size_t item_count;
+  const uint8_t *data;
+  size_t count;
+  unsigned int type;
 
  public:
   explicit save_reader_text_value_t(std::string value);
+  save_reader_text_value_t(const char *text, size_t length,
+                           const char *const *items, size_t item_count);
+  save_reader_text_value_t(const uint8_t *data, size_t count,
+                           unsigned int type);
 
   save_reader_text_value_t& operator >> (int &val);
   save_reader_text_value_t& operator >> (unsigned int &val);
@@ -93,6 +161,15 @@ class save_reader_text_value_t {
   save_reader_text_value_t& operator >> (uint16_t &val);
   save_reader_text_value_t& operator >> (std::string &val);
   save_reader_text_value_t operator[] (size_t pos);
+
+ protected:
+  const char *get_text() const {
+    return (text != NULL) ? text : value.c_str();
+  }
+  size_t get_length() const {
+    return (text != NULL) ? length : value.length();
+  }
+  int64_t get_number() const;
 };
 
 class save_writer_text_value_t {
@@ -101,25 +178,36 @@ class save_writer_text_value_t {
 
  public:
   save_writer_text_value_t() {}
+  virtual ~save_writer_text_value_t() {}
 
-  save_writer_text_value_t& operator << (int val);
-  save_writer_text_value_t& operator << (unsigned int val);
+  virtual save_writer_text_value_t& operator << (int val);
+  virtual save_writer_text_value_t& operator << (unsigned int val);
 #if defined(_M_AMD64) || defined(__x86_64__)
-  save_writer_text_value_t& operator << (size_t val);
+  virtual save_writer_text_value_t& operator << (size_t val);
 #endif  // defined(_M_AMD64) || defined(__x86_64__)
-  save_writer_text_value_t& operator << (dir_t val);
-  save_writer_text_value_t& operator << (resource_type_t val);
-  save_writer_text_value_t& operator << (const std::string &val);
+  virtual save_writer_text_value_t& operator << (dir_t val);
+  virtual save_writer_text_value_t& operator << (resource_type_t val);
+  virtual save_writer_text_value_t& operator << (const std::string &val);
 
   std::string &get_value() { return value; }
 };
 
+/* Type of a value in a binary save: the width of the numbers in bytes,
+   with SAVE_BINARY_SIGNED set for signed numbers, or a string. */
+typedef enum {
+  SAVE_BINARY_STRING = 0,
+  SAVE_BINARY_WIDTH_MASK = 0x0f,
+  SAVE_BINARY_SIGNED = 0x80,
+} save_binary_type_t;
+
 class save_reader_text_t;
 
 typedef std::list<save_reader_text_t*> readers_t;
 
 class save_reader_text_t {
  public:
+  virtual ~save_reader_text_t() {}
+
   virtual std::string get_name() const = 0;
   virtual unsigned int get_number() const = 0;
   virtual save_reader_text_value_t value(const std::string &name) const
@@ -129,6 +217,8 @@ class save_reader_text_t {
 
 class save_writer_text_t {
  public:
+  virtual ~save_writer_text_t() {}
+
   virtual save_writer_text_value_t &value(const std::string &name) = 0;
   virtual save_writer_text_t &add_section(const std::string &name,
                                           unsigned int number) = 0;
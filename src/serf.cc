@@ -22,6 +22,7 @@
 #include "src/serf.h"
 
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 #include <map>
 
@@ -278,12 +279,154 @@ serf_t::serf_t(game_t *game, unsigned int index) : game_object_t(game, index) {
   animation = 0;
   counter = 0;
   pos = -1;
+  tick = 0;
+  memset(&s, 0, sizeof(s));
+  game->activate_serf(this);
+}
+
+/* Take the serf off its timer before it is changed from outside its own
+   update, so that it sees the change on the next update as it would
+   have without the timer. */
+void
+serf_t::wake() {
+  game->activate_serf(this);
+}
+
+void
+serf_t::catch_up() {
+  if (!game->is_serf_waiting(index)) return;
+
+  count_down_to(game->get_serf_update_tick(index));
+}
+
+void
+serf_t::count_down_to(unsigned int update_tick) {
+  uint16_t delta = update_tick - tick;
+  tick = update_tick;
+  counter -= delta;
+}
+
+bool
+serf_t::get_wake_tick(unsigned int *wake_tick) {
+  /* The handler takes the time since the last update as a 16 bit
+     value, so never wait longer than that. */
+  uint16_t elapsed = game->get_tick() - tick;
+  unsigned int last_tick = game->get_tick() - elapsed;
+  int max_wait = 0xffff;
+
+  /* The state handler acts once counter has dropped to limit. */
+  int limit = -1;
+
+  switch (state) {
+    case SERF_STATE_WALKING:
+    case SERF_STATE_TRANSPORTING:
+    case SERF_STATE_LEAVING_BUILDING:
+    case SERF_STATE_DIGGING:
+    case SERF_STATE_DELIVERING:
+    case SERF_STATE_FREE_WALKING:
+    case SERF_STATE_LOGGING:
+    case SERF_STATE_PLANNING_LOGGING:
+    case SERF_STATE_PLANNING_PLANTING:
+    case SERF_STATE_PLANTING:
+    case SERF_STATE_PLANNING_STONECUTTING:
+    case SERF_STATE_STONECUTTER_FREE_WALKING:
+    case SERF_STATE_LOST:
+    case SERF_STATE_LOST_SAILOR:
+    case SERF_STATE_FREE_SAILING:
+    case SERF_STATE_MINING:
+    case SERF_STATE_PLANNING_FISHING:
+    case SERF_STATE_FISHING:
+    case SERF_STATE_PLANNING_FARMING:
+    case SERF_STATE_FARMING:
+    case SERF_STATE_SAMPLING_GEO_SPOT:
+    case SERF_STATE_BUILDING:
+      break;
+    /* Knights in military buildings count down to their next training,
+       taking the full tick difference. From tick 65536 on that is more
+       than the 16 bit tick of the serf holds and they train each tick. */
+    case SERF_STATE_DEFENDING_HUT:
+    case SERF_STATE_DEFENDING_TOWER:
+    case SERF_STATE_DEFENDING_FORTRESS:
+    case SERF_STATE_DEFENDING_CASTLE:
+      if (get_type() < SERF_KNIGHT_0 || get_type() > SERF_KNIGHT_3) {
+        return false;
+      }
+      if (last_tick >= 0xffff) return false;
+      max_wait = 0xffff - last_tick;
+      break;
+    case SERF_STATE_ENTERING_BUILDING:
+      limit = std::max(limit, s.entering_building.slope_len);
+      break;
+    case SERF_STATE_STONECUTTING:
+      if (s.free_walking.neg_dist1 == 0) limit = s.free_walking.neg_dist2;
+      break;
+    /* Workers in buildings poll for resources in mode 0. */
+    case SERF_STATE_SAWING:
+      if (s.sawing.mode == 0) return false;
+      break;
+    case SERF_STATE_SMELTING:
+      if (s.smelting.mode == 0) return false;
+      break;
+    case SERF_STATE_MILLING:
+      if (s.milling.mode == 0) return false;
+      break;
+    case SERF_STATE_BAKING:
+      if (s.baking.mode == 0) return false;
+      break;
+    case SERF_STATE_PIGFARMING:
+      if (s.pigfarming.mode == 0) return false;
+      break;
+    case SERF_STATE_BUTCHERING:
+      if (s.butchering.mode == 0) return false;
+      break;
+    case SERF_STATE_MAKING_WEAPON:
+      if (s.making_weapon.mode == 0) return false;
+      break;
+    case SERF_STATE_MAKING_TOOL:
+      if (s.making_tool.mode == 0) return false;
+      break;
+    case SERF_STATE_BUILDING_BOAT:
+      if (s.building_boat.mode == 0) return false;
+      break;
+    default:
+      return false;
+  }
+
+  int wait = std::min(counter - limit, max_wait);
+  if (wait <= elapsed) return false;
+
+  *wake_tick = last_tick + wait;
+  return true;
+}
+
+/* Updates before the wake tick only count down, which reads nothing
+   but the serf and the game tick. */
+bool
+serf_t::can_update_alone() {
+  unsigned int wake_tick = 0;
+  return get_wake_tick(&wake_tick);
+}
+
+bool
+serf_t::take_update(const serf_t &before, const serf_t &after) {
+  if (owner != before.owner || type != before.type ||
+      sound != before.sound || animation != before.animation ||
+      counter != before.counter || pos != before.pos ||
+      tick != before.tick || state != before.state ||
+      memcmp(&s, &before.s, sizeof(s)) != 0) {
+    return false;
+  }
+
+  *this = after;
+  return true;
 }
 
 /* Change type of serf and update all global tables
    tracking serf types. */
 void
 serf_t::set_type(serf_type_t new_type) {
+  wake();
+
   serf_type_t old_type = get_type();
   type = new_type;
 
@@ -315,6 +458,7 @@ serf_t::set_type(serf_type_t new_type) {
 
 void
 serf_t::add_to_defending_queue(unsigned int next_knight_index, bool pause) {
+  wake();
   serf_log_state_change(this, SERF_STATE_DEFENDING_CASTLE);
   state = SERF_STATE_DEFENDING_CASTLE;
   s.defending.next_knight = next_knight_index;
@@ -325,6 +469,7 @@ serf_t::add_to_defending_queue(unsigned int next_knight_index, bool pause) {
 
 void
 serf_t::init_generic(inventory_t *inventory) {
+  wake();
   set_type(SERF_GENERIC);
   set_player(inventory->get_owner());
   building_t *building = game->get_building(inventory->get_building_index());
@@ -336,6 +481,7 @@ serf_t::init_generic(inventory_t *inventory) {
 
 void
 serf_t::init_inventory_transporter(inventory_t *inventory) {
+  wake();
   serf_log_state_change(this, SERF_STATE_BUILDING_CASTLE);
   state = SERF_STATE_BUILDING_CASTLE;
   s.building_castle.inv_index = inventory->get_index();
@@ -360,7 +506,8 @@ serf_t::reset_transport(flag_t *flag) {
              s.leaving_building.field_B < 0) {
     s.leaving_building.field_B = -2;
     s.leaving_building.dest = 0;
-  } else if (state == SERF_STATE_TRANSPORTING &&
+  } else if ((state == SERF_STATE_TRANSPORTING ||
+              state == SERF_STATE_DELIVERING) &&
              s.walking.dest == flag->get_index()) {
     s.walking.dest = 0;
   } else if (state == SERF_STATE_MOVE_RESOURCE_OUT &&
@@ -542,6 +689,7 @@ serf_t::flag_deleted(map_pos_t flag_pos) {
     case SERF_STATE_FINISHED_BUILDING:
     case SERF_STATE_WALKING:
       if (game->get_map()->paths(flag_pos) == 0) {
+        wake();
         serf_log_state_change(this, SERF_STATE_LOST);
         state = SERF_STATE_LOST;
       }
@@ -558,6 +706,7 @@ serf_t::building_deleted(map_pos_t building_pos, bool escape) {
        state == SERF_STATE_READY_TO_LEAVE_INVENTORY)) {
     if (escape) {
       /* Serf is escaping. */
+      wake();
       state = SERF_STATE_ESCAPE_BUILDING;
     } else {
       /* Kill this serf. */
@@ -574,6 +723,7 @@ void
 serf_t::castle_deleted(map_pos_t castle_pos, bool transporter) {
   if ((!transporter || (get_type() == SERF_TRANSPORTER_INVENTORY)) &&
       pos == castle_pos) {
+    wake();
     if (transporter) {
       set_type(SERF_TRANSPORTER);
     }
@@ -607,6 +757,7 @@ serf_t::change_transporter_state_at_pos(map_pos_t pos_,
 
 void
 serf_t::restore_path_serf_info() {
+  wake();
   if (state != SERF_STATE_WAKE_ON_PATH) {
     s.walking.wait_counter = -1;
     if (s.walking.res != 0) {
@@ -690,8 +841,11 @@ serf_t::idle_to_wait_state(map_pos_t pos_) {
        get_state() == SERF_STATE_WAIT_IDLE_ON_PATH ||
        get_state() == SERF_STATE_WAKE_AT_FLAG ||
        get_state() == SERF_STATE_WAKE_ON_PATH)) {
+    wake();
     serf_log_state_change(this, SERF_STATE_WAKE_AT_FLAG);
     state = SERF_STATE_WAKE_AT_FLAG;
+    /* The road is being removed and its flag may go with it. */
+    s.idle_on_path.flag = NULL;
     return true;
   }
   return false;
@@ -749,6 +903,7 @@ serf_t::insert_before(serf_t *knight) {
 void
 serf_t::go_out_from_inventory(unsigned int inventory,
                               map_pos_t dest, int dir) {
+  wake();
   serf_log_state_change(this, SERF_STATE_READY_TO_LEAVE_INVENTORY);
   state = SERF_STATE_READY_TO_LEAVE_INVENTORY;
   s.ready_to_leave_inventory.mode = dir;
@@ -758,6 +913,7 @@ serf_t::go_out_from_inventory(unsigned int inventory,
 
 void
 serf_t::send_off_to_fight(int dist_col, int dist_row) {
+  wake();
   /* Send this serf off to fight. */
   serf_log_state_change(this, SERF_STATE_KNIGHT_LEAVE_FOR_WALK_TO_FIGHT);
   state = SERF_STATE_KNIGHT_LEAVE_FOR_WALK_TO_FIGHT;
@@ -770,6 +926,7 @@ serf_t::send_off_to_fight(int dist_col, int dist_row) {
 
 void
 serf_t::stay_idle_in_stock(unsigned int inventory) {
+  wake();
   serf_log_state_change(this, SERF_STATE_IDLE_IN_STOCK);
   state = SERF_STATE_IDLE_IN_STOCK;
   s.idle_in_stock.inv_index = inventory;
@@ -777,6 +934,7 @@ serf_t::stay_idle_in_stock(unsigned int inventory) {
 
 void
 serf_t::go_out_from_building(map_pos_t dest, int dir, int field_B) {
+  wake();
   serf_log_state_change(this, SERF_STATE_READY_TO_LEAVE);
   state = SERF_STATE_READY_TO_LEAVE;
   s.leaving_building.field_B = field_B;
@@ -789,6 +947,33 @@ serf_t::go_out_from_building(map_pos_t dest, int dir, int field_B) {
    from any earlier state first. */
 void
 serf_t::set_lost_state() {
+  /* A dead serf is only waiting to be removed, and a knight in a fight
+     is tied to its opponent. Both leave the road on their own. */
+  if (get_type() == SERF_DEAD) return;
+
+  switch (state) {
+    case SERF_STATE_KNIGHT_ATTACKING:
+    case SERF_STATE_KNIGHT_DEFENDING:
+    case SERF_STATE_KNIGHT_ATTACKING_VICTORY:
+    case SERF_STATE_KNIGHT_ATTACKING_DEFEAT:
+    case SERF_STATE_KNIGHT_ENGAGE_DEFENDING_FREE:
+    case SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE:
+    case SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE_JOIN:
+    case SERF_STATE_KNIGHT_PREPARE_ATTACKING_FREE:
+    case SERF_STATE_KNIGHT_PREPARE_DEFENDING_FREE:
+    case SERF_STATE_KNIGHT_PREPARE_DEFENDING_FREE_WAIT:
+    case SERF_STATE_KNIGHT_ATTACKING_FREE:
+    case SERF_STATE_KNIGHT_DEFENDING_FREE:
+    case SERF_STATE_KNIGHT_ATTACKING_VICTORY_FREE:
+    case SERF_STATE_KNIGHT_DEFENDING_VICTORY_FREE:
+    case SERF_STATE_KNIGHT_ATTACKING_FREE_WAIT:
+    case SERF_STATE_KNIGHT_ATTACKING_DEFEAT_FREE:
+      return;
+    default:
+      break;
+  }
+
+  wake();
   if (state == SERF_STATE_WALKING) {
     if (s.walking.res >= 0) {
       if (s.walking.res != 6) {
@@ -888,12 +1073,14 @@ serf_t::switch_waiting(dir_t dir) {
        state == SERF_STATE_WALKING ||
        state == SERF_STATE_DELIVERING) &&
       s.walking.dir < 0) {
+    wake();
     s.walking.dir = DIR_REVERSE(dir);
     return 1;
   } else if ((state == SERF_STATE_FREE_WALKING ||
         state == SERF_STATE_KNIGHT_FREE_WALKING ||
         state == SERF_STATE_STONECUTTER_FREE_WALKING) &&
        animation == 82) {
+    wake();
     int dx = ((dir < 3) ? 1 : -1)*((dir % 3) < 2);
     int dy = ((dir < 3) ? 1 : -1)*((dir % 3) > 0);
 
@@ -1042,6 +1229,7 @@ serf_t::transporter_move_to_flag(flag_t *flag) {
     s.walking.wait_counter = 0;
     int res_index = flag->scheduled_slot((dir_t)dir);
 
+    flag->resource_carried(dir);
     if (s.walking.res == 0) {
       /* Pick up resource. */
       resource_type_t res;
@@ -1067,25 +1255,14 @@ serf_t::transporter_move_to_flag(flag_t *flag) {
     if (flag->drop_resource((resource_type_t)(s.walking.res-1),
                             s.walking.dest)) {
       s.walking.res = 0;
+    } else {
+      flag->transporter_found_full(dir);
     }
   }
 
   change_direction(dir, 1);
 }
 
-bool
-serf_t::handle_serf_walking_state_search_cb(flag_t *flag, void *data) {
-  serf_t *serf = static_cast<serf_t*>(data);
-  flag_t *dest = flag->get_game()->get_flag(serf->s.walking.dest);
-  if (flag == dest) {
-    LOGV("serf", " dest found: %i.", dest->get_search_dir());
-    serf->change_direction(dest->get_search_dir(), 0);
-    return 1;
-  }
-
-  return 0;
-}
-
 void
 serf_t::start_walking(dir_t dir, int slope, int change_pos) {
   map_pos_t new_pos = game->get_map()->move(pos, dir);
@@ -1269,17 +1446,15 @@ serf_t::handle_serf_walking_state() {
         return;
       } else {
         flag_t *src = game->get_flag_at_pos(pos);
-        flag_search_t search(game);
-        for (int i = 0; i < 6; i++) {
-          if (!src->is_water_path((dir_t)(5-i))) {
-            flag_t *other_flag = src->get_other_end_flag((dir_t)(5-i));
-            other_flag->set_search_dir((dir_t)(5-i));
-            search.add_source(other_flag);
-          }
+        flag_t *dest = game->get_flag(s.walking.dest);
+        dir_t dir = DIR_NONE;
+        if (dest != NULL) {
+          dir = game->get_path_cache()->get_next_dir(src, dest);
+        }
+        if (dir != DIR_NONE) {
+          change_direction(dir, 0);
+          continue;
         }
-        bool r = search.execute(handle_serf_walking_state_search_cb,
-                                true, false, this);
-        if (r) continue;
       }
     } else {
       /* 30A37 */
@@ -1316,8 +1491,11 @@ serf_t::handle_serf_walking_state() {
       flag_t *flag = game->get_flag(s.walking.dest);
       building_t *building = flag->get_building();
 
-      building->serf_request_failed();
-      if (!building->has_inventory()) building->decrease_requested_for_stock(0);
+      if (building->serf_requested()) {
+        building->serf_request_failed();
+      } else if (!building->has_inventory()) {
+        building->decrease_requested_for_stock(0);
+      }
     } else if (s.walking.res != 6) {
       flag_t *flag = game->get_flag(s.walking.dest);
       dir_t d = (dir_t)s.walking.res;
@@ -1430,6 +1608,7 @@ serf_t::handle_serf_transporting_state() {
           state = SERF_STATE_IDLE_ON_PATH;
           s.idle_on_path.rev_dir = rev_dir;
           s.idle_on_path.flag = flag;
+          s.idle_on_path.field_E = 0;
           game->get_map()->set_idle_serf(pos);
           game->get_map()->set_serf_index(pos, 0);
           return;
@@ -4533,6 +4712,7 @@ serf_t::handle_serf_knight_engaging_building_state() {
         s.attacking.def_index = def_serf->get_index();
 
         /* Change state of defending knight */
+        def_serf->wake();
         serf_log_state_change(def_serf, SERF_STATE_KNIGHT_LEAVE_FOR_FIGHT);
         def_serf->state = SERF_STATE_KNIGHT_LEAVE_FOR_FIGHT;
         def_serf->s.leaving_building.next_state =
@@ -4608,6 +4788,7 @@ serf_t::handle_serf_knight_prepare_attacking() {
     tick = game->get_tick();
 
     /* Change state of defender. */
+    def_serf->wake();
     serf_log_state_change(def_serf, SERF_STATE_KNIGHT_DEFENDING);
     def_serf->state = SERF_STATE_KNIGHT_DEFENDING;
     def_serf->counter = 0;
@@ -4657,6 +4838,7 @@ serf_t::handle_knight_attacking() {
   const int fight_anim_max[] = { 10, 11, 14, 11, 10 };
 
   serf_t *def_serf = game->get_serf(s.attacking.def_index);
+  def_serf->wake();
 
   uint16_t delta = game->get_tick() - tick;
   tick = game->get_tick();
@@ -4721,7 +4903,7 @@ serf_t::handle_knight_attacking() {
         def_serf->tick = game->get_tick();
         def_serf->animation = 147 + get_type();
         def_serf->counter = 255;
-        set_type(SERF_DEAD);
+        def_serf->set_type(SERF_DEAD);
       }
     } else {
       /* Go to next move in fight sequence. */
@@ -4743,6 +4925,7 @@ serf_t::handle_knight_attacking() {
 void
 serf_t::handle_serf_knight_attacking_victory_state() {
   serf_t *def_serf = game->get_serf(s.attacking.def_index);
+  def_serf->wake();
 
   uint16_t delta = game->get_tick() - def_serf->tick;
   def_serf->tick = game->get_tick();
@@ -4783,7 +4966,10 @@ serf_t::handle_knight_occupy_enemy_building() {
         game->get_map()->get_obj(pos_) <= MAP_OBJ_CASTLE) {
       building_t *building =
                        game->get_building(game->get_map()->get_obj_index(pos_));
+      /* The building may have been rebuilt while the knight was away. A
+         construction site is still held by its builder. */
       if (!building->is_burning() &&
+          building->is_done() &&
           building->is_military()) {
         if (building->get_owner() == get_player()) {
           /* Enter building if there is space. */
@@ -4843,7 +5029,7 @@ serf_t::handle_state_knight_free_walking() {
         serf_t *other = game->get_serf(game->get_map()->get_serf_index(pos_));
         if (get_player() != other->get_player()) {
           if (other->state == SERF_STATE_KNIGHT_FREE_WALKING) {
-            pos = game->get_map()->move_left(pos_);
+            pos_ = game->get_map()->move_left(pos_);
             if (can_pass_map_pos(pos_)) {
               int dist_col = s.free_walking.dist1;
               int dist_row = s.free_walking.dist2;
@@ -4860,6 +5046,7 @@ serf_t::handle_state_knight_free_walking() {
               animation = 99;
               counter = 255;
 
+              other->wake();
               serf_log_state_change(other,
                                     SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE);
               other->state = SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE;
@@ -4884,12 +5071,15 @@ serf_t::handle_state_knight_free_walking() {
               animation = 99;
               counter = 255;
 
+              /* The building the knight was sent to may be gone. */
               flag_t *dest = game->get_flag(other->s.walking.dest);
-              building_t *building = dest->get_building();
-              if (!building->has_inventory()) {
+              building_t *building = NULL;
+              if (dest != NULL) building = dest->get_building();
+              if (building != NULL && !building->has_inventory()) {
                 building->requested_knight_attacking_on_walk();
               }
 
+              other->wake();
               serf_log_state_change(other,
                                     SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE);
               other->state = SERF_STATE_KNIGHT_ENGAGE_ATTACKING_FREE;
@@ -4944,6 +5134,7 @@ serf_t::handle_state_knight_engage_attacking_free_join() {
 
     serf_t *other = game->get_serf(s.attacking.def_index);
     map_pos_t other_pos = other->pos;
+    other->wake();
     serf_log_state_change(other, SERF_STATE_KNIGHT_PREPARE_DEFENDING_FREE);
     other->state = SERF_STATE_KNIGHT_PREPARE_DEFENDING_FREE;
     other->counter = counter;
@@ -4976,6 +5167,7 @@ serf_t::handle_state_knight_prepare_attacking_free() {
     state = SERF_STATE_KNIGHT_ATTACKING_FREE;
     counter = 0;
 
+    other->wake();
     serf_log_state_change(other, SERF_STATE_KNIGHT_DEFENDING_FREE);
     other->state = SERF_STATE_KNIGHT_DEFENDING_FREE;
     other->counter = 0;
@@ -5001,6 +5193,7 @@ serf_t::handle_state_knight_prepare_defending_free() {
 void
 serf_t::handle_knight_attacking_victory_free() {
   serf_t *other = game->get_serf(s.attacking.def_index);
+  other->wake();
 
   uint16_t delta = game->get_tick() - other->tick;
   other->tick = game->get_tick();
@@ -5051,6 +5244,7 @@ serf_t::handle_serf_knight_attacking_defeat_free_state() {
     int dist_col = other->s.defending_free.dist_col;
     int dist_row = other->s.defending_free.dist_row;
 
+    other->wake();
     serf_log_state_change(other, SERF_STATE_KNIGHT_FREE_WALKING);
     other->state = SERF_STATE_KNIGHT_FREE_WALKING;
 
@@ -6012,7 +6206,10 @@ operator >> (save_reader_text_t &reader, serf_t &serf) {
       reader.value("state.rev_dir") >> serf.s.idle_on_path.rev_dir;
       unsigned int flag_idex;
       reader.value("state.flag") >> flag_idex;
-      serf.s.idle_on_path.flag = serf.get_game()->create_flag(flag_idex);
+      serf.s.idle_on_path.flag = NULL;
+      if (flag_idex != 0) {
+        serf.s.idle_on_path.flag = serf.get_game()->create_flag(flag_idex);
+      }
       reader.value("state.field_E") >> serf.s.idle_on_path.field_E;
       break;
 
@@ -6032,6 +6229,8 @@ operator >> (save_reader_text_t &reader, serf_t &serf) {
 
 save_writer_text_t&
 operator << (save_writer_text_t &writer, serf_t &serf) {
+  serf.catch_up();
+
   writer.value("type") << serf.type;
   writer.value("owner") << serf.owner;
   writer.value("animation") << serf.animation;
@@ -6212,7 +6411,11 @@ operator << (save_writer_text_t &writer, serf_t &serf) {
     case SERF_STATE_WAKE_AT_FLAG:
     case SERF_STATE_WAKE_ON_PATH:
       writer.value("state.rev_dir") << serf.s.idle_on_path.rev_dir;
-      writer.value("state.flag") << serf.s.idle_on_path.flag->get_index();
+      if (serf.s.idle_on_path.flag != NULL) {
+        writer.value("state.flag") << serf.s.idle_on_path.flag->get_index();
+      } else {
+        writer.value("state.flag") << 0;
+      }
       writer.value("state.field_E") << serf.s.idle_on_path.field_E;
       break;
 
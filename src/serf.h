@@ -380,7 +380,7 @@ class serf_t : public game_object_t {
 
   serf_state_t get_state() { return state; }
   int get_animation() { return animation; }
-  int get_counter() { return counter; }
+  int get_counter() { catch_up(); return counter; }
 
   map_pos_t get_pos() { return pos; }
 
@@ -441,6 +441,19 @@ class serf_t : public game_object_t {
 
   void update();
 
+  /* Return true if the serf only counts down until wake_tick, so that
+     the updates before that tick can be skipped. */
+  bool get_wake_tick(unsigned int *wake_tick);
+  /* Apply the countdown of the updates skipped while waiting. */
+  void catch_up();
+  void count_down_to(unsigned int update_tick);
+  /* Return true if the next update only changes the serf itself, so
+     that it can run on a copy while other serfs are updated. */
+  bool can_update_alone();
+  /* Take over an update that ran on a copy of the serf, unless the serf
+     changed since the copy was made. */
+  bool take_update(const serf_t &before, const serf_t &after);
+
   static const char *get_state_name(serf_state_t state);
   static const char *get_type_name(serf_type_t type);
 
@@ -452,6 +465,7 @@ class serf_t : public game_object_t {
     operator << (save_writer_text_t &writer, serf_t &serf);
 
  protected:
+  void wake();
   int is_waiting(dir_t *dir);
   int switch_waiting(dir_t dir);
   int get_walking_animation(int h_diff, dir_t dir, int switch_pos);
@@ -466,7 +480,6 @@ class serf_t : public game_object_t {
   bool can_pass_map_pos(map_pos_t pos);
   void set_fight_outcome(serf_t *attacker, serf_t *defender);
 
-  static bool handle_serf_walking_state_search_cb(flag_t *flag, void *data);
 
 
   void handle_serf_idle_in_stock_state();
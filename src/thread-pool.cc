@@ -0,0 +1,159 @@
+/*
+ * thread-pool.cc - Worker threads for background tasks
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/thread-pool.h"
+
+#include <SDL.h>
+
+#include "src/log.h"
+
+mutex_t::mutex_t() {
+  mutex = SDL_CreateMutex();
+}
+
+mutex_t::~mutex_t() {
+  SDL_DestroyMutex(mutex);
+}
+
+void
+mutex_t::lock() {
+  SDL_LockMutex(mutex);
+}
+
+void
+mutex_t::unlock() {
+  SDL_UnlockMutex(mutex);
+}
+
+thread_pool_t::thread_pool_t(unsigned int thread_count) {
+  mutex = SDL_CreateMutex();
+  task_available = SDL_CreateCond();
+  task_finished = SDL_CreateCond();
+  running = 0;
+  stopping = false;
+
+  if (thread_count == 0) {
+    thread_count = get_cpu_count();
+    if (thread_count > 1) thread_count--;
+  }
+
+  for (unsigned int i = 0; i < thread_count; i++) {
+    SDL_Thread *thread = SDL_CreateThread(thread_main, "worker", this);
+    if (thread == NULL) {
+      LOGW("thread-pool", "Unable to create worker thread: %s",
+           SDL_GetError());
+      break;
+    }
+    threads.push_back(thread);
+  }
+}
+
+thread_pool_t::~thread_pool_t() {
+  SDL_LockMutex(mutex);
+  stopping = true;
+  SDL_CondBroadcast(task_available);
+  SDL_UnlockMutex(mutex);
+
+  for (std::vector<SDL_Thread*>::iterator it = threads.begin();
+       it != threads.end(); ++it) {
+    SDL_WaitThread(*it, NULL);
+  }
+
+  SDL_DestroyCond(task_finished);
+  SDL_DestroyCond(task_available);
+  SDL_DestroyMutex(mutex);
+}
+
+void
+thread_pool_t::add_task(thread_task_t *task) {
+  /* Without workers the task is run right away. */
+  if (threads.empty()) {
+    task->run();
+    return;
+  }
+
+  SDL_LockMutex(mutex);
+  queue.push_back(task);
+  SDL_CondSignal(task_available);
+  SDL_UnlockMutex(mutex);
+}
+
+bool
+thread_pool_t::wait(unsigned int timeout) {
+  bool done = true;
+
+  /* Tasks finishing wake us up, so only the time left until the
+     deadline is waited for each time. */
+  Uint32 deadline = SDL_GetTicks() + timeout;
+
+  SDL_LockMutex(mutex);
+  while (!queue.empty() || running > 0) {
+    if (timeout == 0) {
+      SDL_CondWait(task_finished, mutex);
+      continue;
+    }
+
+    Sint32 left = static_cast<Sint32>(deadline - SDL_GetTicks());
+    if (left <= 0) {
+      done = false;
+      break;
+    }
+    SDL_CondWaitTimeout(task_finished, mutex, left);
+  }
+  SDL_UnlockMutex(mutex);
+
+  return done;
+}
+
+unsigned int
+thread_pool_t::get_cpu_count() {
+  int count = SDL_GetCPUCount();
+  return (count > 0) ? count : 1;
+}
+
+int
+thread_pool_t::thread_main(void *data) {
+  reinterpret_cast<thread_pool_t*>(data)->work();
+  return 0;
+}
+
+void
+thread_pool_t::work() {
+  SDL_LockMutex(mutex);
+  while (true) {
+    while (queue.empty() && !stopping) {
+      SDL_CondWait(task_available, mutex);
+    }
+    if (stopping) break;
+
+    thread_task_t *task = queue.front();
+    queue.pop_front();
+    running++;
+    SDL_UnlockMutex(mutex);
+
+    task->run();
+
+    SDL_LockMutex(mutex);
+    running--;
+    SDL_CondBroadcast(task_finished);
+  }
+  SDL_UnlockMutex(mutex);
+}
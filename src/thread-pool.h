@@ -0,0 +1,100 @@
+/*
+ * thread-pool.h - Worker threads for background tasks
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_THREAD_POOL_H_
+#define SRC_THREAD_POOL_H_
+
+#include <deque>
+#include <vector>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+class mutex_t {
+ protected:
+  SDL_mutex *mutex;
+
+ public:
+  mutex_t();
+  virtual ~mutex_t();
+
+  void lock();
+  void unlock();
+
+ private:
+  mutex_t(const mutex_t &);
+  mutex_t &operator=(const mutex_t &);
+};
+
+/* Holds the mutex locked for the lifetime of the object. */
+class mutex_lock_t {
+ protected:
+  mutex_t *mutex;
+
+ public:
+  explicit mutex_lock_t(mutex_t *mutex) : mutex(mutex) { mutex->lock(); }
+  ~mutex_lock_t() { mutex->unlock(); }
+};
+
+class thread_task_t {
+ public:
+  virtual ~thread_task_t() {}
+
+  /* Called on a worker thread. */
+  virtual void run() = 0;
+};
+
+/* Fixed set of worker threads running queued tasks in the order they
+   were added. Tasks are owned by the caller and must stay alive until
+   they have run. */
+class thread_pool_t {
+ protected:
+  std::vector<SDL_Thread*> threads;
+  std::deque<thread_task_t*> queue;
+  SDL_mutex *mutex;
+  SDL_cond *task_available;
+  SDL_cond *task_finished;
+  unsigned int running;
+  bool stopping;
+
+ public:
+  /* With thread_count 0 one thread less than the number of CPUs is
+     used (but at least one). */
+  explicit thread_pool_t(unsigned int thread_count = 0);
+  virtual ~thread_pool_t();
+
+  unsigned int get_thread_count() const { return threads.size(); }
+
+  void add_task(thread_task_t *task);
+
+  /* Wait until all tasks have run. With a timeout (in milliseconds)
+     false is returned if tasks are still pending after it expired. */
+  bool wait(unsigned int timeout = 0);
+
+  static unsigned int get_cpu_count();
+
+ protected:
+  static int thread_main(void *data);
+  void work();
+};
+
+#endif  // SRC_THREAD_POOL_H_
@@ -0,0 +1,262 @@
+/*
+ * tpwm-bench.cc - Benchmark of TPWM uncompressing
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares the previous whole-buffer uncompressing with the streaming
+   decoder and the direct path. Usage:
+
+     tpwm-bench [-n ITERATIONS] [-c CHUNK] FILE
+
+   FILE is usually SPAE.PA. Files that are not TPWM packed are packed
+   first so that any file can be used as input. */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "src/tpwm.h"
+#include "src/freeserf_endian.h"
+
+/* The uncompressing as it was before the decoder was added. It may write
+   up to seven bytes past the end of the output, so the buffer gets some
+   slack here. */
+static bool
+legacy_uncompress(void *src_data, size_t src_size,
+                  void **res_data, size_t *res_size) {
+  uint32_t *header = reinterpret_cast<uint32_t*>(src_data);
+  *res_size = le32toh(header[1]);
+  *res_data = malloc(*res_size + 8);
+  if (*res_data == NULL) return false;
+
+  uint8_t *src_pos = reinterpret_cast<uint8_t*>(src_data) + 8;
+  uint8_t *src_end = src_pos+src_size - 8;
+  uint8_t *res_pos = reinterpret_cast<uint8_t*>(*res_data);
+  uint8_t *res_end = res_pos + *res_size;
+  bool result = true;
+
+  while ((src_pos < src_end) && (res_pos < res_end)) {
+    size_t flag = *src_pos++;
+    if (src_pos >= src_end) { result = false; break; }
+    for (int i = 0 ; i < 8 ; i++) {
+      flag <<= 1;
+      if (flag & ~0xFF) {
+        flag &= 0xFF;
+        size_t temp = *src_pos++;
+        if (src_pos >= src_end) { result = false; break; }
+        size_t repeater = (temp & 0x0F) + 3;
+        size_t stamp_offset = *src_pos++ | ((temp << 4) & 0x0F00);
+        uint8_t *stamp = res_pos - stamp_offset;
+        while (repeater--) {
+          if ((res_pos >= res_end) || (stamp >= res_end)) {
+            result = false; break;
+          }
+          *res_pos++ = *stamp++;
+        }
+      } else {
+        *res_pos++ = *src_pos++;
+      }
+    }
+  }
+
+  if (!result) {
+    free(*res_data);
+    *res_data = NULL;
+  }
+
+  return result;
+}
+
+static double
+seconds_since(clock_t start) {
+  return static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+report(const char *name, size_t bytes, unsigned int iterations,
+       double seconds) {
+  double mb = static_cast<double>(bytes) * iterations / (1024 * 1024);
+  printf("%-24s %8.3f s %10.1f MB/s\n", name, seconds,
+         (seconds > 0) ? mb / seconds : 0.0);
+}
+
+int
+main(int argc, char *argv[]) {
+  unsigned int iterations = 10;
+  size_t chunk = 64 * 1024;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      chunk = atoi(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (path == NULL || iterations == 0 || chunk == 0) {
+    fprintf(stderr, "Usage: %s [-n ITERATIONS] [-c CHUNK] FILE\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open '%s'.\n", path);
+    return EXIT_FAILURE;
+  }
+  std::vector<uint8_t> input;
+  uint8_t buffer[64 * 1024];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    input.insert(input.end(), buffer, buffer + count);
+  }
+  fclose(f);
+
+  if (!tpwm_is_compressed(input.empty() ? NULL : &input[0], input.size())) {
+    printf("Input is not packed, packing %u bytes.\n",
+           static_cast<unsigned int>(input.size()));
+    void *packed = NULL;
+    size_t packed_size = 0;
+    if (!tpwm_compress(input.empty() ? NULL : &input[0], input.size(),
+                       &packed, &packed_size)) {
+      fprintf(stderr, "Packing failed.\n");
+      return EXIT_FAILURE;
+    }
+    uint8_t *packed_bytes = reinterpret_cast<uint8_t*>(packed);
+    input.assign(packed_bytes, packed_bytes + packed_size);
+    free(packed);
+  }
+
+  size_t size = tpwm_uncompressed_size(&input[0], input.size());
+  printf("Packed %u bytes, uncompressed %u bytes, %u iterations.\n",
+         static_cast<unsigned int>(input.size()),
+         static_cast<unsigned int>(size), iterations);
+
+  /* Previous whole-buffer uncompressing. */
+  void *reference = NULL;
+  size_t reference_size = 0;
+  clock_t start = clock();
+  for (unsigned int i = 0; i < iterations; i++) {
+    free(reference);
+    if (!legacy_uncompress(&input[0], input.size(), &reference,
+                           &reference_size)) {
+      fprintf(stderr, "Previous uncompressing failed.\n");
+      return EXIT_FAILURE;
+    }
+  }
+  report("previous", size, iterations, seconds_since(start));
+
+  /* Allocating wrapper. */
+  const char *error = NULL;
+  void *data = NULL;
+  size_t data_size = 0;
+  start = clock();
+  for (unsigned int i = 0; i < iterations; i++) {
+    free(data);
+    if (!tpwm_uncompress(&input[0], input.size(), &data, &data_size,
+                         &error)) {
+      fprintf(stderr, "%s\n", error);
+      return EXIT_FAILURE;
+    }
+  }
+  report("tpwm_uncompress", size, iterations, seconds_since(start));
+  bool equal = (data_size == size) && (memcmp(data, reference, size) == 0);
+  free(data);
+
+  /* Direct path into a preallocated buffer. */
+  std::vector<uint8_t> output(size + 1);
+  start = clock();
+  for (unsigned int i = 0; i < iterations; i++) {
+    if (!tpwm_uncompress_into(&input[0], input.size(), &output[0], size,
+                              &error)) {
+      fprintf(stderr, "%s\n", error);
+      return EXIT_FAILURE;
+    }
+  }
+  report("tpwm_uncompress_into", size, iterations, seconds_since(start));
+  equal = equal && (memcmp(&output[0], reference, size) == 0);
+
+  /* Streaming decoder, pulling from memory in chunks. */
+  start = clock();
+  for (unsigned int i = 0; i < iterations; i++) {
+    tpwm_memory_reader_t reader(&input[0], input.size());
+    tpwm_decoder_t decoder(&reader);
+    if (!decoder.init()) {
+      fprintf(stderr, "%s\n", decoder.get_error());
+      return EXIT_FAILURE;
+    }
+    size_t done = 0;
+    while (!decoder.is_finished() && decoder.get_error() == NULL) {
+      done += decoder.read(&output[done], std::min(chunk, size - done));
+    }
+    if (decoder.get_error() != NULL) {
+      fprintf(stderr, "%s\n", decoder.get_error());
+      return EXIT_FAILURE;
+    }
+  }
+  report("tpwm_decoder_t (memory)", size, iterations, seconds_since(start));
+  equal = equal && (memcmp(&output[0], reference, size) == 0);
+
+  /* Streaming decoder, pulling from a stream into one reused chunk. */
+  std::string packed(reinterpret_cast<char*>(&input[0]), input.size());
+  std::vector<uint8_t> piece(chunk);
+  start = clock();
+  for (unsigned int i = 0; i < iterations; i++) {
+    std::istringstream stream(packed);
+    tpwm_stream_reader_t reader(&stream);
+    tpwm_decoder_t decoder(&reader);
+    decoder.init();
+    size_t done = 0;
+    while ((count = decoder.read(&piece[0], chunk)) > 0) {
+      if (i == 0) {
+        equal = equal && (memcmp(&piece[0],
+                                 reinterpret_cast<uint8_t*>(reference) + done,
+                                 count) == 0);
+      }
+      done += count;
+    }
+    equal = equal && (done == size);
+  }
+  report("tpwm_decoder_t (stream)", size, iterations, seconds_since(start));
+
+  free(reference);
+
+  if (!equal) {
+    fprintf(stderr, "Output differs from previous uncompressing!\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("All outputs are equal.\n");
+  return EXIT_SUCCESS;
+}
@@ -21,6 +21,7 @@
 
 #include "src/tpwm.h"
 
+#include <algorithm>
 #include <cstring>
 
 #ifdef HAVE_CONFIG_H
@@ -48,6 +49,16 @@ tpwm_is_compressed(void *src_data, size_t src_size) {
   return true;
 }
 
+size_t
+tpwm_uncompressed_size(const void *src_data, size_t src_size) {
+  if (!tpwm_is_compressed(const_cast<void*>(src_data), src_size)) {
+    return 0;
+  }
+
+  const uint32_t *header = reinterpret_cast<const uint32_t*>(src_data);
+  return le32toh(header[1]);
+}
+
 bool
 tpwm_uncompress(void *src_data, size_t src_size,
                 void **res_data, size_t *res_size, const char **error) {
@@ -56,58 +67,300 @@ tpwm_uncompress(void *src_data, size_t src_size,
     return false;
   }
 
+  *res_data = NULL;
+  *res_size = 0;
+
   if (!tpwm_is_compressed(src_data, src_size)) {
     *error = "TPWM: source buffer is not tpwm packed";
     return false;
   }
 
-  *res_data = NULL;
-  *res_size = 0;
-
-  uint32_t *header = reinterpret_cast<uint32_t*>(src_data);
-  *res_size = le32toh(header[1]);
-  *res_data = malloc(*res_size);
-  if (*res_data == NULL) {
+  size_t size = tpwm_uncompressed_size(src_data, src_size);
+  void *data = malloc(size);
+  if (data == NULL) {
     *error = "TPWM: unable to allocate target buffer";
     return false;
   }
 
-  uint8_t *src_pos = reinterpret_cast<uint8_t*>(src_data) + 8;
-  uint8_t *src_end = src_pos+src_size - 8;
-  uint8_t *res_pos = reinterpret_cast<uint8_t*>(*res_data);
-  uint8_t *res_end = res_pos + *res_size;
-  bool result = true;
-
-  while ((src_pos < src_end) && (res_pos < res_end)) {
-    size_t flag = *src_pos++;
-    if (src_pos >= src_end) { result = false; break; }
-    for (int i = 0 ; i < 8 ; i++) {
-      flag <<= 1;
-      if (flag & ~0xFF) {
-        flag &= 0xFF;
-        size_t temp = *src_pos++;
-        if (src_pos >= src_end) { result = false; break; }
-        size_t repeater = (temp & 0x0F) + 3;
-        size_t stamp_offset = *src_pos++ | ((temp << 4) & 0x0F00);
-        uint8_t *stamp = res_pos - stamp_offset;
-        while (repeater--) {
-          if ((res_pos >= res_end) || (stamp >= res_end)) {
-            result = false; break;
-          }
+  if (!tpwm_uncompress_into(src_data, src_size, data, size, error)) {
+    free(data);
+    return false;
+  }
+
+  *res_data = data;
+  *res_size = size;
+
+  return true;
+}
+
+/* The packed data is a sequence of groups: a flag byte followed by
+   eight items, one for each bit of the flag byte starting with the most
+   significant. An item is either a literal byte (bit clear) or a back
+   reference of two bytes (bit set) holding a 12 bit offset and a 4 bit
+   length (3 to 18 bytes). */
+bool
+tpwm_uncompress_into(const void *src_data, size_t src_size,
+                     void *res_data, size_t res_size, const char **error) {
+  size_t size = tpwm_uncompressed_size(src_data, src_size);
+  if (size == 0 && !tpwm_is_compressed(const_cast<void*>(src_data),
+                                       src_size)) {
+    *error = "TPWM: source buffer is not tpwm packed";
+    return false;
+  }
+
+  if (res_size < size) {
+    *error = "TPWM: target buffer is too small";
+    return false;
+  }
+
+  const uint8_t *src_pos = reinterpret_cast<const uint8_t*>(src_data) + 8;
+  const uint8_t *src_end = reinterpret_cast<const uint8_t*>(src_data) +
+                           src_size;
+  uint8_t *res_beg = reinterpret_cast<uint8_t*>(res_data);
+  uint8_t *res_pos = res_beg;
+  uint8_t *res_end = res_beg + size;
+
+  while (res_pos < res_end) {
+    if (src_pos >= src_end) break;
+    unsigned int flags = *src_pos++;
+
+    for (int i = 0; i < 8 && res_pos < res_end; i++, flags <<= 1) {
+      if (flags & 0x80) {
+        if (src_end - src_pos < 2) {
+          src_pos = src_end;
+          break;
+        }
+        unsigned int temp = *src_pos++;
+        size_t length = (temp & 0x0F) + 3;
+        size_t offset = *src_pos++ | ((temp << 4) & 0x0F00);
+        if ((offset == 0) || (offset > (size_t)(res_pos - res_beg)) ||
+            (length > (size_t)(res_end - res_pos))) {
+          *error = "TPWM: unable to unpack, source data corrupted";
+          return false;
+        }
+
+        /* Source and destination may overlap, so copy byte by byte. */
+        const uint8_t *stamp = res_pos - offset;
+        while (length--) {
           *res_pos++ = *stamp++;
         }
       } else {
+        if (src_pos >= src_end) break;
         *res_pos++ = *src_pos++;
       }
     }
   }
 
-  if (!result) {
-    *error = "TPWM: unable to unpack, source data corrupted";
-    free(*res_data);
-    *res_data = NULL;
-    *res_size = 0;
+  if (res_pos < res_end) {
+    *error = "TPWM: unable to unpack, source data truncated";
+    return false;
+  }
+
+  return true;
+}
+
+/* Greedy packer: each position is matched against the last position
+   with the same three byte hash inside the 4096 byte window. */
+bool
+tpwm_compress(const void *src_data, size_t src_size,
+              void **res_data, size_t *res_size) {
+  if (src_size > 0xffffffff) {
+    return false;
+  }
+
+  /* Worst case is one flag byte for every eight literals. */
+  size_t capacity = 8 + src_size + (src_size + 7) / 8;
+  uint8_t *result = reinterpret_cast<uint8_t*>(malloc(capacity));
+  if (result == NULL) {
+    return false;
+  }
+
+  const size_t none = static_cast<size_t>(-1);
+  size_t *last = reinterpret_cast<size_t*>(malloc(0x10000 * sizeof(size_t)));
+  if (last == NULL) {
+    free(result);
+    return false;
+  }
+  std::fill(last, last + 0x10000, none);
+
+  memcpy(result, tpwm_sign, 4);
+  uint32_t size = htole32(static_cast<uint32_t>(src_size));
+  memcpy(result + 4, &size, 4);
+
+  const uint8_t *data = reinterpret_cast<const uint8_t*>(src_data);
+  uint8_t *res_pos = result + 8;
+  size_t pos = 0;
+  while (pos < src_size) {
+    uint8_t *flags = res_pos++;
+    *flags = 0;
+    for (int i = 0; i < 8 && pos < src_size; i++) {
+      size_t length = 0;
+      size_t offset = 0;
+      if (pos + 3 <= src_size) {
+        unsigned int h = (data[pos] << 8) ^ (data[pos+1] << 4) ^ data[pos+2];
+        h &= 0xffff;
+        size_t candidate = last[h];
+        last[h] = pos;
+        if (candidate != none && pos - candidate < 4096) {
+          while (length < 18 && pos + length < src_size &&
+                 data[candidate + length] == data[pos + length]) {
+            length++;
+          }
+          offset = pos - candidate;
+        }
+      }
+
+      if (length >= 3) {
+        *flags |= 0x80 >> i;
+        *res_pos++ = static_cast<uint8_t>(((offset >> 4) & 0xf0) |
+                                          (length - 3));
+        *res_pos++ = static_cast<uint8_t>(offset & 0xff);
+        pos += length;
+      } else {
+        *res_pos++ = data[pos++];
+      }
+    }
+  }
+
+  free(last);
+
+  *res_data = result;
+  *res_size = res_pos - result;
+
+  return true;
+}
+
+tpwm_memory_reader_t::tpwm_memory_reader_t(const void *data, size_t size) {
+  pos = reinterpret_cast<const uint8_t*>(data);
+  end = pos + size;
+}
+
+size_t
+tpwm_memory_reader_t::read(void *buffer, size_t size) {
+  size = std::min(size, static_cast<size_t>(end - pos));
+  memcpy(buffer, pos, size);
+  pos += size;
+  return size;
+}
+
+size_t
+tpwm_stream_reader_t::read(void *buffer, size_t size) {
+  stream->read(reinterpret_cast<char*>(buffer), size);
+  return static_cast<size_t>(stream->gcount());
+}
+
+tpwm_decoder_t::tpwm_decoder_t(tpwm_reader_t *reader) {
+  this->reader = reader;
+  input_pos = 0;
+  input_length = 0;
+  size = 0;
+  position = 0;
+  flags = 0;
+  flag_count = 0;
+  match_length = 0;
+  match_offset = 0;
+  error = "TPWM: decoder not initialized";
+}
+
+bool
+tpwm_decoder_t::next_byte(uint8_t *byte) {
+  if (input_pos >= input_length) {
+    input_length = reader->read(input, sizeof(input));
+    input_pos = 0;
+    if (input_length == 0) {
+      return false;
+    }
+  }
+
+  *byte = input[input_pos++];
+  return true;
+}
+
+bool
+tpwm_decoder_t::init() {
+  uint8_t header[8];
+  for (int i = 0; i < 8; i++) {
+    if (!next_byte(&header[i])) {
+      error = "TPWM: source is not tpwm packed";
+      return false;
+    }
+  }
+
+  size = tpwm_uncompressed_size(header, sizeof(header));
+  if (size == 0 && !tpwm_is_compressed(header, sizeof(header))) {
+    error = "TPWM: source is not tpwm packed";
+    return false;
+  }
+
+  position = 0;
+  flag_count = 0;
+  match_length = 0;
+  error = NULL;
+  return true;
+}
+
+size_t
+tpwm_decoder_t::read(void *buffer, size_t length) {
+  if (error != NULL) return 0;
+
+  uint8_t *out = reinterpret_cast<uint8_t*>(buffer);
+  length = std::min(length, size - position);
+  size_t done = 0;
+
+  while (done < length) {
+    /* Continue a back reference, possibly from the previous call. */
+    if (match_length > 0) {
+      size_t count = std::min(match_length, length - done);
+      for (size_t i = 0; i < count; i++) {
+        uint8_t byte = window[(position - match_offset) & 0xfff];
+        window[position & 0xfff] = byte;
+        out[done++] = byte;
+        position++;
+      }
+      match_length -= count;
+      continue;
+    }
+
+    if (flag_count == 0) {
+      uint8_t byte = 0;
+      if (!next_byte(&byte)) {
+        error = "TPWM: unable to unpack, source data truncated";
+        break;
+      }
+      flags = byte;
+      flag_count = 8;
+    }
+
+    bool match = (flags & 0x80) != 0;
+    flags <<= 1;
+    flag_count--;
+
+    if (match) {
+      uint8_t temp = 0;
+      uint8_t low = 0;
+      if (!next_byte(&temp) || !next_byte(&low)) {
+        error = "TPWM: unable to unpack, source data truncated";
+        break;
+      }
+      match_length = (temp & 0x0F) + 3;
+      match_offset = low | ((temp << 4) & 0x0F00);
+      if ((match_offset == 0) || (match_offset > position) ||
+          (match_length > size - position)) {
+        error = "TPWM: unable to unpack, source data corrupted";
+        match_length = 0;
+        break;
+      }
+    } else {
+      uint8_t byte = 0;
+      if (!next_byte(&byte)) {
+        error = "TPWM: unable to unpack, source data truncated";
+        break;
+      }
+      window[position & 0xfff] = byte;
+      out[done++] = byte;
+      position++;
+    }
   }
 
-  return result;
+  return done;
 }
@@ -23,10 +23,107 @@
 #define SRC_TPWM_H_
 
 #include <cstdlib>
+#include <istream>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
 
 bool tpwm_is_compressed(void *src_data, size_t src_size);
 bool tpwm_uncompress(void *src_data, size_t src_size,
                      void **res_data, size_t *res_size,
                      const char **error);
 
+/* Size of the uncompressed content, or 0 if src_data is not packed. */
+size_t tpwm_uncompressed_size(const void *src_data, size_t src_size);
+
+/* Uncompress into a caller provided buffer (e.g. a mapped file) of at
+   least tpwm_uncompressed_size() bytes. */
+bool tpwm_uncompress_into(const void *src_data, size_t src_size,
+                          void *res_data, size_t res_size,
+                          const char **error);
+
+/* Pack src_data into a newly allocated buffer (released with free()).
+   Only used for data written by freeserf itself. */
+bool tpwm_compress(const void *src_data, size_t src_size,
+                   void **res_data, size_t *res_size);
+
+/* Source of packed data for tpwm_decoder_t. */
+class tpwm_reader_t {
+ public:
+  virtual ~tpwm_reader_t() {}
+
+  /* Read up to size bytes into buffer. Returns the number of bytes
+     read; 0 means the end of the input was reached. */
+  virtual size_t read(void *buffer, size_t size) = 0;
+};
+
+class tpwm_memory_reader_t : public tpwm_reader_t {
+ protected:
+  const uint8_t *pos;
+  const uint8_t *end;
+
+ public:
+  tpwm_memory_reader_t(const void *data, size_t size);
+
+  virtual size_t read(void *buffer, size_t size);
+};
+
+class tpwm_stream_reader_t : public tpwm_reader_t {
+ protected:
+  std::istream *stream;
+
+ public:
+  explicit tpwm_stream_reader_t(std::istream *stream) : stream(stream) {}
+
+  virtual size_t read(void *buffer, size_t size);
+};
+
+/* Incremental TPWM decoder. Packed data is pulled from the reader as
+   needed and the uncompressed content is produced in chunks of any
+   size, so neither needs to be in memory as a whole. Only the last
+   4096 bytes of output are kept for back references. */
+class tpwm_decoder_t {
+ protected:
+  tpwm_reader_t *reader;
+
+  uint8_t input[4096];
+  size_t input_pos;
+  size_t input_length;
+
+  uint8_t window[4096];
+  size_t size;
+  size_t position;
+
+  unsigned int flags;
+  unsigned int flag_count;
+  size_t match_length;
+  size_t match_offset;
+
+  const char *error;
+
+ public:
+  explicit tpwm_decoder_t(tpwm_reader_t *reader);
+
+  /* Read the header. Must succeed before read() is used. */
+  bool init();
+
+  /* Uncompress up to length bytes into buffer. Returns the number of
+     bytes produced, which is less than length only at the end of the
+     content or on error. */
+  size_t read(void *buffer, size_t length);
+
+  size_t get_size() const { return size; }
+  size_t get_position() const { return position; }
+  bool is_finished() const { return (error == NULL) && (position == size); }
+  const char *get_error() const { return error; }
+
+ protected:
+  bool next_byte(uint8_t *byte);
+};
+
 #endif  // SRC_TPWM_H_
@@ -306,6 +306,21 @@ video_sdl_t::draw_frame(int dx, int dy, video_frame_t *dest, int sx, int sy,
   }
 }
 
+void
+video_sdl_t::draw_frame_scaled(int dx, int dy, int dw, int dh,
+                               video_frame_t *dest, int sx, int sy,
+                               int sw, int sh, video_frame_t *src) {
+  SDL_Rect dest_rect = { dx, dy, dw, dh };
+  SDL_Rect src_rect = { sx, sy, sw, sh };
+
+  SDL_SetRenderTarget(renderer, dest->texture);
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  int r = SDL_RenderCopy(renderer, src->texture, &src_rect, &dest_rect);
+  if (r < 0) {
+    throw SDL_Exception("RenderCopy error");
+  }
+}
+
 void
 video_sdl_t::draw_rect(int x, int y, unsigned int width, unsigned int height,
                        const video_color_t color, video_frame_t *dest) {
@@ -0,0 +1,475 @@
+/*
+ * video-soft.cc - Software graphics rendering
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/video-soft.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "src/log.h"
+
+video_soft_t::video_soft_t() throw(Video_Exception) {
+  screen = NULL;
+  output_width = 0;
+  output_height = 0;
+  fullscreen = false;
+  zoom_factor = 1.f;
+  frame_count = 0;
+}
+
+video_soft_t::~video_soft_t() {
+  if (screen != NULL) {
+    destroy_frame(screen);
+    screen = NULL;
+  }
+}
+
+video_t *
+video_t::get_instance() {
+  if (instance == NULL) {
+    instance = new video_soft_t();
+  }
+  return instance;
+}
+
+void
+video_soft_t::set_resolution(unsigned int width, unsigned int height,
+                             bool fullscreen) throw(Video_Exception) {
+  if (width == 0 || height == 0) {
+    throw Soft_Exception("Invalid resolution");
+  }
+
+  /* Callers keep the screen frame across resolution changes, like the
+     screen of the SDL backend. Only replace its pixels. */
+  if (screen == NULL) {
+    screen = create_frame(width, height);
+  } else if (screen->w != width || screen->h != height) {
+    delete[] screen->pixels;
+    screen->w = width;
+    screen->h = height;
+    screen->pixels = new uint32_t[width * height];
+    memset(screen->pixels, 0, width * height * sizeof(uint32_t));
+  }
+
+  /* The first resolution set is the size of the virtual output. Later
+     calls only change the logical size of the screen, like the logical
+     size of the SDL renderer. */
+  if (output_width == 0 || output_height == 0) {
+    output_width = width;
+    output_height = height;
+  }
+
+  this->fullscreen = fullscreen;
+}
+
+void
+video_soft_t::get_resolution(unsigned int *width, unsigned int *height) {
+  if (width != NULL) {
+    *width = output_width;
+  }
+  if (height != NULL) {
+    *height = output_height;
+  }
+}
+
+void
+video_soft_t::set_fullscreen(bool enable) throw(Video_Exception) {
+  fullscreen = enable;
+}
+
+bool
+video_soft_t::is_fullscreen() {
+  return fullscreen;
+}
+
+video_frame_t *
+video_soft_t::get_screen_frame() {
+  return screen;
+}
+
+video_frame_t *
+video_soft_t::create_frame(unsigned int width, unsigned int height) {
+  video_frame_t *frame = new video_frame_t();
+  frame->w = width;
+  frame->h = height;
+  frame->pixels = new uint32_t[width * height];
+  memset(frame->pixels, 0, width * height * sizeof(uint32_t));
+  return frame;
+}
+
+void
+video_soft_t::destroy_frame(video_frame_t *frame) {
+  delete[] frame->pixels;
+  delete frame;
+}
+
+video_image_t *
+video_soft_t::create_image(void *data, unsigned int width,
+                           unsigned int height) {
+  video_image_t *image = new video_image_t();
+  image->w = width;
+  image->h = height;
+  image->pixels = new uint32_t[width * height];
+  memcpy(image->pixels, data, width * height * sizeof(uint32_t));
+
+  image->opaque = true;
+  for (unsigned int i = 0; i < width * height; i++) {
+    if ((image->pixels[i] >> 24) != 0xff) {
+      image->opaque = false;
+      break;
+    }
+  }
+
+  return image;
+}
+
+void
+video_soft_t::destroy_image(video_image_t *image) {
+  delete[] image->pixels;
+  delete image;
+}
+
+/* Blend a single source pixel over a destination pixel. This matches
+   SDL_BLENDMODE_BLEND: dstRGB = srcRGB*srcA + dstRGB*(1-srcA) and
+   dstA = srcA + dstA*(1-srcA). */
+static inline uint32_t
+blend_pixel(uint32_t d, uint32_t s) {
+  unsigned int a = s >> 24;
+  if (a == 0) return d;
+  if (a == 0xff) return s;
+
+  s |= 0xff000000;
+  unsigned int na = 0xff - a;
+  uint32_t r = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    unsigned int t = ((s >> shift) & 0xff) * a + ((d >> shift) & 0xff) * na;
+    t += 128;
+    t = (t + (t >> 8)) >> 8;
+    r |= t << shift;
+  }
+  return r;
+}
+
+void
+video_soft_t::blend_span(uint32_t *dest, const uint32_t *src,
+                         unsigned int count) {
+  unsigned int i = 0;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+  const __m128i full = _mm_set1_epi16(0xff);
+  const __m128i round = _mm_set1_epi16(128);
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+    /* Skip fully transparent and copy fully opaque groups of pixels. */
+    __m128i sa = _mm_and_si128(s, alpha_mask);
+    int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero));
+    if (transparent == 0xffff) continue;
+    int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, alpha_mask));
+    if (opaque == 0xffff) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), s);
+      continue;
+    }
+
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i*>(dest + i));
+
+    /* Broadcast the alpha of each pixel to all of its channels and treat
+       the source alpha channel as fully set, so the destination alpha
+       becomes srcA + dstA*(1-srcA). */
+    __m128i a = _mm_srli_epi32(s, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    s = _mm_or_si128(s, alpha_mask);
+
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+    __m128i t_lo = _mm_add_epi16(_mm_mullo_epi16(s_lo, a_lo),
+                         _mm_mullo_epi16(d_lo, _mm_sub_epi16(full, a_lo)));
+    __m128i t_hi = _mm_add_epi16(_mm_mullo_epi16(s_hi, a_hi),
+                         _mm_mullo_epi16(d_hi, _mm_sub_epi16(full, a_hi)));
+
+    /* Exact division by 255 with rounding. */
+    t_lo = _mm_add_epi16(t_lo, round);
+    t_hi = _mm_add_epi16(t_hi, round);
+    t_lo = _mm_srli_epi16(_mm_add_epi16(t_lo, _mm_srli_epi16(t_lo, 8)), 8);
+    t_hi = _mm_srli_epi16(_mm_add_epi16(t_hi, _mm_srli_epi16(t_hi, 8)), 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_packus_epi16(t_lo, t_hi));
+  }
+#endif
+
+  for (; i < count; i++) {
+    dest[i] = blend_pixel(dest[i], src[i]);
+  }
+}
+
+void
+video_soft_t::copy_span(uint32_t *dest, const uint32_t *src,
+                        unsigned int count) {
+  memcpy(dest, src, count * sizeof(uint32_t));
+}
+
+/* Copy or blend the rectangle at sx, sy with size w, h in the source
+   buffer to dx, dy in the destination buffer, clipped to the bounds of
+   the destination. */
+void
+video_soft_t::blit(uint32_t *dest, unsigned int dest_pitch,
+                   unsigned int dest_w, unsigned int dest_h, int dx, int dy,
+                   const uint32_t *src, unsigned int src_pitch, int sx, int sy,
+                   int w, int h, bool blend) {
+  if (dx < 0) {
+    sx -= dx;
+    w += dx;
+    dx = 0;
+  }
+  if (dy < 0) {
+    sy -= dy;
+    h += dy;
+    dy = 0;
+  }
+  w = std::min(w, static_cast<int>(dest_w) - dx);
+  h = std::min(h, static_cast<int>(dest_h) - dy);
+  if (w <= 0 || h <= 0) return;
+
+  for (int row = 0; row < h; row++) {
+    uint32_t *d = dest + (dy + row) * dest_pitch + dx;
+    const uint32_t *s = src + (sy + row) * src_pitch + sx;
+    if (blend) {
+      blend_span(d, s, w);
+    } else {
+      copy_span(d, s, w);
+    }
+  }
+}
+
+void
+video_soft_t::draw_image(const video_image_t *image, int x, int y,
+                         int y_offset, video_frame_t *dest) {
+  if (y_offset < 0) y_offset = 0;
+  int h = static_cast<int>(image->h) - y_offset;
+  if (h <= 0) return;
+
+  blit(dest->pixels, dest->w, dest->w, dest->h, x, y + y_offset,
+       image->pixels, image->w, 0, y_offset, image->w, h, !image->opaque);
+}
+
+void
+video_soft_t::draw_frame(int dx, int dy, video_frame_t *dest, int sx, int sy,
+                         video_frame_t *src, int w, int h) {
+  /* Clip the source rectangle to the bounds of the source frame. */
+  if (sx < 0) {
+    dx -= sx;
+    w += sx;
+    sx = 0;
+  }
+  if (sy < 0) {
+    dy -= sy;
+    h += sy;
+    sy = 0;
+  }
+  w = std::min(w, static_cast<int>(src->w) - sx);
+  h = std::min(h, static_cast<int>(src->h) - sy);
+  if (w <= 0 || h <= 0) return;
+
+  blit(dest->pixels, dest->w, dest->w, dest->h, dx, dy,
+       src->pixels, src->w, sx, sy, w, h, true);
+}
+
+/* Scale the source rectangle to the destination rectangle. Every
+   destination pixel is the average of the source pixels it covers, so
+   shrinking by a power of two is a plain box filter. */
+void
+video_soft_t::draw_frame_scaled(int dx, int dy, int dw, int dh,
+                                video_frame_t *dest, int sx, int sy,
+                                int sw, int sh, video_frame_t *src) {
+  if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) return;
+
+  int x0 = std::max(0, -dx);
+  int x1 = std::min(dw, static_cast<int>(dest->w) - dx);
+  int y0 = std::max(0, -dy);
+  int y1 = std::min(dh, static_cast<int>(dest->h) - dy);
+  if (x0 >= x1 || y0 >= y1) return;
+
+  uint32_t *row = new uint32_t[x1 - x0];
+  for (int y = y0; y < y1; y++) {
+    int src_y0 = std::max(0, sy + (y * sh) / dh);
+    int src_y1 = std::min(static_cast<int>(src->h),
+                          sy + std::max((y + 1) * sh / dh, y * sh / dh + 1));
+    for (int x = x0; x < x1; x++) {
+      int src_x0 = std::max(0, sx + (x * sw) / dw);
+      int src_x1 = std::min(static_cast<int>(src->w),
+                            sx + std::max((x + 1) * sw / dw, x * sw / dw + 1));
+
+      unsigned int sum[4] = { 0, 0, 0, 0 };
+      unsigned int count = 0;
+      for (int j = src_y0; j < src_y1; j++) {
+        const uint32_t *s = src->pixels + j * src->w;
+        for (int i = src_x0; i < src_x1; i++) {
+          for (int c = 0; c < 4; c++) {
+            sum[c] += (s[i] >> (8 * c)) & 0xff;
+          }
+          count++;
+        }
+      }
+
+      uint32_t pixel = 0;
+      if (count > 0) {
+        for (int c = 0; c < 4; c++) {
+          pixel |= ((sum[c] + count / 2) / count) << (8 * c);
+        }
+      }
+      row[x - x0] = pixel;
+    }
+    blend_span(dest->pixels + (dy + y) * dest->w + dx + x0, row, x1 - x0);
+  }
+  delete[] row;
+}
+
+void
+video_soft_t::draw_rect(int x, int y, unsigned int width, unsigned int height,
+                        const video_color_t color, video_frame_t *dest) {
+  /* Draw rectangle. */
+  fill_rect(x, y, width, 1, color, dest);
+  fill_rect(x, y+height-1, width, 1, color, dest);
+  fill_rect(x, y, 1, height, color, dest);
+  fill_rect(x+width-1, y, 1, height, color, dest);
+}
+
+void
+video_soft_t::fill_rect(int x, int y, unsigned int width, unsigned int height,
+                        const video_color_t color, video_frame_t *dest) {
+  int x0 = std::max(x, 0);
+  int y0 = std::max(y, 0);
+  int x1 = std::min(x + static_cast<int>(width), static_cast<int>(dest->w));
+  int y1 = std::min(y + static_cast<int>(height), static_cast<int>(dest->h));
+  if (x1 <= x0 || y1 <= y0) return;
+
+  /* Like the SDL renderer, rectangles are always filled opaque. */
+  uint32_t pixel = 0xff000000 | (color.r << 16) | (color.g << 8) | color.b;
+  for (int row = y0; row < y1; row++) {
+    uint32_t *d = dest->pixels + row * dest->w;
+    std::fill(d + x0, d + x1, pixel);
+  }
+}
+
+void
+video_soft_t::swap_buffers() {
+  /* Frames are only kept in memory, there is nothing to present. */
+  frame_count += 1;
+  if (dump_prefix.empty()) return;
+
+  std::ostringstream path;
+  path << dump_prefix << std::setw(6) << std::setfill('0') << frame_count
+       << ".bmp";
+  if (!save_bmp(path.str())) {
+    LOGW("video", "Unable to write frame to %s, frame dump stopped.",
+         path.str().c_str());
+    dump_prefix.clear();
+  }
+}
+
+bool
+video_soft_t::set_zoom_factor(float factor) {
+  if ((factor < 0.2f) || (factor > 1.f)) {
+    return false;
+  }
+
+  zoom_factor = factor;
+
+  unsigned int width = (unsigned int)(static_cast<float>(output_width) *
+                                      zoom_factor);
+  unsigned int height = (unsigned int)(static_cast<float>(output_height) *
+                                       zoom_factor);
+  set_resolution(width, height, is_fullscreen());
+
+  return true;
+}
+
+static void
+write_le16(FILE *f, unsigned int value) {
+  fputc(value & 0xff, f);
+  fputc((value >> 8) & 0xff, f);
+}
+
+static void
+write_le32(FILE *f, unsigned int value) {
+  write_le16(f, value & 0xffff);
+  write_le16(f, (value >> 16) & 0xffff);
+}
+
+bool
+video_soft_t::save_bmp(const std::string &path, const video_frame_t *frame) {
+  if (frame == NULL) frame = screen;
+  if (frame == NULL) return false;
+
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f == NULL) return false;
+
+  unsigned int data_size = frame->w * frame->h * 4;
+
+  /* File header */
+  fputc('B', f);
+  fputc('M', f);
+  write_le32(f, 14 + 40 + data_size);
+  write_le32(f, 0);
+  write_le32(f, 14 + 40);
+
+  /* Info header, bottom-up 32 bit BI_RGB */
+  write_le32(f, 40);
+  write_le32(f, frame->w);
+  write_le32(f, frame->h);
+  write_le16(f, 1);
+  write_le16(f, 32);
+  write_le32(f, 0);
+  write_le32(f, data_size);
+  write_le32(f, 2835);
+  write_le32(f, 2835);
+  write_le32(f, 0);
+  write_le32(f, 0);
+
+  for (int row = frame->h - 1; row >= 0; row--) {
+    const uint32_t *p = frame->pixels + row * frame->w;
+    for (unsigned int col = 0; col < frame->w; col++) {
+      write_le32(f, p[col]);
+    }
+  }
+
+  bool ok = (ferror(f) == 0);
+  fclose(f);
+
+  return ok;
+}
@@ -0,0 +1,143 @@
+/*
+ * video-soft.h - Software graphics rendering
+ *
+ * Copyright (C) 2016  Wicked_Digger <wicked_digger@mail.ru>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_VIDEO_SOFT_H_
+#define SRC_VIDEO_SOFT_H_
+
+#include <exception>
+#include <string>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "src/video.h"
+
+/* Pixels of frames and images are stored as 32 bit words in the same
+   layout as the sprite data (0xAARRGGBB), i.e. BGRA byte order on little
+   endian machines. */
+class video_frame_t {
+ public:
+  unsigned int w;
+  unsigned int h;
+  uint32_t *pixels;
+
+  video_frame_t() : w(0), h(0), pixels(NULL) {}
+};
+
+class video_image_t {
+ public:
+  unsigned int w;
+  unsigned int h;
+  uint32_t *pixels;
+
+  /* True if every pixel is fully opaque; such images are copied
+     instead of blended. */
+  bool opaque;
+
+  video_image_t() : w(0), h(0), pixels(NULL), opaque(false) {}
+};
+
+class Soft_Exception : public Video_Exception {
+ public:
+  explicit Soft_Exception(const std::string &description) throw()
+    : Video_Exception(description) {}
+  virtual ~Soft_Exception() throw() {}
+
+  virtual std::string get_platform() const { return "Software"; }
+};
+
+/* Video backend rendering into memory buffers only. There is no window
+   and no dependency on a GPU, so it can be used for headless rendering,
+   screenshots and reproducible rendering benchmarks. */
+class video_soft_t : public video_t {
+ protected:
+  video_frame_t *screen;
+  unsigned int output_width;
+  unsigned int output_height;
+  bool fullscreen;
+  float zoom_factor;
+  unsigned int frame_count;
+  std::string dump_prefix;
+
+ public:
+  video_soft_t() throw(Video_Exception);
+  virtual ~video_soft_t();
+
+  virtual void set_resolution(unsigned int width, unsigned int height,
+                              bool fullscreen) throw(Video_Exception);
+  virtual void get_resolution(unsigned int *width, unsigned int *height);
+  virtual void set_fullscreen(bool enable) throw(Video_Exception);
+  virtual bool is_fullscreen();
+
+  virtual video_frame_t *get_screen_frame();
+  virtual video_frame_t *create_frame(unsigned int width, unsigned int height);
+  virtual void destroy_frame(video_frame_t *frame);
+
+  virtual video_image_t *create_image(void *data, unsigned int width,
+                                      unsigned int height);
+  virtual void destroy_image(video_image_t *image);
+
+  virtual void warp_mouse(int x, int y) {}
+
+  virtual void draw_image(const video_image_t *image, int x, int y,
+                          int y_offset, video_frame_t *dest);
+  virtual void draw_frame(int dx, int dy, video_frame_t *dest, int sx, int sy,
+                          video_frame_t *src, int w, int h);
+  virtual void draw_frame_scaled(int dx, int dy, int dw, int dh,
+                                 video_frame_t *dest, int sx, int sy,
+                                 int sw, int sh, video_frame_t *src);
+  virtual void draw_rect(int x, int y, unsigned int width, unsigned int height,
+                         const video_color_t color, video_frame_t *dest);
+  virtual void fill_rect(int x, int y, unsigned int width, unsigned int height,
+                         const video_color_t color, video_frame_t *dest);
+  virtual void swap_buffers();
+
+  virtual void set_cursor(void *data, unsigned int width,
+                          unsigned int height) {}
+
+  virtual float get_zoom_factor() { return zoom_factor; }
+  virtual bool set_zoom_factor(float factor);
+
+  /* Write every frame presented by swap_buffers() to a BMP file named
+     by prefix and the frame number. An empty prefix stops the dump. */
+  void set_frame_dump(const std::string &prefix) { dump_prefix = prefix; }
+
+  /* Write the contents of frame (or the screen when frame is NULL)
+     to a 32 bit BMP file. */
+  bool save_bmp(const std::string &path, const video_frame_t *frame = NULL);
+
+ protected:
+  static void blend_span(uint32_t *dest, const uint32_t *src,
+                         unsigned int count);
+  static void copy_span(uint32_t *dest, const uint32_t *src,
+                        unsigned int count);
+  static void blit(uint32_t *dest, unsigned int dest_pitch,
+                   unsigned int dest_w, unsigned int dest_h, int dx, int dy,
+                   const uint32_t *src, unsigned int src_pitch, int sx, int sy,
+                   int w, int h, bool blend);
+};
+
+#endif  // SRC_VIDEO_SOFT_H_
@@ -79,6 +79,9 @@ class video_t {
                           int y_offset, video_frame_t *dest) = 0;
   virtual void draw_frame(int dx, int dy, video_frame_t *dest, int sx, int sy,
                           video_frame_t *src, int w, int h) = 0;
+  virtual void draw_frame_scaled(int dx, int dy, int dw, int dh,
+                                 video_frame_t *dest, int sx, int sy,
+                                 int sw, int sh, video_frame_t *src) = 0;
   virtual void draw_rect(int x, int y, unsigned int width, unsigned int height,
                          const video_color_t color, video_frame_t *dest) = 0;
   virtual void fill_rect(int x, int y, unsigned int width, unsigned int height,
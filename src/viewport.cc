@@ -22,6 +22,7 @@
 #include "src/viewport.h"
 
 #include <cassert>
+#include <cmath>
 #include <algorithm>
 
 #include "src/misc.h"
@@ -44,6 +45,10 @@
 
 #define VIEWPORT_COLS(viewport)  (2*((viewport)->width / MAP_TILE_WIDTH) + 1)
 
+/* Sounds are played from this far outside of the viewport (in screen
+   pixels) and fade out towards that distance. */
+#define SOUND_MARGIN  (4*MAP_TILE_WIDTH)
+
 /* Number of cols,rows in each landscape tile */
 #define MAP_TILE_COLS  16
 #define MAP_TILE_ROWS  16
@@ -67,29 +72,43 @@ static const uint8_t tri_spr[] = {
   16, 17, 18, 19, 20, 21, 22, 23
 };
 
+/* Index of the ground texture row (the low bits of tri_spr) for each
+   combination of neighbouring heights of a triangle. */
+static const int8_t tri_mask_up[] = {
+   0,  1,  3,  6,  7, -1, -1, -1, -1,
+   0,  1,  2,  5,  6,  7, -1, -1, -1,
+   0,  1,  2,  3,  5,  6,  7, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7, -1,
+   0,  1,  2,  3,  4,  4,  5,  6,  7,
+  -1,  0,  1,  2,  3,  4,  5,  6,  7,
+  -1, -1,  0,  1,  2,  4,  5,  6,  7,
+  -1, -1, -1,  0,  1,  2,  5,  6,  7,
+  -1, -1, -1, -1,  0,  1,  4,  6,  7
+};
+
+static const int8_t tri_mask_down[] = {
+   0,  0,  0,  0,  0, -1, -1, -1, -1,
+   1,  1,  1,  1,  1,  0, -1, -1, -1,
+   3,  2,  2,  2,  2,  1,  0, -1, -1,
+   6,  5,  3,  3,  3,  2,  1,  0, -1,
+   7,  6,  5,  4,  4,  3,  2,  1,  0,
+  -1,  7,  6,  5,  4,  4,  4,  2,  1,
+  -1, -1,  7,  6,  5,  5,  5,  5,  4,
+  -1, -1, -1,  7,  6,  6,  6,  6,  6,
+  -1, -1, -1, -1,  7,  7,  7,  7,  7
+};
+
 void
 viewport_t::draw_triangle_up(int x, int y, int m, int left, int right,
                              map_pos_t pos, frame_t *frame) {
-  static const int8_t tri_mask[] = {
-     0,  1,  3,  6,  7, -1, -1, -1, -1,
-     0,  1,  2,  5,  6,  7, -1, -1, -1,
-     0,  1,  2,  3,  5,  6,  7, -1, -1,
-     0,  1,  2,  3,  4,  5,  6,  7, -1,
-     0,  1,  2,  3,  4,  4,  5,  6,  7,
-    -1,  0,  1,  2,  3,  4,  5,  6,  7,
-    -1, -1,  0,  1,  2,  4,  5,  6,  7,
-    -1, -1, -1,  0,  1,  2,  5,  6,  7,
-    -1, -1, -1, -1,  0,  1,  4,  6,  7
-  };
-
   assert(left - m >= -4 && left - m <= 4);
   assert(right - m >= -4 && right - m <= 4);
 
   int mask = 4 + m - left + 9*(4 + m - right);
-  assert(tri_mask[mask] >= 0);
+  assert(tri_mask_up[mask] >= 0);
 
   int type = map->type_up(map->move_up(pos));
-  int index = (type << 3) | tri_mask[mask];
+  int index = (type << 3) | tri_mask_up[mask];
   assert(index < 128);
 
   int sprite = tri_spr[index];
@@ -102,26 +121,14 @@ viewport_t::draw_triangle_up(int x, int y, int m, int left, int right,
 void
 viewport_t::draw_triangle_down(int x, int y, int m, int left, int right,
                                map_pos_t pos, frame_t *frame) {
-  static const int8_t tri_mask[] = {
-     0,  0,  0,  0,  0, -1, -1, -1, -1,
-     1,  1,  1,  1,  1,  0, -1, -1, -1,
-     3,  2,  2,  2,  2,  1,  0, -1, -1,
-     6,  5,  3,  3,  3,  2,  1,  0, -1,
-     7,  6,  5,  4,  4,  3,  2,  1,  0,
-    -1,  7,  6,  5,  4,  4,  4,  2,  1,
-    -1, -1,  7,  6,  5,  5,  5,  5,  4,
-    -1, -1, -1,  7,  6,  6,  6,  6,  6,
-    -1, -1, -1, -1,  7,  7,  7,  7,  7
-  };
-
   assert(left - m >= -4 && left - m <= 4);
   assert(right - m >= -4 && right - m <= 4);
 
   int mask = 4 + left - m + 9*(4 + right - m);
-  assert(tri_mask[mask] >= 0);
+  assert(tri_mask_down[mask] >= 0);
 
   int type = map->type_down(map->move_up_left(pos));
-  int index = (type << 3) | tri_mask[mask];
+  int index = (type << 3) | tri_mask_down[mask];
   assert(index < 128);
 
   int sprite = tri_spr[index];
@@ -131,6 +138,26 @@ viewport_t::draw_triangle_down(int x, int y, int m, int left, int right,
                             DATA_MAP_GROUND_BASE + sprite);
 }
 
+void
+viewport_t::add_preload_sprites(sprite_preloader_t *preloader) {
+  for (int mask = 0; mask < MAP_TILE_MASKS; mask++) {
+    for (int type = 0; type < 16; type++) {
+      if (tri_mask_up[mask] >= 0) {
+        int sprite = tri_spr[(type << 3) | tri_mask_up[mask]];
+        preloader->add(sprite_preloader_t::PRELOAD_MASKED,
+                       DATA_MAP_GROUND_BASE + sprite,
+                       DATA_MAP_MASK_UP_BASE + mask);
+      }
+      if (tri_mask_down[mask] >= 0) {
+        int sprite = tri_spr[(type << 3) | tri_mask_down[mask]];
+        preloader->add(sprite_preloader_t::PRELOAD_MASKED,
+                       DATA_MAP_GROUND_BASE + sprite,
+                       DATA_MAP_MASK_DOWN_BASE + mask);
+      }
+    }
+  }
+}
+
 /* Draw a column (vertical) of tiles, starting at an up pointing tile. */
 void
 viewport_t::draw_up_tile_col(map_pos_t pos, int x_base, int y_base, int max_y,
@@ -252,6 +279,15 @@ viewport_t::draw_down_tile_col(map_pos_t pos, int x_base, int y_base,
 
 void
 viewport_t::layout() {
+  /* Zooming out past full size lowers the level of detail, one level
+     for every doubling of the zoom factor. */
+  float zoom = gfx_t::get_instance()->get_zoom_factor();
+  unsigned int zoom_lod = 0;
+  while (zoom_lod + 1 < VIEWPORT_LOD_LEVELS &&
+         zoom > 1.5f * static_cast<float>(1 << zoom_lod)) {
+    zoom_lod += 1;
+  }
+  set_lod(zoom_lod);
 }
 
 void
@@ -269,21 +305,19 @@ viewport_t::redraw_map_pos(map_pos_t pos) {
   int tr = (my / tile_height) % vert_tiles;
   int tid = tc + horiz_tiles*tr;
 
-  tiles_map_t::iterator it = landscape_tiles.find(tid);
-  if (it != landscape_tiles.end()) {
-    frame_t *frame = it->second;
-    landscape_tiles.erase(tid);
-    delete frame;
+  for (int i = 0; i < VIEWPORT_LOD_LEVELS; i++) {
+    tiles_map_t::iterator it = landscape_tiles[i].find(tid);
+    if (it != landscape_tiles[i].end()) {
+      frame_t *frame = it->second;
+      landscape_tiles[i].erase(tid);
+      delete frame;
+    }
   }
 }
 
+/* Render the landscape tile at full detail into a new frame. */
 frame_t *
-viewport_t::get_tile_frame(unsigned int tid, int tc, int tr) {
-  tiles_map_t::iterator it = landscape_tiles.find(tid);
-  if (it != landscape_tiles.end()) {
-    return it->second;
-  }
-
+viewport_t::render_tile_frame(int tc, int tr) {
   int tile_width = MAP_TILE_COLS*MAP_TILE_WIDTH;
   int tile_height = MAP_TILE_ROWS*MAP_TILE_HEIGHT;
 
@@ -320,7 +354,48 @@ viewport_t::get_tile_frame(unsigned int tid, int tc, int tr) {
        tc, tr,
        tile_width, tile_height);
 
-  landscape_tiles[tid] = tile_frame;
+  return tile_frame;
+}
+
+/* Get the landscape tile for the given level of detail. Tiles of lower
+   detail are downsampled from the next level when it is cached, or else
+   directly from a temporary full detail tile, so zooming out over a
+   large map does not keep every full detail tile around. */
+frame_t *
+viewport_t::get_tile_frame(unsigned int tid, int tc, int tr,
+                           unsigned int lod) {
+  tiles_map_t::iterator it = landscape_tiles[lod].find(tid);
+  if (it != landscape_tiles[lod].end()) {
+    return it->second;
+  }
+
+  frame_t *tile_frame = NULL;
+  if (lod == 0) {
+    tile_frame = render_tile_frame(tc, tr);
+  } else {
+    int tile_width = (MAP_TILE_COLS*MAP_TILE_WIDTH) >> lod;
+    int tile_height = (MAP_TILE_ROWS*MAP_TILE_HEIGHT) >> lod;
+
+    frame_t *src_frame = NULL;
+    int shift = 1;
+    it = landscape_tiles[lod-1].find(tid);
+    if (it != landscape_tiles[lod-1].end()) {
+      src_frame = it->second;
+    } else {
+      src_frame = render_tile_frame(tc, tr);
+      shift = lod;
+    }
+
+    tile_frame = gfx_t::get_instance()->create_frame(tile_width, tile_height);
+    tile_frame->fill_rect(0, 0, tile_width, tile_height, 0);
+    tile_frame->draw_frame_scaled(0, 0, tile_width, tile_height, 0, 0,
+                                  src_frame, tile_width << shift,
+                                  tile_height << shift);
+
+    if (shift != 1) delete src_frame;
+  }
+
+  landscape_tiles[lod][tid] = tile_frame;
 
   return tile_frame;
 }
@@ -330,13 +405,14 @@ viewport_t::draw_landscape() {
   int horiz_tiles = map->get_cols()/MAP_TILE_COLS;
   int vert_tiles = map->get_rows()/MAP_TILE_ROWS;
 
-  int tile_width = MAP_TILE_COLS*MAP_TILE_WIDTH;
-  int tile_height = MAP_TILE_ROWS*MAP_TILE_HEIGHT;
+  /* All sizes are in pixels of the current level of detail. */
+  int tile_width = (MAP_TILE_COLS*MAP_TILE_WIDTH) >> lod;
+  int tile_height = (MAP_TILE_ROWS*MAP_TILE_HEIGHT) >> lod;
 
-  int map_width = map->get_cols()*MAP_TILE_WIDTH;
-  int map_height = map->get_rows()*MAP_TILE_HEIGHT;
+  int map_width = (map->get_cols()*MAP_TILE_WIDTH) >> lod;
+  int map_height = (map->get_rows()*MAP_TILE_HEIGHT) >> lod;
 
-  int my = offset_y;
+  int my = offset_y >> lod;
   int y = 0;
   int x_base = 0;
   while (y < height) {
@@ -348,7 +424,7 @@ viewport_t::draw_landscape() {
     int ty = my % tile_height;
 
     int x = 0;
-    int mx = (offset_x + x_base) % map_width;
+    int mx = ((offset_x + x_base) >> lod) % map_width;
     while (x < width) {
       int tx = mx % tile_width;
 
@@ -356,7 +432,7 @@ viewport_t::draw_landscape() {
       int tr = (my / tile_height) % vert_tiles;
       int tid = tc + horiz_tiles*tr;
 
-      frame_t *tile_frame = get_tile_frame(tid, tc, tr);
+      frame_t *tile_frame = get_tile_frame(tid, tc, tr, lod);
 
       int w = tile_width - tx;
       if (x+w > width) {
@@ -514,6 +590,8 @@ viewport_t::draw_paths_and_borders() {
   int row_0 = (offset_y/MAP_TILE_HEIGHT) & map->get_row_mask();
   map_pos_t base_pos = map->pos(col_0, row_0);
 
+  road_load_map_t loads;
+
   for (int x_base = x_off; x_base < width + MAP_TILE_WIDTH;
        x_base += MAP_TILE_WIDTH) {
     map_pos_t pos = base_pos;
@@ -588,6 +666,35 @@ viewport_t::draw_paths_and_borders() {
   }
 }
 
+/* Play a sound from the map position pos. Sounds far outside of the
+   viewport are dropped, the rest are panned by their horizontal screen
+   position and attenuated by their distance from the centre. */
+void
+viewport_t::play_sound_at(int sound, map_pos_t pos) {
+  int mx, my;
+  map_pix_from_map_coord(pos, map->get_height(pos), &mx, &my);
+
+  int sx, sy;
+  screen_pix_from_map_pix(mx, my, &sx, &sy);
+
+  if (sx < -SOUND_MARGIN || sx >= width + SOUND_MARGIN ||
+      sy < -SOUND_MARGIN || sy >= height + SOUND_MARGIN) {
+    return;
+  }
+
+  float half_width = std::max(1, width / 2);
+  float half_height = std::max(1, height / 2);
+  float dx = (sx - half_width) / (half_width + SOUND_MARGIN);
+  float dy = (sy - half_height) / (half_height + SOUND_MARGIN);
+  float distance = std::min(1.f, std::sqrt(dx*dx + dy*dy));
+
+  audio_t *audio = audio_t::get_instance();
+  audio_player_t *player = audio->get_sound_player();
+  if (player != NULL) {
+    player->play_track_at(sound, 0.75f * dx, 1.f - 0.75f * distance);
+  }
+}
+
 void
 viewport_t::draw_game_sprite(int x, int y, int index) {
   frame->draw_transp_sprite(x, y, DATA_GAME_OBJECT_BASE + index, true);
@@ -725,7 +832,7 @@ viewport_t::draw_unharmed_building(building_t *building, int x, int y) {
         if ((((interface->get_game()->get_tick() +
                reinterpret_cast<uint8_t*>(&pos)[1]) >> 3) & 7) == 0
             && random->random() < 40000) {
-          play_sound(SFX_ELEVATOR);
+          play_sound_at(SFX_ELEVATOR, building->get_position());
         }
       }
       draw_shadow_and_building_sprite(x, y, map_building_sprite[type]);
@@ -743,7 +850,7 @@ viewport_t::draw_unharmed_building(building_t *building, int x, int y) {
       if (building->get_res_count_in_stock(1) > 0) {
         if ((random->random() & 0x7f) <
             static_cast<int>(building->get_res_count_in_stock(1))) {
-          play_sound(SFX_PIG_OINK);
+          play_sound_at(SFX_PIG_OINK, building->get_position());
         }
 
         int pigs_count = building->get_res_count_in_stock(1);
@@ -793,7 +900,7 @@ viewport_t::draw_unharmed_building(building_t *building, int x, int y) {
           building->stop_playing_sfx();
         } else if (!building->playing_sfx()) {
           building->start_playing_sfx();
-          play_sound(SFX_MILL_GRINDING);
+          play_sound_at(SFX_MILL_GRINDING, building->get_position());
         }
         draw_shadow_and_building_sprite(x, y, map_building_sprite[type] +
                                 ((interface->get_game()->get_tick() >> 4) & 3));
@@ -814,7 +921,7 @@ viewport_t::draw_unharmed_building(building_t *building, int x, int y) {
         int i = (interface->get_game()->get_tick() >> 3) & 7;
         if (i == 0 || (i == 7 && !building->playing_sfx())) {
           building->start_playing_sfx();
-          play_sound(SFX_GOLD_BOILS);
+          play_sound_at(SFX_GOLD_BOILS, building->get_position());
         } else if (i != 7) {
           building->stop_playing_sfx();
         }
@@ -854,7 +961,7 @@ viewport_t::draw_unharmed_building(building_t *building, int x, int y) {
         int i = (interface->get_game()->get_tick() >> 3) & 7;
         if (i == 0 || (i == 7 && !building->playing_sfx())) {
           building->start_playing_sfx();
-          play_sound(SFX_GOLD_BOILS);
+          play_sound_at(SFX_GOLD_BOILS, building->get_position());
         } else if (i != 7) {
           building->stop_playing_sfx();
         }
@@ -1090,7 +1197,7 @@ viewport_t::draw_burning_building(building_t *building, int x, int y) {
   if (((building->get_burning_counter() >> 3) & 3) == 3 &&
       !building->playing_sfx()) {
     building->start_playing_sfx();
-    play_sound(SFX_BURNING);
+    play_sound_at(SFX_BURNING, building->get_position());
   } else {
     building->stop_playing_sfx();
   }
@@ -1123,9 +1230,7 @@ viewport_t::draw_burning_building(building_t *building, int x, int y) {
 }
 
 void
-viewport_t::draw_building(map_pos_t pos, int x, int y) {
-  building_t *building = interface->get_game()->get_building_at_pos(pos);
-
+viewport_t::draw_building(building_t *building, int x, int y) {
   if (building->is_burning()) {
     draw_burning_building(building, x, y);
   } else {
@@ -1150,21 +1255,7 @@ viewport_t::draw_water_waves(map_pos_t pos, int x, int y) {
 }
 
 void
-viewport_t::draw_water_waves_row(map_pos_t pos, int y_base, int cols,
-                                 int x_base) {
-  for (int i = 0; i < cols; i++, x_base += MAP_TILE_WIDTH,
-       pos = map->move_right(pos)) {
-    if (map->type_up(pos) < 4 || map->type_down(pos) < 4) {
-      /*player->water_in_view += 1;*/
-      draw_water_waves(pos, x_base, y_base);
-    }
-  }
-}
-
-void
-viewport_t::draw_flag_and_res(map_pos_t pos, int x, int y) {
-  flag_t *flag = interface->get_game()->get_flag_at_pos(pos);
-
+viewport_t::draw_flag_and_res(flag_t *flag, int x, int y) {
   if (flag->get_resource_at_slot(0) != RESOURCE_NONE) {
     draw_game_sprite(x+6 , y-4, flag->get_resource_at_slot(0) + 1);
   }
@@ -1199,38 +1290,22 @@ viewport_t::draw_flag_and_res(map_pos_t pos, int x, int y) {
 }
 
 void
-viewport_t::draw_map_objects_row(map_pos_t pos, int y_base,
-                                 int cols, int x_base) {
-  for (int i = 0; i < cols;
-       i++, x_base += MAP_TILE_WIDTH, pos = map->move_right(pos)) {
-    if (map->get_obj(pos) == MAP_OBJ_NONE) continue;
-
-    int y = y_base - 4 * map->get_height(pos);
-    if (map->get_obj(pos) < MAP_OBJ_TREE_0) {
-      if (map->get_obj(pos) == MAP_OBJ_FLAG) {
-        draw_flag_and_res(pos, x_base, y);
-      } else if (map->get_obj(pos) <= MAP_OBJ_CASTLE) {
-        draw_building(pos, x_base, y);
-      }
+viewport_t::draw_map_object(int sprite, int x, int y) {
+  if (sprite < 24) {
+    /* Trees */
+    /*player->trees_in_view += 1;*/
+
+    /* Adding sprite number to animation ensures
+       that the tree animation won't be synchronized
+       for all trees on the map. */
+    int tree_anim = (interface->get_game()->get_tick() + sprite) >> 4;
+    if (sprite < 16) {
+      sprite = (sprite & ~7) + (tree_anim & 7);
     } else {
-      int sprite = map->get_obj(pos) - MAP_OBJ_TREE_0;
-      if (sprite < 24) {
-        /* Trees */
-        /*player->trees_in_view += 1;*/
-
-        /* Adding sprite number to animation ensures
-           that the tree animation won't be synchronized
-           for all trees on the map. */
-        int tree_anim = (interface->get_game()->get_tick() + sprite) >> 4;
-        if (sprite < 16) {
-          sprite = (sprite & ~7) + (tree_anim & 7);
-        } else {
-          sprite = (sprite & ~3) + (tree_anim & 3);
-        }
-      }
-      draw_shadow_and_building_sprite(x_base, y, sprite);
+      sprite = (sprite & ~3) + (tree_anim & 3);
     }
   }
+  draw_shadow_and_building_sprite(x, y, sprite);
 }
 
 /* Draw one individual serf in the row. */
@@ -1373,7 +1448,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       if (((t & 7) == 4 && !serf->playing_sfx()) ||
           (t & 7) == 3) {
         serf->start_playing_sfx();
-        play_sound(SFX_ROWING);
+        play_sound_at(SFX_ROWING, serf->get_pos());
       } else {
         serf->stop_playing_sfx();
       }
@@ -1387,7 +1462,7 @@ viewport_t::serf_get_body(serf_t *serf) {
         if (((t & 7) == 4 && !serf->playing_sfx()) ||
             (t & 7) == 3) {
           serf->start_playing_sfx();
-          play_sound(SFX_ROWING);
+          play_sound_at(SFX_ROWING, serf->get_pos());
         } else {
           serf->stop_playing_sfx();
         }
@@ -1405,7 +1480,7 @@ viewport_t::serf_get_body(serf_t *serf) {
     } else if (t == 0x83 || t == 0x84) {
       if (t == 0x83 || !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_DIGGING);
+        play_sound_at(SFX_DIGGING, serf->get_pos());
       }
       t += 0x380;
     } else {
@@ -1419,7 +1494,7 @@ viewport_t::serf_get_body(serf_t *serf) {
     } else if ((t & 7) == 4 || (t & 7) == 5) {
       if ((t & 7) == 4 || !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_HAMMER_BLOW);
+        play_sound_at(SFX_HAMMER_BLOW, serf->get_pos());
       }
       t += 0x580;
     } else {
@@ -1447,12 +1522,12 @@ viewport_t::serf_get_body(serf_t *serf) {
     } else if ((t == 0x86 && !serf->playing_sfx()) ||
          t == 0x85) {
       serf->start_playing_sfx();
-      play_sound(SFX_AX_BLOW);
+      play_sound_at(SFX_AX_BLOW, serf->get_pos());
       /* TODO Dangerous reference to unknown state vars.
          It is probably free walking. */
       if (serf->get_free_walking_neg_dist2() == 0 &&
           serf->get_counter() < 64) {
-        play_sound(SFX_TREE_FALL);
+        play_sound_at(SFX_TREE_FALL, serf->get_pos());
       }
       t += 0xe80;
     } else if (t != 0x86) {
@@ -1475,7 +1550,7 @@ viewport_t::serf_get_body(serf_t *serf) {
           (!serf->playing_sfx() && (t == 0xb7 || t == 0xbf ||
                 t == 0xc7 || t == 0xcf))) {
         serf->start_playing_sfx();
-        play_sound(SFX_SAWING);
+        play_sound_at(SFX_SAWING, serf->get_pos());
       } else if (t != 0xb7 && t != 0xbf && t != 0xc7 && t != 0xcf) {
         serf->stop_playing_sfx();
       }
@@ -1495,7 +1570,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       }
     } else if (t == 0x85 || (t == 0x86 && !serf->playing_sfx())) {
       serf->start_playing_sfx();
-      play_sound(SFX_PICK_BLOW);
+      play_sound_at(SFX_PICK_BLOW, serf->get_pos());
       t += 0x1280;
     } else if (t != 0x86) {
       serf->stop_playing_sfx();
@@ -1507,7 +1582,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       t += 0xe00;
     } else if (t == 0x86 || (t == 0x87 && !serf->playing_sfx())) {
       serf->start_playing_sfx();
-      play_sound(SFX_PLANTING);
+      play_sound_at(SFX_PLANTING, serf->get_pos());
       t += 0x1080;
     } else if (t != 0x87) {
       serf->stop_playing_sfx();
@@ -1578,7 +1653,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       }
     } else {
       if (t != 0x80 && t != 0x87 && t != 0x88 && t != 0x8f) {
-        play_sound(SFX_FISHING_ROD_REEL);
+        play_sound_at(SFX_FISHING_ROD_REEL, serf->get_pos());
       }
 
       /* TODO no check for state */
@@ -1616,7 +1691,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       if ((t == 0xb2 || t == 0xba || t == 0xc2 || t == 0xca) &&
           !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_BACKSWORD_BLOW);
+        play_sound_at(SFX_BACKSWORD_BLOW, serf->get_pos());
       } else if (t != 0xb2 && t != 0xba && t != 0xc2 && t != 0xca) {
         serf->stop_playing_sfx();
       }
@@ -1638,7 +1713,7 @@ viewport_t::serf_get_body(serf_t *serf) {
         t += 0x3d80;
       } else if (t == 0x83 || (t == 0x84 && !serf->playing_sfx())) {
         serf->start_playing_sfx();
-        play_sound(SFX_MOWING);
+        play_sound_at(SFX_MOWING, serf->get_pos());
         t += 0x3e80;
       } else if (t != 0x83 && t != 0x84) {
         serf->stop_playing_sfx();
@@ -1686,7 +1761,7 @@ viewport_t::serf_get_body(serf_t *serf) {
     } else if (t == 0x84 || t == 0x85) {
       if (t == 0x84 || !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_WOOD_HAMMERING);
+        play_sound_at(SFX_WOOD_HAMMERING, serf->get_pos());
       }
       t += 0x4e80;
     } else {
@@ -1718,10 +1793,10 @@ viewport_t::serf_get_body(serf_t *serf) {
       /* edi10 += 4; */
       if (t == 0x83 || (t == 0xb2 && !serf->playing_sfx())) {
         serf->start_playing_sfx();
-        play_sound(SFX_SAWING);
+        play_sound_at(SFX_SAWING, serf->get_pos());
       } else if (t == 0x87 || (t == 0xb6 && !serf->playing_sfx())) {
         serf->start_playing_sfx();
-        play_sound(SFX_WOOD_HAMMERING);
+        play_sound_at(SFX_WOOD_HAMMERING, serf->get_pos());
       } else if (t != 0xb2 && t != 0xb6) {
         serf->stop_playing_sfx();
       }
@@ -1745,7 +1820,7 @@ viewport_t::serf_get_body(serf_t *serf) {
       /* edi10 += 4; */
       if (t == 0x83 || (t == 0x84 && !serf->playing_sfx())) {
         serf->start_playing_sfx();
-        play_sound(SFX_METAL_HAMMERING);
+        play_sound_at(SFX_METAL_HAMMERING, serf->get_pos());
       } else if (t != 0x84) {
         serf->stop_playing_sfx();
       }
@@ -1758,13 +1833,13 @@ viewport_t::serf_get_body(serf_t *serf) {
     } else if (t == 0x83 || t == 0x84 || t == 0x86) {
       if (t == 0x83 || !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_GEOLOGIST_SAMPLING);
+        play_sound_at(SFX_GEOLOGIST_SAMPLING, serf->get_pos());
       }
       t += 0x4c80;
     } else if (t == 0x8c || t == 0x8d) {
       if (t == 0x8c || !serf->playing_sfx()) {
         serf->start_playing_sfx();
-        play_sound(SFX_RESOURCE_FOUND);
+        play_sound_at(SFX_RESOURCE_FOUND, serf->get_pos());
       }
       t += 0x4c80;
     } else {
@@ -1791,12 +1866,12 @@ viewport_t::serf_get_body(serf_t *serf) {
           serf->start_playing_sfx();
           if (serf->get_attacking_field_D() == 0 ||
               serf->get_attacking_field_D() == 4) {
-            play_sound(SFX_FIGHT_01);
+            play_sound_at(SFX_FIGHT_01, serf->get_pos());
           } else if (serf->get_attacking_field_D() == 2) {
             /* TODO when is SFX_FIGHT_02 played? */
-            play_sound(SFX_FIGHT_03);
+            play_sound_at(SFX_FIGHT_03, serf->get_pos());
           } else {
-            play_sound(SFX_FIGHT_04);
+            play_sound_at(SFX_FIGHT_04, serf->get_pos());
           }
         }
       }
@@ -1812,7 +1887,7 @@ viewport_t::serf_get_body(serf_t *serf) {
          (t == 2 || t == 5)) ||
         (t == 1 || t == 4)) {
       serf->start_playing_sfx();
-      play_sound(SFX_SERF_DYING);
+      play_sound_at(SFX_SERF_DYING, serf->get_pos());
     } else {
       serf->stop_playing_sfx();
     }
@@ -1914,12 +1989,10 @@ viewport_t::draw_active_serf(serf_t *serf, map_pos_t pos,
   }
 }
 
-/* Draw one row of serfs. The serfs are composed of two or three transparent
-   sprites (arm, torso, possibly head). A shadow is also drawn if appropriate.
-   Note that idle serfs do not have their serf_t object linked from the map
-   so they are drawn seperately from active serfs. */
+/* Draw an idle serf. Idle serfs do not have their serf_t object linked
+   from the map so they are drawn from the map state alone. */
 void
-viewport_t::draw_serf_row(map_pos_t pos, int y_base, int cols, int x_base) {
+viewport_t::draw_idle_serf(map_pos_t pos, int x_base, int y_base) {
   const int arr_1[] = {
     0x240, 0x40, 0x380, 0x140, 0x300, 0x80, 0x180, 0x200,
     0, 0x340, 0x280, 0x100, 0x1c0, 0x2c0, 0x3c0, 0xc0
@@ -1955,83 +2028,130 @@ viewport_t::draw_serf_row(map_pos_t pos, int y_base, int cols, int x_base) {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
   };
 
+  int x, y, body;
+  if (map->is_in_water(pos)) { /* Sailor */
+    x = x_base;
+    y = y_base - 4 * map->get_height(pos);
+    body = 0x203;
+  } else { /* Transporter */
+    x = x_base + arr_3[2* map->paths(pos)];
+    y = y_base - 4 * map->get_height(pos) +
+        arr_3[2 * map->paths(pos) + 1];
+    body = arr_2[((interface->get_game()->get_tick() +
+                   arr_1[pos & 0xf]) >> 3) & 0x7f];
+  }
+
+  int color =
+        interface->get_game()->get_player(map->get_owner(pos))->get_color();
+  draw_row_serf(x, y, 1, color, body);
+}
+
+/* Objects anchored further than this above the frame are left out of
+   the draw list. Sprites extend upward from their anchor and never more
+   than this below it. There is no cull at the bottom, tall sprites
+   anchored below the frame can still reach into it. The row loop ends
+   far enough down for those. */
+#define DRAW_LIST_MARGIN  (3*MAP_TILE_HEIGHT)
+
+/* Draw pass of each item type within a map row. Flags, buildings and
+   map objects share a pass, as do active and idle serfs, so that within
+   a pass the items are drawn from left to right. */
+static const unsigned int draw_item_pass[] = {
+  0,  // DRAW_ITEM_WATER_WAVES
+  1,  // DRAW_ITEM_SERF_BEHIND
+  2,  // DRAW_ITEM_FLAG
+  2,  // DRAW_ITEM_BUILDING
+  2,  // DRAW_ITEM_MAP_OBJECT
+  3,  // DRAW_ITEM_SERF
+  3,  // DRAW_ITEM_IDLE_SERF
+};
+
+draw_item_t *
+viewport_t::add_draw_item(draw_item_type_t type, unsigned int row,
+                          unsigned int col, map_pos_t pos, int x, int y) {
+  draw_item_t item;
+  item.key = (row << 16) | (draw_item_pass[type] << 12) | col;
+  item.type = type;
+  item.pos = pos;
+  item.x = x;
+  item.y = y;
+  item.serf = NULL;
+  draw_list.push_back(item);
+  return &draw_list.back();
+}
+
+/* Add the items of one map row to the draw list. Every map position is
+   decoded once for all item types. */
+void
+viewport_t::build_draw_list_row(map_pos_t pos, unsigned int row, int y_base,
+                                int cols, int x_base, int layers) {
+  game_t *game = interface->get_game();
+  int draw_landscape = layers & VIEWPORT_LAYER_LANDSCAPE;
+  int draw_objects = layers & VIEWPORT_LAYER_OBJECTS;
+  int draw_serfs = layers & VIEWPORT_LAYER_SERFS;
+
   for (int i = 0; i < cols;
        i++, x_base += MAP_TILE_WIDTH, pos = map->move_right(pos)) {
-#if 0
-    /* Draw serf marker */
-    if (map->get_serf_index(pos) != 0) {
-      serf_t *serf = game->get_serf_at_pos(pos);
-      int color = game.player[map->get_owner(pos)]->color;
-      frame->fill_rect(x_base - 2, y_base - 4*MAP_HEIGHT(pos) - 2, 4, 4, color);
+    if (draw_landscape &&
+        (map->type_up(pos) < 4 || map->type_down(pos) < 4)) {
+      /*player->water_in_view += 1;*/
+      add_draw_item(DRAW_ITEM_WATER_WAVES, row, i, pos, x_base, y_base);
     }
-#endif
+
+    int y = y_base - 4 * map->get_height(pos);
+    if (y < -DRAW_LIST_MARGIN) continue;
 
     /* Active serf */
-    if (map->get_serf_index(pos) != 0) {
-      serf_t *serf = interface->get_game()->get_serf_at_pos(pos);
-
-      if (serf->get_state() != SERF_STATE_MINING ||
-          (serf->get_mining_substate() != 3 &&
-           serf->get_mining_substate() != 4 &&
-           serf->get_mining_substate() != 9 &&
-           serf->get_mining_substate() != 10)) {
-            draw_active_serf(serf, pos, x_base, y_base);
-          }
+    if (draw_serfs && map->get_serf_index(pos) != 0) {
+      serf_t *serf = game->get_serf_at_pos(pos);
+
+      /* Serfs that should appear behind the building at their
+         current position. */
+      bool behind = (serf->get_state() == SERF_STATE_MINING &&
+                     (serf->get_mining_substate() == 3 ||
+                      serf->get_mining_substate() == 4 ||
+                      serf->get_mining_substate() == 9 ||
+                      serf->get_mining_substate() == 10));
+      draw_item_t *item = add_draw_item(behind ? DRAW_ITEM_SERF_BEHIND :
+                                                 DRAW_ITEM_SERF,
+                                        row, i, pos, x_base, y_base);
+      item->serf = serf;
+    }
+
+    map_obj_t obj = map->get_obj(pos);
+    if (draw_objects && obj != MAP_OBJ_NONE) {
+      if (obj == MAP_OBJ_FLAG) {
+        draw_item_t *item = add_draw_item(DRAW_ITEM_FLAG, row, i, pos,
+                                          x_base, y);
+        item->flag = game->get_flag_at_pos(pos);
+      } else if (obj <= MAP_OBJ_CASTLE) {
+        draw_item_t *item = add_draw_item(DRAW_ITEM_BUILDING, row, i, pos,
+                                          x_base, y);
+        item->building = game->get_building_at_pos(pos);
+      } else if (obj >= MAP_OBJ_TREE_0) {
+        draw_item_t *item = add_draw_item(DRAW_ITEM_MAP_OBJECT, row, i, pos,
+                                          x_base, y);
+        item->sprite = obj - MAP_OBJ_TREE_0;
+      }
     }
 
     /* Idle serf */
-    if (map->get_idle_serf(pos)) {
-      int x, y, body;
-      if (map->is_in_water(pos)) { /* Sailor */
-        x = x_base;
-        y = y_base - 4 * map->get_height(pos);
-        body = 0x203;
-      } else { /* Transporter */
-        x = x_base + arr_3[2* map->paths(pos)];
-        y = y_base - 4 * map->get_height(pos) +
-            arr_3[2 * map->paths(pos) + 1];
-        body = arr_2[((interface->get_game()->get_tick() +
-                       arr_1[pos & 0xf]) >> 3) & 0x7f];
-      }
-
-      int color =
-            interface->get_game()->get_player(map->get_owner(pos))->get_color();
-      draw_row_serf(x, y, 1, color, body);
+    if (draw_serfs && map->get_idle_serf(pos)) {
+      add_draw_item(DRAW_ITEM_IDLE_SERF, row, i, pos, x_base, y_base);
     }
   }
 }
 
-/* Draw serfs that should appear behind the building at their
-   current position. */
-void
-viewport_t::draw_serf_row_behind(map_pos_t pos, int y_base, int cols,
-                                 int x_base) {
-  for (int i = 0; i < cols;
-       i++, x_base += MAP_TILE_WIDTH, pos = map->move_right(pos)) {
-    /* Active serf */
-    if (map->get_serf_index(pos) != 0) {
-      serf_t *serf = interface->get_game()->get_serf_at_pos(pos);
-
-      if (serf->get_state() == SERF_STATE_MINING &&
-          (serf->get_mining_substate() == 3 ||
-           serf->get_mining_substate() == 4 ||
-           serf->get_mining_substate() == 9 ||
-           serf->get_mining_substate() == 10)) {
-            draw_active_serf(serf, pos, x_base, y_base);
-          }
-    }
-  }
+static bool
+draw_item_less(const draw_item_t &a, const draw_item_t &b) {
+  return a.key < b.key;
 }
 
+/* Collect everything to draw in the visible part of the map in a single
+   pass, then sort it back to front. */
 void
-viewport_t::draw_game_objects(int layers) {
-  /*player->water_in_view = 0;
-  player->trees_in_view = 0;*/
-
-  int draw_landscape = layers & VIEWPORT_LAYER_LANDSCAPE;
-  int draw_objects = layers & VIEWPORT_LAYER_OBJECTS;
-  int draw_serfs = layers & VIEWPORT_LAYER_SERFS;
-  if (!draw_landscape && !draw_objects && !draw_serfs) return;
+viewport_t::build_draw_list(int layers) {
+  draw_list.clear();
 
   int cols = VIEWPORT_COLS(this);
   int short_row_len = ((cols + 1) >> 1) + 1;
@@ -2045,18 +2165,10 @@ viewport_t::draw_game_objects(int layers) {
   map_pos_t pos = map->pos(col_0, row_0);
 
   /* Loop until objects drawn fall outside the frame. */
+  unsigned int row = 0;
   while (1) {
     /* short row */
-    if (draw_landscape) draw_water_waves_row(pos, y, short_row_len, x);
-    if (draw_serfs) {
-      draw_serf_row_behind(pos, y, short_row_len, x);
-    }
-    if (draw_objects) {
-      draw_map_objects_row(pos, y, short_row_len, x);
-    }
-    if (draw_serfs) {
-      draw_serf_row(pos, y, short_row_len, x);
-    }
+    build_draw_list_row(pos, row++, y, short_row_len, x, layers);
 
     y += MAP_TILE_HEIGHT;
     if (y >= height + 6*MAP_TILE_HEIGHT) break;
@@ -2064,21 +2176,128 @@ viewport_t::draw_game_objects(int layers) {
     pos = map->move_down(pos);
 
     /* long row */
-    if (draw_landscape) {
-      draw_water_waves_row(pos, y, long_row_len, x - 16);
-    }
-    if (draw_serfs) {
-      draw_serf_row_behind(pos, y, long_row_len, x - 16);
+    build_draw_list_row(pos, row++, y, long_row_len, x - 16, layers);
+
+    y += MAP_TILE_HEIGHT;
+    if (y >= height + 6*MAP_TILE_HEIGHT) break;
+
+    pos = map->move_down_right(pos);
+  }
+
+  /* Items are added row by row, so only the passes of each row need
+     reordering. The sort is stable to keep an idle serf after the
+     active serf at the same position. */
+  std::stable_sort(draw_list.begin(), draw_list.end(), draw_item_less);
+}
+
+void
+viewport_t::draw_game_objects(int layers) {
+  /*player->water_in_view = 0;
+  player->trees_in_view = 0;*/
+
+  if (!(layers & (VIEWPORT_LAYER_LANDSCAPE | VIEWPORT_LAYER_OBJECTS |
+                  VIEWPORT_LAYER_SERFS))) {
+    return;
+  }
+
+  build_draw_list(layers);
+
+  for (draw_list_t::iterator it = draw_list.begin();
+       it != draw_list.end(); ++it) {
+    const draw_item_t &item = *it;
+    switch (item.type) {
+      case DRAW_ITEM_WATER_WAVES:
+        draw_water_waves(item.pos, item.x, item.y);
+        break;
+      case DRAW_ITEM_SERF_BEHIND:
+      case DRAW_ITEM_SERF:
+        draw_active_serf(item.serf, item.pos, item.x, item.y);
+        break;
+      case DRAW_ITEM_FLAG:
+        draw_flag_and_res(item.flag, item.x, item.y);
+        break;
+      case DRAW_ITEM_BUILDING:
+        draw_building(item.building, item.x, item.y);
+        break;
+      case DRAW_ITEM_MAP_OBJECT:
+        draw_map_object(item.sprite, item.x, item.y);
+        break;
+      case DRAW_ITEM_IDLE_SERF:
+        draw_idle_serf(item.pos, item.x, item.y);
+        break;
     }
-    if (draw_objects) {
-      draw_map_objects_row(pos, y, long_row_len, x - 16);
+  }
+}
+
+/* Draw the objects of one map row as points for a reduced level of
+   detail. Coordinates are in full detail pixels. */
+void
+viewport_t::draw_lod_objects_row(map_pos_t pos, int y_base, int cols,
+                                 int x_base, int layers) {
+  game_t *game = interface->get_game();
+
+  for (int i = 0; i < cols;
+       i++, x_base += MAP_TILE_WIDTH, pos = map->move_right(pos)) {
+    int x = x_base >> lod;
+    int y = (y_base - 4 * map->get_height(pos)) >> lod;
+    if (x < -2 || x >= width + 2 || y < -2 || y >= height + 2) continue;
+
+    if (layers & VIEWPORT_LAYER_OBJECTS) {
+      map_obj_t obj = map->get_obj(pos);
+      if (obj == MAP_OBJ_FLAG || (obj > MAP_OBJ_FLAG &&
+                                  obj <= MAP_OBJ_CASTLE)) {
+        int color = game->get_player(map->get_owner(pos))->get_color();
+        int size = (obj == MAP_OBJ_FLAG) ? 2 : 4;
+        size = std::max(1, size >> (lod - 1));
+        frame->fill_rect(x - size/2, y - size, size, size, color);
+        continue;
+      }
     }
-    if (draw_serfs) {
-      draw_serf_row(pos, y, long_row_len, x - 16);
+
+    /* Serfs are only drawn at the first reduced level. */
+    if ((layers & VIEWPORT_LAYER_SERFS) && lod == 1 &&
+        (map->get_serf_index(pos) != 0 || map->get_idle_serf(pos))) {
+      int color = game->get_player(map->get_owner(pos))->get_color();
+      frame->fill_rect(x, y - 1, 1, 1, color);
     }
+  }
+}
+
+/* Draw flags, buildings and serfs as points. Trees, stones and other
+   small objects are skipped at reduced levels of detail. */
+void
+viewport_t::draw_lod_objects(int layers) {
+  if (!(layers & (VIEWPORT_LAYER_OBJECTS | VIEWPORT_LAYER_SERFS))) return;
+
+  /* Walk the map in full detail pixels. */
+  int full_width = width << lod;
+  int full_height = height << lod;
+
+  int cols = 2*(full_width / MAP_TILE_WIDTH) + 1;
+  int short_row_len = ((cols + 1) >> 1) + 1;
+  int long_row_len = ((cols + 2) >> 1) + 1;
+
+  int x = -(offset_x + 16*(offset_y/20)) % 32;
+  int y = -(offset_y) % 20;
+
+  int col_0 = (offset_x/16 + offset_y/20)/2 & map->get_col_mask();
+  int row_0 = (offset_y/MAP_TILE_HEIGHT) & map->get_row_mask();
+  map_pos_t pos = map->pos(col_0, row_0);
+
+  while (1) {
+    /* short row */
+    draw_lod_objects_row(pos, y, short_row_len, x, layers);
 
     y += MAP_TILE_HEIGHT;
-    if (y >= height + 6*MAP_TILE_HEIGHT) break;
+    if (y >= full_height + 6*MAP_TILE_HEIGHT) break;
+
+    pos = map->move_down(pos);
+
+    /* long row */
+    draw_lod_objects_row(pos, y, long_row_len, x - 16, layers);
+
+    y += MAP_TILE_HEIGHT;
+    if (y >= full_height + 6*MAP_TILE_HEIGHT) break;
 
     pos = map->move_down_right(pos);
   }
@@ -2104,6 +2323,8 @@ viewport_t::draw_map_cursor_possible_build() {
   int row_0 = (offset_y/MAP_TILE_HEIGHT) & map->get_row_mask();
   map_pos_t base_pos = map->pos(col_0, row_0);
 
+  road_load_map_t loads;
+
   for (int x_base = x_off; x_base < width + MAP_TILE_WIDTH;
        x_base += MAP_TILE_WIDTH) {
     map_pos_t pos = base_pos;
@@ -2175,6 +2396,145 @@ viewport_t::draw_map_cursor() {
   }
 }
 
+/* Flag at the end of the road that leaves pos in direction dir when
+   following the road backwards, and the direction of the road at that
+   flag. NULL if pos is not on a road between two flags. */
+flag_t *
+viewport_t::get_road_end(map_pos_t pos, dir_t dir, dir_t *end_dir) {
+  for (int i = 0; i < 512; i++) {
+    if (map->has_flag(pos)) {
+      *end_dir = dir;
+      return interface->get_game()->get_flag(map->get_obj_index(pos));
+    }
+
+    int paths = map->paths(pos) & ~BIT(dir);
+    dir_t back = DIR_NONE;
+    for (int d = DIR_RIGHT; d <= DIR_UP; d++) {
+      if (paths == BIT(d)) {
+        back = (dir_t)d;
+        break;
+      }
+    }
+    if (back == DIR_NONE) return NULL;
+
+    pos = map->move(pos, back);
+    dir = DIR_REVERSE(back);
+  }
+
+  return NULL;
+}
+
+/* Load of the road through pos, which is not a flag, leaving pos in
+   direction dir. The road is followed only the first time one of its
+   positions is asked for; the load is then kept in loads for every
+   position of the road. */
+int
+viewport_t::get_road_load_at(map_pos_t pos, dir_t dir,
+                             road_load_map_t *loads) {
+  road_load_map_t::const_iterator it = loads->find(pos);
+  if (it != loads->end()) return it->second;
+
+  dir_t end_dir = DIR_NONE;
+  flag_t *flag = get_road_end(pos, dir, &end_dir);
+  if (flag == NULL || !flag->has_path(end_dir)) {
+    (*loads)[pos] = 0;
+    return 0;
+  }
+
+  int load = flag->get_road_load(end_dir);
+
+  map_pos_t road_pos = map->move(flag->get_position(), end_dir);
+  dir_t in_dir = end_dir;
+  for (int i = 0; i < 512 && !map->has_flag(road_pos); i++) {
+    (*loads)[road_pos] = load;
+
+    int paths = map->paths(road_pos) & ~BIT(DIR_REVERSE(in_dir));
+    dir_t next = DIR_NONE;
+    for (int d = DIR_RIGHT; d <= DIR_UP; d++) {
+      if (paths == BIT(d)) {
+        next = (dir_t)d;
+        break;
+      }
+    }
+    if (next == DIR_NONE) break;
+
+    road_pos = map->move(road_pos, next);
+    in_dir = next;
+  }
+
+  return load;
+}
+
+/* Mark each road segment with the load of its road, see
+   flag_t::get_road_load(). */
+void
+viewport_t::draw_road_load_overlay() {
+  const int load_color[] = { 0, 67, 71, 75 };
+  const int seg_dx[] = { MAP_TILE_WIDTH, MAP_TILE_WIDTH/2, -MAP_TILE_WIDTH/2 };
+
+  int x_off = -(offset_x + 16*(offset_y/20)) % 32;
+  int y_off = -offset_y % 20;
+
+  int col_0 = (offset_x/16 + offset_y/20)/2 & map->get_col_mask();
+  int row_0 = (offset_y/MAP_TILE_HEIGHT) & map->get_row_mask();
+  map_pos_t base_pos = map->pos(col_0, row_0);
+
+  road_load_map_t loads;
+
+  for (int x_base = x_off; x_base < width + MAP_TILE_WIDTH;
+       x_base += MAP_TILE_WIDTH) {
+    map_pos_t pos = base_pos;
+    int y_base = y_off;
+    int row = 0;
+
+    while (1) {
+      int x;
+      if (row % 2 == 0) {
+        x = x_base;
+      } else {
+        x = x_base - MAP_TILE_WIDTH/2;
+      }
+
+      int y = y_base - 4 * map->get_height(pos);
+      if (y >= height) break;
+
+      for (int d = DIR_RIGHT; d <= DIR_DOWN; d++) {
+        if (!map->has_path(pos, (dir_t)d)) continue;
+
+        int load = 0;
+        if (map->has_flag(pos)) {
+          flag_t *flag = interface->get_game()->get_flag(
+                                                    map->get_obj_index(pos));
+          if (flag->has_path((dir_t)d)) load = flag->get_road_load((dir_t)d);
+        } else {
+          load = get_road_load_at(pos, (dir_t)d, &loads);
+        }
+        if (load == 0) continue;
+
+        map_pos_t other_pos = map->move(pos, (dir_t)d);
+        int dx = seg_dx[d];
+        int dy = (d == DIR_RIGHT) ? 0 : MAP_TILE_HEIGHT;
+        dy -= 4 * (map->get_height(other_pos) - map->get_height(pos));
+        for (int i = 0; i < 4; i++) {
+          frame->fill_rect(x + (dx * i) / 4 - 1, y + (dy * i) / 4 - 1, 3, 3,
+                           load_color[load]);
+        }
+      }
+
+      if (row % 2 == 0) {
+        pos = map->move_down(pos);
+      } else {
+        pos = map->move_down_right(pos);
+      }
+
+      y_base += MAP_TILE_HEIGHT;
+      row += 1;
+    }
+
+    base_pos = map->move_right(base_pos);
+  }
+}
+
 void
 viewport_t::draw_base_grid_overlay(int color) {
   int x_base = -(offset_x + 16*(offset_y/20)) % 32;
@@ -2199,6 +2559,8 @@ viewport_t::draw_height_grid_overlay(int color) {
   int row_0 = (offset_y/MAP_TILE_HEIGHT) & map->get_row_mask();
   map_pos_t base_pos = map->pos(col_0, row_0);
 
+  road_load_map_t loads;
+
   for (int x_base = x_off; x_base < width + MAP_TILE_WIDTH;
        x_base += MAP_TILE_WIDTH) {
     map_pos_t pos = base_pos;
@@ -2248,6 +2610,10 @@ viewport_t::internal_draw() {
   if (layers & VIEWPORT_LAYER_LANDSCAPE) {
     draw_landscape();
   }
+  if (lod > 0) {
+    draw_lod_objects(layers);
+    return;
+  }
   if (layers & VIEWPORT_LAYER_GRID) {
     draw_base_grid_overlay(72);
     draw_height_grid_overlay(76);
@@ -2255,6 +2621,9 @@ viewport_t::internal_draw() {
   if (layers & VIEWPORT_LAYER_PATHS) {
     draw_paths_and_borders();
   }
+  if (layers & VIEWPORT_LAYER_ROAD_LOAD) {
+    draw_road_load_overlay();
+  }
   draw_game_objects(layers);
   if (layers & VIEWPORT_LAYER_CURSOR) {
     draw_map_cursor();
@@ -2460,6 +2829,7 @@ viewport_t::viewport_t(interface_t *interface, map_t *map) {
   this->map = map;
   map->add_change_handler(this);
   layers = VIEWPORT_LAYER_ALL;
+  lod = 0;
 
   last_tick = 0;
 
@@ -2469,13 +2839,26 @@ viewport_t::viewport_t(interface_t *interface, map_t *map) {
 
 viewport_t::~viewport_t() {
   map->del_change_handler(this);
-  while (landscape_tiles.size()) {
-    tiles_map_t::iterator it = landscape_tiles.begin();
-    delete it->second;
-    landscape_tiles.erase(it);
+  for (int i = 0; i < VIEWPORT_LOD_LEVELS; i++) {
+    while (landscape_tiles[i].size()) {
+      tiles_map_t::iterator it = landscape_tiles[i].begin();
+      delete it->second;
+      landscape_tiles[i].erase(it);
+    }
   }
 }
 
+/* Change the level of detail, keeping the map position at the center
+   of the viewport. */
+void
+viewport_t::set_lod(unsigned int lod) {
+  if (lod >= VIEWPORT_LOD_LEVELS || lod == this->lod) return;
+
+  map_pos_t pos = get_current_map_pos();
+  this->lod = lod;
+  move_to_map_pos(pos);
+}
+
 void
 viewport_t::changed_height(map_pos_t pos) {
   redraw_map_pos(pos);
@@ -2540,6 +2923,9 @@ viewport_t::screen_pix_from_map_pix(int mx, int my, int *sx, int *sy) {
 
   while (*sx < 0) *sx += width;
   while (*sx >= width) *sx -= width;
+
+  *sx >>= lod;
+  *sy >>= lod;
 }
 
 void
@@ -2562,6 +2948,9 @@ viewport_t::map_pix_from_map_coord(map_pos_t pos, int h, int *mx, int *my) {
 
 map_pos_t
 viewport_t::map_pos_from_screen_pix(int sx, int sy) {
+  sx <<= lod;
+  sy <<= lod;
+
   int x_off = -(offset_x + 16*(offset_y/20)) % 32;
   int y_off = -offset_y % 20;
 
@@ -2616,8 +3005,8 @@ viewport_t::move_to_map_pos(map_pos_t pos) {
   int map_height = map->get_rows()*MAP_TILE_HEIGHT;
 
   /* Center screen. */
-  mx -= width/2;
-  my -= height/2;
+  mx -= (width << lod)/2;
+  my -= (height << lod)/2;
 
   if (my < 0) {
     mx -= (map->get_rows()*MAP_TILE_WIDTH)/2;
@@ -2638,8 +3027,8 @@ viewport_t::move_by_pixels(int x, int y) {
   int width = map->get_cols()*MAP_TILE_WIDTH;
   int height = map->get_rows()*MAP_TILE_HEIGHT;
 
-  offset_x += x;
-  offset_y += y;
+  offset_x += x * (1 << lod);
+  offset_y += y * (1 << lod);
 
   if (offset_y < 0) {
     offset_y += height;
@@ -23,6 +23,7 @@
 #define SRC_VIEWPORT_H_
 
 #include <map>
+#include <vector>
 
 #include "src/gui.h"
 #include "src/map.h"
@@ -37,6 +38,7 @@ typedef enum {
   VIEWPORT_LAYER_CURSOR = 1<<4,
   VIEWPORT_LAYER_GRID = 1<<5,
   VIEWPORT_LAYER_BUILDS = 1<<6,
+  VIEWPORT_LAYER_ROAD_LOAD = 1<<7,
   VIEWPORT_LAYER_ALL = (VIEWPORT_LAYER_LANDSCAPE |
                         VIEWPORT_LAYER_PATHS |
                         VIEWPORT_LAYER_OBJECTS |
@@ -44,28 +46,77 @@ typedef enum {
                         VIEWPORT_LAYER_CURSOR),
 } viewport_layer_t;
 
+/* Number of levels of detail. At level n the map is drawn at 1/2^n of
+   its size, from a downsampled copy of the landscape tiles. Serfs and
+   objects are drawn as points, or not at all when zoomed out further. */
+#define VIEWPORT_LOD_LEVELS  4
+
 class interface_t;
 class data_source_t;
+class flag_t;
+class sprite_preloader_t;
+
+/* Kinds of items in the per-frame draw list, in the order they are drawn
+   within one map row. Flags, buildings and map objects are drawn in one
+   pass from left to right, and so are active and idle serfs. */
+typedef enum {
+  DRAW_ITEM_WATER_WAVES = 0,
+  DRAW_ITEM_SERF_BEHIND,
+  DRAW_ITEM_FLAG,
+  DRAW_ITEM_BUILDING,
+  DRAW_ITEM_MAP_OBJECT,
+  DRAW_ITEM_SERF,
+  DRAW_ITEM_IDLE_SERF,
+} draw_item_type_t;
+
+/* One sprite (or sprite group) to draw for a map position. The key orders
+   the items back to front: map row first, then draw pass, then column. */
+typedef struct {
+  unsigned int key;
+  draw_item_type_t type;
+  map_pos_t pos;
+  int x, y;
+  union {
+    serf_t *serf;
+    building_t *building;
+    flag_t *flag;
+    int sprite;
+  };
+} draw_item_t;
 
 class viewport_t : public gui_object_t, public update_map_height_handler_t {
  protected:
-  /* Cache prerendered tiles of the landscape. */
+  /* Cache prerendered tiles of the landscape, one for each level of
+     detail. */
   typedef std::map<unsigned int, frame_t*> tiles_map_t;
-  tiles_map_t landscape_tiles;
+  tiles_map_t landscape_tiles[VIEWPORT_LOD_LEVELS];
 
   int offset_x, offset_y;
   unsigned int layers;
+  unsigned int lod;
   interface_t *interface;
   unsigned int last_tick;
   data_source_t *data_source;
 
   map_t *map;
 
+  /* Draw list, rebuilt on every draw. Kept to reuse its storage. */
+  typedef std::vector<draw_item_t> draw_list_t;
+  draw_list_t draw_list;
+
+  /* Load of the road through each position, filled in one road at a
+     time while drawing the road load overlay. */
+  typedef std::map<map_pos_t, int> road_load_map_t;
+
  public:
   viewport_t(interface_t *interface, map_t *map);
   virtual ~viewport_t();
 
-  void switch_layer(viewport_layer_t layer) { layers ^= layer; }
+  void switch_layer(viewport_layer_t layer) {
+    layers ^= layer; set_redraw(); }
+
+  unsigned int get_lod() const { return lod; }
+  void set_lod(unsigned int lod);
 
   void move_to_map_pos(map_pos_t pos);
   void move_by_pixels(int x, int y);
@@ -79,6 +130,9 @@ class viewport_t : public gui_object_t, public update_map_height_handler_t {
 
   void update();
 
+  /* Add the masked ground sprites used by the landscape. */
+  static void add_preload_sprites(sprite_preloader_t *preloader);
+
  protected:
   void draw_triangle_up(int x, int y, int m, int left, int right, map_pos_t pos,
                         frame_t *frame);
@@ -89,9 +143,16 @@ class viewport_t : public gui_object_t, public update_map_height_handler_t {
   void draw_down_tile_col(map_pos_t pos, int x_base, int y_base, int max_y,
                           frame_t *frame);
   void draw_landscape();
+  void draw_lod_objects_row(map_pos_t pos, int y_base, int cols, int x_base,
+                            int layers);
+  void draw_lod_objects(int layers);
   void draw_path_segment(int x, int y, map_pos_t pos, dir_t dir);
   void draw_border_segment(int x, int y, map_pos_t pos, dir_t dir);
   void draw_paths_and_borders();
+  flag_t *get_road_end(map_pos_t pos, dir_t dir, dir_t *end_dir);
+  int get_road_load_at(map_pos_t pos, dir_t dir, road_load_map_t *loads);
+  void draw_road_load_overlay();
+  void play_sound_at(int sound, map_pos_t pos);
   void draw_game_sprite(int x, int y, int index);
   void draw_serf(int x, int y, unsigned char color, int head, int body);
   void draw_shadow_and_building_sprite(int x, int y, int index);
@@ -101,16 +162,19 @@ class viewport_t : public gui_object_t, public update_map_height_handler_t {
                                 int x, int y);
   void draw_unharmed_building(building_t *building, int x, int y);
   void draw_burning_building(building_t *building, int x, int y);
-  void draw_building(map_pos_t pos, int x, int y);
+  void draw_building(building_t *building, int x, int y);
   void draw_water_waves(map_pos_t pos, int x, int y);
-  void draw_water_waves_row(map_pos_t pos, int y_base, int cols, int x_base);
-  void draw_flag_and_res(map_pos_t pos, int x, int y);
-  void draw_map_objects_row(map_pos_t pos, int y_base, int cols, int x_base);
+  void draw_flag_and_res(flag_t *flag, int x, int y);
+  void draw_map_object(int sprite, int x, int y);
   void draw_row_serf(int x, int y, int shadow, int color, int body);
   int serf_get_body(serf_t *serf);
   void draw_active_serf(serf_t *serf, map_pos_t pos, int x_base, int y_base);
-  void draw_serf_row(map_pos_t pos, int y_base, int cols, int x_base);
-  void draw_serf_row_behind(map_pos_t pos, int y_base, int cols, int x_base);
+  void draw_idle_serf(map_pos_t pos, int x_base, int y_base);
+  draw_item_t *add_draw_item(draw_item_type_t type, unsigned int row,
+                             unsigned int col, map_pos_t pos, int x, int y);
+  void build_draw_list_row(map_pos_t pos, unsigned int row, int y_base,
+                           int cols, int x_base, int layers);
+  void build_draw_list(int layers);
   void draw_game_objects(int layers);
   void draw_map_cursor_sprite(map_pos_t pos, int sprite);
   void draw_map_cursor_possible_build();
@@ -124,7 +188,8 @@ class viewport_t : public gui_object_t, public update_map_height_handler_t {
   virtual bool handle_dbl_click(int x, int y, event_button_t button);
   virtual bool handle_drag(int x, int y);
 
-  frame_t *get_tile_frame(unsigned int tid, int tc, int tr);
+  frame_t *render_tile_frame(int tc, int tr);
+  frame_t *get_tile_frame(unsigned int tid, int tc, int tr, unsigned int lod);
 
  public:
   void changed_height(map_pos_t pos);